@@ -0,0 +1,220 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         benchrun.c                                               */
+/*                                                                        */
+/* description:  Runs a command a number of times and reports wall time,  */
+/*               throughput (MB/s, samples/s) and peak RSS as one JSON    */
+/*               line, for the benchmark suite.                           */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/* Maximum number of -i files */
+#define MAX_INPUTS  4096
+
+/* Measurements of one run */
+typedef struct {
+  double wall;        /* Seconds, monotonic clock */
+  double user;        /* CPU seconds in user mode */
+  double system;      /* CPU seconds in the kernel */
+  long max_rss;       /* Peak resident set size, KB */
+  int status;         /* Exit status, or 128 + signal */
+} Run;
+
+static double seconds(const struct timeval *tv)
+{
+  return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* Run the command once, with its output discarded unless verbose */
+static int runOnce(char **command, bool verbose, Run *run)
+{
+  struct timespec start, stop;
+  struct rusage usage;
+  int status;
+  pid_t pid;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if ((pid = fork()) < 0)
+    return -1;
+
+  if (pid == 0) {
+    if (!verbose) {
+      int null = open("/dev/null", O_WRONLY);
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+    }
+    execvp(command[0], command);
+    _exit(127);
+  }
+
+  if (wait4(pid, &status, 0, &usage) < 0)
+    return -1;
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  run->wall = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+  run->user = seconds(&usage.ru_utime);
+  run->system = seconds(&usage.ru_stime);
+#ifdef __APPLE__
+  run->max_rss = usage.ru_maxrss / 1024;  /* Bytes on macOS */
+#else
+  run->max_rss = usage.ru_maxrss;         /* KB on Linux and BSD */
+#endif
+  run->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  return 0;
+}
+
+/* Number of samples in the data chunk of a WAV file, -1 if unreadable */
+static long long wavSamples(const char *filename)
+{
+  unsigned char chunk[8], format[16];
+  unsigned channels = 1, bits = 8;
+  FILE *file;
+  long long samples = -1;
+
+  if ((file = fopen(filename, "rb")) == NULL)
+    return -1;
+
+  /* RIFF header, then chunks: 4-byte id, 4-byte little-endian size */
+  if (fread(chunk, 1, 8, file) == 8 && !memcmp(chunk, "RIFF", 4) &&
+      fread(chunk, 1, 4, file) == 4 && !memcmp(chunk, "WAVE", 4)) {
+    while (fread(chunk, 1, 8, file) == 8) {
+      uint32_t size = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (uint32_t)chunk[7] << 24;
+      if (!memcmp(chunk, "fmt ", 4) && size >= 16 && fread(format, 1, 16, file) == 16) {
+        channels = format[2] | format[3] << 8;
+        bits = format[14] | format[15] << 8;
+        fseek(file, size - 16 + (size & 1), SEEK_CUR);
+      }
+      else if (!memcmp(chunk, "data", 4)) {
+        unsigned frame = channels * ((bits + 7) / 8);
+        samples = size / (frame ? frame : 1);
+        break;
+      }
+      else
+        fseek(file, size + (size & 1), SEEK_CUR);
+    }
+  }
+  fclose(file);
+  return samples;
+}
+
+/* Write a JSON string literal */
+static void printString(const char *s)
+{
+  putchar('"');
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      putchar('\\');
+    putchar(*s);
+  }
+  putchar('"');
+}
+
+/* Display usage information and command-line options */
+static void showUsage(char *progname)
+{
+  printf("usage: %s [-n runs] [-t tool] [-l case] [-i file]... [-w wavfile] [-v]\n"
+         "       -- command [args...]\n"
+         " -n   number of runs, the fastest one is reported (default: 3)\n"
+         " -t   tool name for the report\n"
+         " -l   case name for the report\n"
+         " -i   input file whose size counts for MB/s (repeatable)\n"
+         " -w   WAV file whose sample count counts for samples/s\n"
+         " -v   show the output of the command\n"
+   ,progname);
+}
+
+int main(int argc, char* argv[])
+{
+  const char *tool = "", *label = "", *wav = NULL;
+  const char *inputs[MAX_INPUTS];
+  int input_count = 0, runs = 3, i;
+  bool verbose = false;
+  unsigned long long bytes = 0;
+  long long samples = -1;
+  long max_rss = 0;
+  Run best, run;
+  int status = 0;
+
+  for (i=1; i<argc; i++) {
+    if (!strcmp(argv[i], "--")) {
+      i++;
+      break;
+    }
+    if (!strcmp(argv[i], "-v"))
+      verbose = true;
+    else if (i+1 < argc && !strcmp(argv[i], "-n"))
+      runs = atoi(argv[++i]);
+    else if (i+1 < argc && !strcmp(argv[i], "-t"))
+      tool = argv[++i];
+    else if (i+1 < argc && !strcmp(argv[i], "-l"))
+      label = argv[++i];
+    else if (i+1 < argc && !strcmp(argv[i], "-w"))
+      wav = argv[++i];
+    else if (i+1 < argc && !strcmp(argv[i], "-i") && input_count < MAX_INPUTS)
+      inputs[input_count++] = argv[++i];
+    else {
+      fprintf(stderr,"%s: invalid option '%s'\n",argv[0],argv[i]);
+      exit(1);
+    }
+  }
+  if (i >= argc || runs < 1) {
+    showUsage(argv[0]);
+    exit(1);
+  }
+
+  /* Keep the fastest run; peak RSS is the maximum over all runs */
+  for (int n = 0; n < runs; n++) {
+    if (runOnce(argv + i, verbose, &run) < 0) {
+      fprintf(stderr,"%s: failed running %s\n",argv[0],argv[i]);
+      exit(1);
+    }
+    if (n == 0 || run.wall < best.wall)
+      best = run;
+    if (run.max_rss > max_rss)
+      max_rss = run.max_rss;
+    if (run.status != 0)
+      status = run.status;
+  }
+
+  /* Sizes are taken after the runs, so outputs can be measured too */
+  for (int n = 0; n < input_count; n++) {
+    struct stat st;
+    if (stat(inputs[n], &st) == 0)
+      bytes += st.st_size;
+  }
+  if (wav != NULL)
+    samples = wavSamples(wav);
+
+  printf("{\"tool\":");
+  printString(tool);
+  printf(",\"case\":");
+  printString(label);
+  printf(",\"runs\":%d,\"seconds\":%.6f,\"user\":%.6f,\"system\":%.6f",
+         runs, best.wall, best.user, best.system);
+  printf(",\"bytes\":%llu,\"mb_s\":%.3f", bytes,
+         best.wall > 0 ? bytes / best.wall / 1e6 : 0.0);
+  if (samples >= 0)
+    printf(",\"samples\":%lld,\"samples_s\":%.0f", samples,
+           best.wall > 0 ? samples / best.wall : 0.0);
+  printf(",\"max_rss_kb\":%ld,\"status\":%d}\n", max_rss, status);
+
+  return status ? 1 : 0;
+}
@@ -0,0 +1,298 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         casgen.c                                                 */
+/*                                                                        */
+/* description:  Generates a deterministic corpus of synthetic .cas       */
+/*               images (BIN, BASIC, multi-block ASCII and mixed          */
+/*               compilations) for the benchmark suite.                   */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lib/caslib.h"
+#include "lib/casindex.h"
+
+/* ASCII files are split into blocks of this size */
+#define ASCII_BLOCK   256
+
+/* MSX tape EOF marker (Ctrl-Z) */
+#define EOF_MARKER    0x1A
+
+/* Start of BASIC program text in RAM (TXTTAB) */
+#define BASIC_START   0x8001
+
+/* Kind of content in a corpus image */
+typedef enum {
+  MIX_BINARY,    /* BIN files: random machine code */
+  MIX_BASIC,     /* Tokenised BASIC programs */
+  MIX_ASCII,     /* Multi-block ASCII text */
+  MIX_ALL        /* Compilation of all of the above and a custom block */
+} MixType;
+
+/* One image of the corpus */
+typedef struct {
+  const char *name;
+  MixType mix;
+  int files;     /* Files in the image */
+  size_t size;   /* Payload bytes per file (compilations: maximum) */
+} CorpusImage;
+
+static const CorpusImage corpus[] = {
+  { "bin-1k",     MIX_BINARY, 1,  1024  },
+  { "bin-32k",    MIX_BINARY, 1,  32768 },
+  { "basic-8k",   MIX_BASIC,  1,  8192  },
+  { "ascii-16k",  MIX_ASCII,  1,  16384 },
+  { "mixed-24",   MIX_ALL,    24, 4096  },
+};
+
+/* Output image being assembled */
+typedef struct {
+  unsigned char *data;
+  size_t size;
+  size_t capacity;
+} Image;
+
+/* xorshift64* generator: same corpus on every platform */
+static uint64_t state;
+
+static uint32_t nextRandom(void)
+{
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return (uint32_t)((state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static void append(Image *image, const void *data, size_t size)
+{
+  if (image->size + size > image->capacity) {
+    while (image->size + size > image->capacity)
+      image->capacity = image->capacity ? image->capacity * 2 : 65536;
+    image->data = (unsigned char*)realloc(image->data, image->capacity);
+    if (image->data == NULL) {
+      fprintf(stderr,"out of memory\n");
+      exit(1);
+    }
+  }
+  memcpy(image->data + image->size, data, size);
+  image->size += size;
+}
+
+/* Zero-pad to the next 8-byte boundary */
+static void addPadding(Image *image)
+{
+  static const unsigned char zero[8];
+  append(image, zero, (8 - (image->size & 7)) & 7);
+}
+
+/* Pad and add a HEADER */
+static void addHeader(Image *image)
+{
+  addPadding(image);
+  append(image, HEADER, sizeof(HEADER));
+}
+
+/* Add a header block with a type marker and a numbered name */
+static void addFileHeader(Image *image, const char *marker, const char *prefix, int number)
+{
+  char name[7];
+
+  snprintf(name, sizeof(name), "%s%02d    ", prefix, number % 100);
+  addHeader(image);
+  append(image, marker, 10);
+  append(image, name, 6);
+}
+
+/* Add a BIN/BASIC data block: addresses, then the program */
+static void addProgram(Image *image, uint16_t start, const unsigned char *program,
+                       size_t size, uint16_t exec)
+{
+  unsigned char addresses[DATA_HEADER_SIZE];
+  uint16_t stop = start + size;
+
+  addresses[0] = start & 0xff; addresses[1] = start >> 8;
+  addresses[2] = stop & 0xff;  addresses[3] = stop >> 8;
+  addresses[4] = exec & 0xff;  addresses[5] = exec >> 8;
+  addHeader(image);
+  append(image, addresses, sizeof(addresses));
+  append(image, program, size);
+}
+
+/* BIN file of random bytes: both bit values equally likely */
+static void addBinary(Image *image, int number, size_t size)
+{
+  unsigned char *program = (unsigned char*)malloc(size);
+  uint16_t start = size <= 0x4000 ? 0xC000 : 0x4000;
+
+  for (size_t i = 0; i < size; i++)
+    program[i] = nextRandom() & 0xff;
+  addFileHeader(image, BIN, "BIN", number);
+  addProgram(image, start, program, size, start);
+  free(program);
+}
+
+/* BASIC program of numbered lines with common statements */
+static void addBasic(Image *image, int number, size_t size)
+{
+  static const unsigned char statements[][12] = {
+    { 0x91, ' ', '"', 'H', 'E', 'L', 'L', 'O', '"', ';', 'A' },       /* PRINT "HELLO";A */
+    { 0x82, ' ', 'I', 0xEF, 0x12, ' ', 0xD9, ' ', 0x0F, 0x64 },       /* FOR I=1 TO 100 */
+    { 0x98, ' ', 0x0C, 0x00, 0xC0, ',', 'I' },                        /* POKE &HC000,I */
+    { 0x8B, ' ', 'A', 0xEE, 0x1C, 0x10, 0x27, ' ', 0xDA, ' ', 0x0E }, /* IF A>10000 THEN n */
+    { 0x8F, ' ', 'L', 'O', 'O', 'P' },                                /* REM LOOP */
+  };
+  static const size_t lengths[] = { 11, 10, 7, 11, 6 };
+  unsigned char *program = (unsigned char*)malloc(size + 64);
+  size_t length = 0;
+  unsigned line = 10;
+
+  /* Lines: next-line link, line number, statement, 0 */
+  while (length + 4 + 13 + 2 <= size) {
+    int pick = nextRandom() % 5;
+    size_t start = length;
+    uint16_t link;
+
+    length += 4;
+    memcpy(program + length, statements[pick], lengths[pick]);
+    length += lengths[pick];
+    if (pick == 3) {
+      program[length++] = line & 0xff;
+      program[length++] = line >> 8;
+    }
+    program[length++] = 0;
+
+    link = BASIC_START + length;
+    program[start]   = link & 0xff;
+    program[start+1] = link >> 8;
+    program[start+2] = line & 0xff;
+    program[start+3] = line >> 8;
+    line += 10;
+  }
+  program[length++] = 0;
+  program[length++] = 0;
+
+  addFileHeader(image, BASIC, "BAS", number);
+  addProgram(image, BASIC_START, program, length, 0);
+  free(program);
+}
+
+/* ASCII file of text lines in 256-byte blocks, padded with EOF markers */
+static void addAscii(Image *image, int number, size_t size)
+{
+  static const char *const words[] = {
+    "10 ", "PRINT ", "GOTO ", "DATA ", "HELLO ", "MSX ", "TAPE ", "1200 "
+  };
+  unsigned char block[ASCII_BLOCK];
+  size_t length = 0, used = 0;
+
+  addFileHeader(image, ASCII, "ASC", number);
+  while (length < size) {
+    const char *word = (nextRandom() % 8 == 0) ? "\r\n" : words[nextRandom() % 8];
+    for (; *word && length < size; word++, length++) {
+      block[used++] = *word;
+      if (used == ASCII_BLOCK) {
+        addHeader(image);
+        append(image, block, used);
+        used = 0;
+      }
+    }
+  }
+  memset(block + used, EOF_MARKER, ASCII_BLOCK - used);
+  addHeader(image);
+  append(image, block, ASCII_BLOCK);
+}
+
+/* Headerless block, as written for custom loaders */
+static void addCustom(Image *image, size_t size)
+{
+  unsigned char *data = (unsigned char*)malloc(size);
+
+  for (size_t i = 0; i < size; i++)
+    data[i] = nextRandom() & 0xff;
+  addHeader(image);
+  append(image, data, size);
+  free(data);
+}
+
+/* Assemble one corpus image */
+static void generate(Image *image, const CorpusImage *spec)
+{
+  for (int i = 0; i < spec->files; i++) {
+    MixType mix = spec->mix == MIX_ALL ? (MixType)(i % 3) : spec->mix;
+    size_t size = spec->mix == MIX_ALL ? 256 + nextRandom() % (spec->size - 255) : spec->size;
+
+    switch (mix) {
+      case MIX_BINARY: addBinary(image, i, size); break;
+      case MIX_BASIC:  addBasic(image, i, size);  break;
+      default:         addAscii(image, i, size);  break;
+    }
+  }
+  if (spec->mix == MIX_ALL)
+    addCustom(image, 512);
+  addPadding(image);
+}
+
+/* Display usage information and command-line options */
+static void showUsage(char *progname)
+{
+  printf("usage: %s [-s seed] <odir>\n"
+         " -s   random seed (default: 1)\n"
+         " writes the benchmark corpus to odir, one .cas file per line of output\n"
+   ,progname);
+}
+
+int main(int argc, char* argv[])
+{
+  const char *odir = NULL;
+  uint64_t seed = 1;
+
+  for (int i=1; i<argc; i++) {
+    if (argv[i][0]=='-' && argv[i][1]!='\0') {
+      if (!strcmp(argv[i], "-s") && i+1 < argc)
+        seed = strtoull(argv[++i], NULL, 0);
+      else {
+        fprintf(stderr,"%s: invalid option '%s'\n",argv[0],argv[i]);
+        exit(1);
+      }
+      continue;
+    }
+    if (odir == NULL) { odir = argv[i]; continue; }
+    fprintf(stderr,"%s: too many arguments\n",argv[0]);
+    exit(1);
+  }
+  if (odir == NULL) {
+    showUsage(argv[0]);
+    exit(1);
+  }
+
+  for (size_t i = 0; i < sizeof(corpus) / sizeof(corpus[0]); i++) {
+    Image image = { NULL, 0, 0 };
+    char filename[4096];
+    FILE *output;
+
+    /* Every image has its own stream, so adding images keeps the others */
+    state = seed * 0x9E3779B97F4A7C15ULL + i + 1;
+
+    generate(&image, &corpus[i]);
+    snprintf(filename, sizeof(filename), "%s/%s.cas", odir, corpus[i].name);
+    if ((output = fopen(filename, "wb")) == NULL ||
+        fwrite(image.data, 1, image.size, output) != image.size ||
+        fclose(output) != 0) {
+      fprintf(stderr,"%s: failed writing %s\n",argv[0],filename);
+      exit(1);
+    }
+    printf("%s\n", filename);
+    free(image.data);
+  }
+
+  return 0;
+}
@@ -0,0 +1,438 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         microbench.c                                             */
+/*                                                                        */
+/* description:  Microbenchmarks for the encoder and decoder kernels of   */
+/*               caslib and wavlib on fixed buffers: ns per sample or     */
+/*               per byte, with warm-up, repetitions and spread.          */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "lib/caslib.h"
+#include "lib/wavlib.h"
+#include "lib/simd.h"
+
+/* Upper limit for -r */
+#define MAX_REPS        1000
+
+/* Cross-check: random cases per kernel, largest buffer */
+#define CHECK_CASES     2000
+#define CHECK_SIZE      4096
+
+/* Encoder calls per repetition */
+#define PULSE_CALLS     100000
+#define SYNC_CALLS      4
+
+/* One kernel under test */
+typedef struct {
+  const char *name;
+  const char *unit;             /* "sample" or "byte" */
+  void (*prepare)(void);        /* Untimed, before every run (may be NULL) */
+  double (*run)(void);          /* Timed; returns the units processed */
+} Kernel;
+
+/* Fixture: the recording of a sync header, random bytes and a silence,
+ * as cas2wav writes it */
+static unsigned char *raw8;     /* 8-bit unsigned mono */
+static unsigned char *raw16;    /* Same signal, 16-bit stereo */
+static int8_t *signal;          /* Converted, as wav2cas decodes it */
+static int8_t *work;            /* Scratch copy for in-place kernels */
+static int32_t samples;
+static unsigned char *bytes;    /* Random payload */
+static size_t byte_count;
+
+static Decoder dec = DECODER_DEFAULTS;
+static WriteBuffer wb;
+static volatile long sink;      /* Keeps results alive */
+
+/* xorshift64*: the same fixture on every run */
+static uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+static uint32_t nextRandom(void)
+{
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return (uint32_t)((state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/* Pulse length in samples, as writePulse computes it */
+static uint32_t pulseLength(uint32_t freq)
+{
+  return (uint32_t)(wb.output_frequency / (wb.baudrate * (freq / 1200.0)));
+}
+
+static void copySignal(void)
+{
+  memcpy(work, signal, samples);
+}
+
+static double runConvert8(void)
+{
+  convertSamples(raw8, samples, 1, 8, dec.phase, work);
+  return samples;
+}
+
+static double runConvert16(void)
+{
+  convertSamples(raw16, samples, 4, 16, dec.phase, work);
+  return samples;
+}
+
+static double runEnvelope(void)
+{
+  correctEnvelope(work, samples);
+  return samples;
+}
+
+static double runNormalize(void)
+{
+  normalizeAmplitude(work, samples);
+  return samples;
+}
+
+/* Silence check at every position, as the decoder loops do */
+static double runSilence(void)
+{
+  long silent = 0;
+  for (int32_t i = 0; i < samples; i++)
+    silent += isSilence(&dec, signal, i, samples);
+  sink = silent;
+  return samples;
+}
+
+/* Walk the whole signal pulse by pulse */
+static double runPulseWidth(void)
+{
+  int32_t index = 0;
+  long total = 0;
+  while (index < samples)
+    total += getPulseWidth(&dec, signal, &index, samples);
+  sink = total;
+  return samples;
+}
+
+static double runWritePulse(void)
+{
+  for (int i = 0; i < PULSE_CALLS; i += 2) {
+    writePulse(&wb, LONG_PULSE);
+    writePulse(&wb, SHORT_PULSE);
+  }
+  return PULSE_CALLS / 2 * (double)(pulseLength(LONG_PULSE) + pulseLength(SHORT_PULSE));
+}
+
+static double runWriteByte(void)
+{
+  for (size_t i = 0; i < byte_count; i++)
+    writeByte(&wb, bytes[i]);
+  return byte_count;
+}
+
+static double runWriteSync(void)
+{
+  for (int i = 0; i < SYNC_CALLS; i++)
+    writeSync(&wb, SYNC_BLOCK);
+  return SYNC_CALLS * (double)(int)(SYNC_BLOCK * (wb.baudrate / 1200.0)) *
+         2 * pulseLength(SHORT_PULSE);
+}
+
+static const Kernel kernels[] = {
+  { "tapeRead-8bit",      "sample", NULL,       runConvert8   },
+  { "tapeRead-16bit",     "sample", NULL,       runConvert16  },
+  { "correctEnvelope",    "sample", copySignal, runEnvelope   },
+  { "normalizeAmplitude", "sample", copySignal, runNormalize  },
+  { "isSilence",          "sample", NULL,       runSilence    },
+  { "getPulseWidth",      "sample", NULL,       runPulseWidth },
+  { "writePulse",         "sample", NULL,       runWritePulse },
+  { "writeByte",          "byte",   NULL,       runWriteByte  },
+  { "writeSync",          "sample", NULL,       runWriteSync  },
+};
+
+/* Encode the fixture with cas2wav's kernels and read it back */
+static int makeFixture(size_t count)
+{
+  FILE *file = tmpfile();
+  long size;
+
+  if (file == NULL)
+    return -1;
+  byte_count = count;
+  if ((bytes = (unsigned char*)malloc(count)) == NULL)
+    return -1;
+  for (size_t i = 0; i < count; i++)
+    bytes[i] = nextRandom() & 0xff;
+
+  initWriteBuffer(&wb, file, 1200, OUTPUT_FREQUENCY);
+  writeSilence(&wb, SHORT_SILENCE);
+  writeSync(&wb, SYNC_BLOCK);
+  for (size_t i = 0; i < count; i++)
+    writeByte(&wb, bytes[i]);
+  writeSilence(&wb, SHORT_SILENCE);
+  flushWriteBuffer(&wb);
+
+  size = ftell(file);
+  rewind(file);
+  samples = size;
+  raw8 = (unsigned char*)malloc(samples);
+  raw16 = (unsigned char*)malloc((size_t)samples * 4);
+  signal = (int8_t*)malloc(samples);
+  work = (int8_t*)malloc(samples);
+  if (!raw8 || !raw16 || !signal || !work ||
+      fread(raw8, 1, samples, file) != (size_t)samples) {
+    fclose(file);
+    return -1;
+  }
+  fclose(file);
+
+  for (int32_t i = 0; i < samples; i++) {
+    int16_t v = (int16_t)((raw8[i] - 128) << 8);
+    for (int ch = 0; ch < 2; ch++) {
+      raw16[i*4 + ch*2]     = v & 0xff;
+      raw16[i*4 + ch*2 + 1] = (v >> 8) & 0xff;
+    }
+  }
+  convertSamples(raw8, samples, 1, 8, dec.phase, signal);
+  return 0;
+}
+
+/* Report a kernel that differs from the reference */
+static int mismatch(const char *isa, const char *kernel, int size, int offset)
+{
+  fprintf(stderr,"%s: %s differs from scalar (size %d, offset %d)\n",isa,kernel,size,offset);
+  return 1;
+}
+
+/* Compare one kernel table with the scalar reference on random buffers of
+ * random sizes and alignments; returns the number of differences */
+static int crossCheck(const SimdKernels *k)
+{
+  const SimdKernels *ref = &simd_scalar;
+  static unsigned char raw[CHECK_SIZE * 6 + 64];
+  static int8_t a[CHECK_SIZE + 64], b[CHECK_SIZE + 64];
+  static const int frames[] = { 1, 2, 3, 4, 6 };
+  int errors = 0;
+
+  for (size_t i = 0; i < sizeof(raw); i++)
+    raw[i] = nextRandom() & 0xff;
+
+  for (int n = 0; n < CHECK_CASES && errors == 0; n++) {
+    /* Short buffers first: they exercise the vector tails */
+    int size = nextRandom() % (n < CHECK_CASES / 2 ? 200 : CHECK_SIZE);
+    int offset = nextRandom() % 64;
+    int frame = frames[nextRandom() % 5];
+    int bits = frame % 2 || nextRandom() % 2 ? 8 : 16;
+    bool phase = nextRandom() % 2;
+    int spikes = 2 + nextRandom() % 200;
+    int threshold = (int)(nextRandom() % 300) - 150;
+    int lo = -(int)(nextRandom() % 140), hi = (int)(nextRandom() % 140);
+    int maximum;
+
+    /* Output one byte into the buffers, to catch writes past the end */
+    memset(a, 0, size + 2);
+    memset(b, 0, size + 2);
+    ref->convert(raw + offset, size, frame, bits, phase, a + 1);
+    k->convert(raw + offset, size, frame, bits, phase, b + 1);
+    if (memcmp(a, b, size + 2))
+      errors += mismatch(k->name, "convert", size, offset);
+
+    /* Full-range signal, sometimes attenuated, for the filters */
+    for (int i = 0; i < size; i++)
+      a[offset + i] = b[offset + i] = (int8_t)(nextRandom() & 0xff) / (1 + spikes % 4);
+    ref->envelope(a + offset, size);
+    k->envelope(b + offset, size);
+    if (memcmp(a + offset, b + offset, size))
+      errors += mismatch(k->name, "envelope", size, offset);
+
+    maximum = ref->peak(a + offset, size);
+    if (k->peak(a + offset, size) != maximum)
+      errors += mismatch(k->name, "peak", size, offset);
+    memcpy(b + offset, a + offset, size);
+    ref->scale(a + offset, size, maximum ? 127 / (float)maximum : 1.0f);
+    k->scale(b + offset, size, maximum ? 127 / (float)maximum : 1.0f);
+    if (memcmp(a + offset, b + offset, size))
+      errors += mismatch(k->name, "scale", size, offset);
+
+    /* Quiet signal with the odd spike, for the silence search */
+    for (int i = 0; i < size; i++)
+      a[offset + i] = nextRandom() % spikes == 0 ? (int8_t)(nextRandom() & 0xff)
+                                                 : (int8_t)(nextRandom() % 9) - 4;
+    for (int start = 0; start <= size; start += 1 + size / 8) {
+      if (ref->find(a + offset, start, size, lo, hi) != k->find(a + offset, start, size, lo, hi) ||
+          ref->find(a + offset, start, size, 1 - threshold, threshold - 1) !=
+          k->find(a + offset, start, size, 1 - threshold, threshold - 1)) {
+        errors += mismatch(k->name, "find", size, offset);
+        break;
+      }
+    }
+  }
+
+  /* Envelope filter: every input triple */
+  for (int x = -128; x < 128 && errors == 0; x++)
+    for (int y = -128; y < 128 && errors == 0; y++)
+      for (int z = -128; z < 128; z++) {
+        int8_t ta[3] = { x, y, z }, tb[3] = { x, y, z };
+        ref->envelope(ta, 3);
+        k->envelope(tb, 3);
+        if (ta[1] != tb[1]) {
+          fprintf(stderr,"%s: envelope differs from scalar (%d, %d, %d)\n",k->name,x,y,z);
+          errors++;
+          break;
+        }
+      }
+  return errors;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return x < y ? -1 : x > y;
+}
+
+/* Display usage information and command-line options */
+static void showUsage(char *progname)
+{
+  printf("usage: %s [-w warmup] [-r repetitions] [-b bytes] [-k kernel] [-i isa] [-j] [-c]\n"
+         " -w   untimed warm-up runs per kernel (default: 3)\n"
+         " -r   timed runs per kernel (default: 15)\n"
+         " -b   random bytes in the fixture recording (default: 8192)\n"
+         " -k   only run kernels whose name contains this text\n"
+         " -i   use this kernel set: scalar, sse2, avx2, avx512, neon (default: best)\n"
+         " -j   one JSON line per kernel instead of a table\n"
+         " -c   cross-check every supported kernel set against scalar and exit\n"
+   ,progname);
+}
+
+int main(int argc, char* argv[])
+{
+  int warmup = 3, reps = 15;
+  size_t fixture = 8192;
+  const char *only = NULL, *isa = NULL;
+  bool json = false, check = false;
+  FILE *null;
+
+  for (int i=1; i<argc; i++) {
+    if (!strcmp(argv[i], "-j"))
+      json = true;
+    else if (!strcmp(argv[i], "-c"))
+      check = true;
+    else if (!strcmp(argv[i], "-i") && i+1 < argc)
+      isa = argv[++i];
+    else if (!strcmp(argv[i], "-w") && i+1 < argc)
+      warmup = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-r") && i+1 < argc)
+      reps = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-b") && i+1 < argc)
+      fixture = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "-k") && i+1 < argc)
+      only = argv[++i];
+    else if (!strcmp(argv[i], "-h")) {
+      showUsage(argv[0]);
+      exit(0);
+    }
+    else {
+      fprintf(stderr,"%s: invalid option '%s'\n",argv[0],argv[i]);
+      exit(1);
+    }
+  }
+  if (warmup < 0 || reps < 1 || reps > MAX_REPS || fixture < 1) {
+    showUsage(argv[0]);
+    exit(1);
+  }
+
+  if (check) {
+    const char *const *names;
+    int count, errors = 0;
+
+    names = simdNames(&count);
+    for (int i = 1; i < count; i++) {
+      const SimdKernels *k = simdKernelsByName(names[i]);
+      if (k == NULL)
+        continue;
+      errors += crossCheck(k);
+      printf("%s: %s\n", names[i], errors ? "FAILED" : "matches scalar");
+    }
+    return errors ? 1 : 0;
+  }
+
+  if (isa != NULL && simdSelect(isa) < 0) {
+    fprintf(stderr,"%s: kernel set '%s' not supported here\n",argv[0],isa);
+    exit(1);
+  }
+
+  if (makeFixture(fixture) < 0) {
+    fprintf(stderr,"%s: failed creating the fixture\n",argv[0]);
+    exit(1);
+  }
+
+  /* Encoder kernels write to a sink; the cost of the writes is included */
+  if ((null = fopen("/dev/null", "wb")) == NULL) {
+    fprintf(stderr,"%s: failed opening /dev/null\n",argv[0]);
+    exit(1);
+  }
+  initWriteBuffer(&wb, null, 1200, OUTPUT_FREQUENCY);
+
+  if (!json)
+    printf("kernels: %s; fixture: %d samples, %zu bytes; %d warm-up, %d timed runs\n"
+           "%-20s %-6s %10s %10s %10s %8s\n", simdKernels()->name, samples, byte_count, warmup, reps,
+           "kernel", "unit", "min ns", "median ns", "mean ns", "stddev%");
+
+  for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    const Kernel *kernel = &kernels[k];
+    double ns[MAX_REPS], mean = 0, var = 0;
+
+    if (only != NULL && strstr(kernel->name, only) == NULL)
+      continue;
+
+    for (int n = 0; n < warmup; n++) {
+      if (kernel->prepare) kernel->prepare();
+      kernel->run();
+    }
+    for (int n = 0; n < reps; n++) {
+      double start, units;
+      if (kernel->prepare) kernel->prepare();
+      start = now();
+      units = kernel->run();
+      ns[n] = (now() - start) * 1e9 / units;
+      mean += ns[n];
+    }
+    flushWriteBuffer(&wb);
+
+    mean /= reps;
+    for (int n = 0; n < reps; n++)
+      var += (ns[n] - mean) * (ns[n] - mean);
+    var = reps > 1 ? var / (reps - 1) : 0;
+    qsort(ns, reps, sizeof(double), compareDouble);
+
+    if (json)
+      printf("{\"kernel\":\"%s\",\"isa\":\"%s\",\"unit\":\"%s\",\"reps\":%d,\"min_ns\":%.4f,"
+             "\"median_ns\":%.4f,\"mean_ns\":%.4f,\"stddev_ns\":%.4f}\n",
+             kernel->name, simdKernels()->name, kernel->unit, reps, ns[0], ns[reps/2], mean, sqrt(var));
+    else
+      printf("%-20s %-6s %10.3f %10.3f %10.3f %7.1f%%\n", kernel->name, kernel->unit,
+             ns[0], ns[reps/2], mean, mean > 0 ? 100 * sqrt(var) / mean : 0.0);
+  }
+
+  fclose(null);
+  free(raw8); free(raw16); free(signal); free(work); free(bytes);
+  return 0;
+}
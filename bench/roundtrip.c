@@ -0,0 +1,399 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         roundtrip.c                                              */
+/*                                                                        */
+/* description:  Round-trip regression check: CAS -> cas2wav -> optional */
+/*               tapesim channel -> wav2cas -> compare, per image, with   */
+/*               accuracy and throughput checked against a baseline.      */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* Limits for the channel argument list and the baseline */
+#define MAX_CHANNEL_ARGS  64
+#define MAX_CASES         1024
+
+/* Default throughput tolerance, percent below the baseline */
+#define TOLERANCE         25.0
+
+/* Result of one image */
+typedef struct {
+  char name[64];
+  bool exact;             /* Decoded image equals the original */
+  double encode;          /* Seconds in cas2wav */
+  double channel;         /* Seconds in tapesim */
+  double decode;          /* Seconds in wav2cas */
+  long long samples;      /* Samples in the WAV given to wav2cas */
+  long long encoded;      /* Samples written by cas2wav */
+} Case;
+
+/* Totals, as stored in the baseline file */
+typedef struct {
+  int images;
+  int exact;
+  double encode_rate;     /* cas2wav samples/s */
+  double decode_rate;     /* wav2cas samples/s */
+  int cases;
+  char names[MAX_CASES][64];
+  bool passed[MAX_CASES];
+} Summary;
+
+/* Tool paths */
+static const char *cas2wav = "./cas2wav";
+static const char *wav2cas = "./wav2cas";
+static const char *tapesim = "./bench/tapesim";
+
+/* Run a command with its output discarded; wall seconds of the fastest
+ * of runs, -1 if it could not run or failed */
+static double runTimed(char **command, int runs)
+{
+  double best = -1;
+
+  for (int n = 0; n < runs; n++) {
+    struct timespec start, stop;
+    int status;
+    double wall;
+    pid_t pid;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if ((pid = fork()) < 0)
+      return -1;
+    if (pid == 0) {
+      int null = open("/dev/null", O_WRONLY);
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+      execvp(command[0], command);
+      _exit(127);
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      return -1;
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    wall = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    if (best < 0 || wall < best)
+      best = wall;
+  }
+  return best;
+}
+
+/* Number of samples in the data chunk of a WAV file, -1 if unreadable */
+static long long wavSamples(const char *filename)
+{
+  unsigned char chunk[8], format[16];
+  unsigned channels = 1, bits = 8;
+  FILE *file;
+  long long samples = -1;
+
+  if ((file = fopen(filename, "rb")) == NULL)
+    return -1;
+
+  if (fread(chunk, 1, 8, file) == 8 && !memcmp(chunk, "RIFF", 4) &&
+      fread(chunk, 1, 4, file) == 4 && !memcmp(chunk, "WAVE", 4)) {
+    while (fread(chunk, 1, 8, file) == 8) {
+      uint32_t size = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (uint32_t)chunk[7] << 24;
+      if (!memcmp(chunk, "fmt ", 4) && size >= 16 && fread(format, 1, 16, file) == 16) {
+        channels = format[2] | format[3] << 8;
+        bits = format[14] | format[15] << 8;
+        fseek(file, size - 16 + (size & 1), SEEK_CUR);
+      }
+      else if (!memcmp(chunk, "data", 4)) {
+        unsigned frame = channels * ((bits + 7) / 8);
+        samples = size / (frame ? frame : 1);
+        break;
+      }
+      else
+        fseek(file, size + (size & 1), SEEK_CUR);
+    }
+  }
+  fclose(file);
+  return samples;
+}
+
+/* True if both files exist and have the same contents */
+static bool sameFile(const char *a, const char *b)
+{
+  FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+  unsigned char ba[65536], bb[65536];
+  bool same = fa != NULL && fb != NULL;
+
+  while (same) {
+    size_t na = fread(ba, 1, sizeof(ba), fa);
+    size_t nb = fread(bb, 1, sizeof(bb), fb);
+    if (na != nb || memcmp(ba, bb, na))
+      same = false;
+    if (na < sizeof(ba))
+      break;
+  }
+  if (fa) fclose(fa);
+  if (fb) fclose(fb);
+  return same;
+}
+
+/* Run the whole chain for one image; false if a stage failed to run */
+static bool roundTrip(const char *cas, const char *dir, char **channel, int channel_count,
+                      int runs, Case *result)
+{
+  char wav[4096], sim[4096], out[4096];
+  const char *base = strrchr(cas, '/');
+  char *dot, *command[MAX_CHANNEL_ARGS + 4];
+
+  snprintf(result->name, sizeof(result->name), "%s", base ? base + 1 : cas);
+  if ((dot = strrchr(result->name, '.')) != NULL && dot != result->name)
+    *dot = '\0';
+  snprintf(wav, sizeof(wav), "%s/%s.rt.wav", dir, result->name);
+  snprintf(sim, sizeof(sim), "%s/%s.rt.sim.wav", dir, result->name);
+  snprintf(out, sizeof(out), "%s/%s.rt.decoded", dir, result->name);
+
+  command[0] = (char*)cas2wav;
+  command[1] = (char*)cas;
+  command[2] = wav;
+  command[3] = NULL;
+  if ((result->encode = runTimed(command, runs)) < 0)
+    return false;
+  result->encoded = result->samples = wavSamples(wav);
+
+  result->channel = 0;
+  if (channel_count > 0) {
+    command[0] = (char*)tapesim;
+    memcpy(command + 1, channel, channel_count * sizeof(char*));
+    command[channel_count + 1] = wav;
+    command[channel_count + 2] = sim;
+    command[channel_count + 3] = NULL;
+    if ((result->channel = runTimed(command, 1)) < 0)
+      return false;
+    result->samples = wavSamples(sim);
+  }
+
+  command[0] = (char*)wav2cas;
+  command[1] = channel_count > 0 ? sim : wav;
+  command[2] = out;
+  command[3] = NULL;
+  if ((result->decode = runTimed(command, runs)) < 0)
+    return false;
+
+  result->exact = sameFile(cas, out);
+  return true;
+}
+
+/* Read a baseline file of "key value" lines; false if unreadable */
+static bool readBaseline(const char *filename, Summary *summary)
+{
+  char line[256], key[64], name[64];
+  double value;
+  FILE *file;
+
+  if ((file = fopen(filename, "r")) == NULL)
+    return false;
+  memset(summary, 0, sizeof(*summary));
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] == '#')
+      continue;
+    if (sscanf(line, "case %63s %lf", name, &value) == 2) {
+      if (summary->cases < MAX_CASES) {
+        snprintf(summary->names[summary->cases], 64, "%s", name);
+        summary->passed[summary->cases++] = value != 0;
+      }
+    }
+    else if (sscanf(line, "%63s %lf", key, &value) == 2) {
+      if (!strcmp(key, "images"))           summary->images = (int)value;
+      else if (!strcmp(key, "exact"))       summary->exact = (int)value;
+      else if (!strcmp(key, "encode_samples_s")) summary->encode_rate = value;
+      else if (!strcmp(key, "decode_samples_s")) summary->decode_rate = value;
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+static bool writeBaseline(const char *filename, const Summary *summary)
+{
+  FILE *file;
+
+  if ((file = fopen(filename, "w")) == NULL)
+    return false;
+  fprintf(file, "# Round-trip baseline, written by bench/roundtrip -u\n"
+                "# Throughput is machine-specific: regenerate it on the machine that checks\n");
+  fprintf(file, "images %d\nexact %d\nencode_samples_s %.0f\ndecode_samples_s %.0f\n",
+          summary->images, summary->exact, summary->encode_rate, summary->decode_rate);
+  for (int i = 0; i < summary->cases; i++)
+    fprintf(file, "case %s %d\n", summary->names[i], summary->passed[i]);
+  return fclose(file) == 0;
+}
+
+/* Compare against the baseline; returns the number of regressions */
+static int compareBaseline(const char *progname, const Summary *now, const Summary *base,
+                           double tolerance)
+{
+  int regressions = 0;
+
+  /* Every image exact in the baseline must still be run and exact */
+  for (int i = 0; i < base->cases; i++) {
+    int j;
+
+    if (!base->passed[i])
+      continue;
+    for (j = 0; j < now->cases && strcmp(base->names[i], now->names[j]); j++)
+      ;
+    if (j == now->cases) {
+      fprintf(stderr,"%s: %s was not run\n",progname,base->names[i]);
+      regressions++;
+    }
+    else if (!now->passed[j]) {
+      fprintf(stderr,"%s: %s no longer round-trips\n",progname,now->names[j]);
+      regressions++;
+    }
+  }
+  if (now->exact < base->exact) {
+    fprintf(stderr,"%s: accuracy %d/%d, baseline %d/%d\n",progname,
+            now->exact,now->images,base->exact,base->images);
+    regressions++;
+  }
+  if (now->encode_rate < base->encode_rate * (1 - tolerance / 100)) {
+    fprintf(stderr,"%s: cas2wav %.0f samples/s, baseline %.0f (tolerance %.0f%%)\n",progname,
+            now->encode_rate,base->encode_rate,tolerance);
+    regressions++;
+  }
+  if (now->decode_rate < base->decode_rate * (1 - tolerance / 100)) {
+    fprintf(stderr,"%s: wav2cas %.0f samples/s, baseline %.0f (tolerance %.0f%%)\n",progname,
+            now->decode_rate,base->decode_rate,tolerance);
+    regressions++;
+  }
+  return regressions;
+}
+
+/* Display usage information and command-line options */
+static void showUsage(char *progname)
+{
+  printf("usage: %s [-n runs] [-b baseline [-u]] [-t percent] [-d dir] [-c \"tapesim options\"]\n"
+         "       <file.cas> [<file.cas> ...]\n"
+         " -n   runs per timed stage, the fastest one counts (default: 1)\n"
+         " -b   baseline file to compare against\n"
+         " -u   write the results to the baseline file instead\n"
+         " -t   throughput regression tolerance in percent (default: %.0f)\n"
+         " -d   directory for intermediate files (default: /tmp)\n"
+         " -c   pass each WAV through bench/tapesim with these options\n"
+         " prints one JSON line per image and a total line; exits with 1 on a\n"
+         " regression against the baseline\n"
+   ,progname,TOLERANCE);
+}
+
+int main(int argc, char* argv[])
+{
+  const char *baseline = NULL, *dir = "/tmp";
+  char *channel[MAX_CHANNEL_ARGS], *channel_options = NULL;
+  int channel_count = 0, runs = 1, first = 0;
+  double tolerance = TOLERANCE, encode = 0, decode = 0;
+  long long encoded = 0, decoded = 0;
+  bool update = false;
+  static Summary now, base;
+
+  for (int i=1; i<argc; i++) {
+    if (argv[i][0]=='-' && argv[i][1]!='\0') {
+      if (!strcmp(argv[i], "-u"))
+        update = true;
+      else if (!strcmp(argv[i], "-n") && i+1 < argc)
+        runs = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-b") && i+1 < argc)
+        baseline = argv[++i];
+      else if (!strcmp(argv[i], "-t") && i+1 < argc)
+        tolerance = atof(argv[++i]);
+      else if (!strcmp(argv[i], "-d") && i+1 < argc)
+        dir = argv[++i];
+      else if (!strcmp(argv[i], "-c") && i+1 < argc)
+        channel_options = argv[++i];
+      else {
+        fprintf(stderr,"%s: invalid option '%s'\n",argv[0],argv[i]);
+        exit(1);
+      }
+      continue;
+    }
+    first = i;
+    break;
+  }
+  if (first == 0 || runs < 1 || (update && baseline == NULL)) {
+    showUsage(argv[0]);
+    exit(1);
+  }
+
+  /* Tools can be overridden, e.g. to check an installed build */
+  if (getenv("CAS2WAV")) cas2wav = getenv("CAS2WAV");
+  if (getenv("WAV2CAS")) wav2cas = getenv("WAV2CAS");
+  if (getenv("TAPESIM")) tapesim = getenv("TAPESIM");
+
+  /* Split the channel options on blanks */
+  for (char *arg = channel_options ? strtok(channel_options, " \t") : NULL;
+       arg != NULL; arg = strtok(NULL, " \t")) {
+    if (channel_count == MAX_CHANNEL_ARGS - 2) {
+      fprintf(stderr,"%s: too many channel options\n",argv[0]);
+      exit(1);
+    }
+    channel[channel_count++] = arg;
+  }
+
+  for (int i = first; i < argc; i++) {
+    Case result;
+
+    if (!roundTrip(argv[i], dir, channel, channel_count, runs, &result)) {
+      fprintf(stderr,"%s: round trip of %s failed to run\n",argv[0],argv[i]);
+      exit(1);
+    }
+    printf("{\"case\":\"%s\",\"exact\":%s,\"samples\":%lld,\"cas2wav_s\":%.6f,"
+           "\"tapesim_s\":%.6f,\"wav2cas_s\":%.6f,\"decode_samples_s\":%.0f}\n",
+           result.name, result.exact ? "true" : "false", result.samples,
+           result.encode, result.channel, result.decode,
+           result.decode > 0 ? result.samples / result.decode : 0.0);
+    fflush(stdout);
+
+    if (now.cases < MAX_CASES) {
+      snprintf(now.names[now.cases], 64, "%s", result.name);
+      now.passed[now.cases++] = result.exact;
+    }
+    now.images++;
+    now.exact += result.exact;
+    encode += result.encode;
+    decode += result.decode;
+    encoded += result.encoded;
+    decoded += result.samples;
+  }
+  now.encode_rate = encode > 0 ? encoded / encode : 0;
+  now.decode_rate = decode > 0 ? decoded / decode : 0;
+
+  printf("{\"case\":\"total\",\"images\":%d,\"exact\":%d,\"accuracy\":%.4f,"
+         "\"cas2wav_s\":%.6f,\"wav2cas_s\":%.6f,\"encode_samples_s\":%.0f,"
+         "\"decode_samples_s\":%.0f}\n",
+         now.images, now.exact, (double)now.exact / now.images, encode, decode,
+         now.encode_rate, now.decode_rate);
+
+  if (baseline == NULL)
+    return 0;
+  if (update) {
+    if (!writeBaseline(baseline, &now)) {
+      fprintf(stderr,"%s: failed writing %s\n",argv[0],baseline);
+      exit(1);
+    }
+    return 0;
+  }
+  if (!readBaseline(baseline, &base)) {
+    fprintf(stderr,"%s: failed reading %s\n",argv[0],baseline);
+    exit(1);
+  }
+  if (compareBaseline(argv[0], &now, &base, tolerance) > 0)
+    exit(1);
+  fprintf(stderr,"%s: no regressions against %s\n",argv[0],baseline);
+  return 0;
+}
@@ -0,0 +1,487 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         tapesim.c                                                */
+/*                                                                        */
+/* description:  Tape channel simulator: turns a clean cas2wav recording  */
+/*               into degraded captures (wow and flutter, hiss, DC        */
+/*               drift, clipping, dropouts, azimuth error, resampling)    */
+/*               to stress wav2cas.                                       */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "lib/caslib.h"
+
+/* Output is written in chunks of this many bytes */
+#define OUTPUT_BUFFER   65536
+
+/* Default modulation rates, Hz */
+#define WOW_HZ          0.5
+#define FLUTTER_HZ      8.0
+#define DRIFT_HZ        0.2
+
+/* Default dropout length (ms) and attenuation (fraction removed) */
+#define DROPOUT_MS      20.0
+#define DROPOUT_DEPTH   0.9
+
+/* Channel model; every effect is off at zero */
+typedef struct {
+  double wow, wow_hz;             /* Peak speed deviation (fraction), rate */
+  double flutter, flutter_hz;
+  double hiss;                    /* Noise RMS, fraction of full scale */
+  double drift, drift_hz;         /* DC offset RMS, fraction of full scale */
+  double gain;                    /* Playback gain, linear */
+  double clip;                    /* Clipping level, fraction of full scale */
+  double dropouts;                /* Dropouts per minute */
+  double dropout_ms, dropout_depth;
+  double azimuth;                 /* Second channel delay, microseconds */
+} Channel;
+
+/* Clean input recording, as samples in -1..1 */
+typedef struct {
+  float *samples;
+  size_t count;
+  uint32_t rate;
+} Recording;
+
+/* Sine oscillator by phasor rotation: no sin() per sample */
+typedef struct {
+  double c, s;        /* Current phasor */
+  double cw, sw;      /* Rotation per sample */
+} Oscillator;
+
+/* Buffered PCM output */
+typedef struct {
+  FILE *file;
+  unsigned char data[OUTPUT_BUFFER];
+  size_t used;
+  int bits;
+} Output;
+
+/* xorshift64* generator: captures are reproducible from the seed */
+static uint64_t state;
+
+static uint64_t nextRandom(void)
+{
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 0x2545F4914F6CDD1DULL;
+}
+
+/* Uniform in 0..1 */
+static double uniform(void)
+{
+  return (nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Approximately normal, unit variance: sum of four uniforms (Irwin-Hall) */
+static double gaussian(void)
+{
+  uint64_t r = nextRandom();
+  double sum = (double)(r & 0xffff) + ((r >> 16) & 0xffff) + ((r >> 32) & 0xffff) + (r >> 48);
+  return (sum / 65536.0 - 2.0) * 1.7320508075688772;
+}
+
+static void startOscillator(Oscillator *osc, double hz, double rate)
+{
+  double phase = 2 * M_PI * uniform();
+  osc->c = cos(phase);
+  osc->s = sin(phase);
+  osc->cw = cos(2 * M_PI * hz / rate);
+  osc->sw = sin(2 * M_PI * hz / rate);
+}
+
+static double nextOscillator(Oscillator *osc)
+{
+  double s = osc->s;
+  double c = osc->c * osc->cw - osc->s * osc->sw;
+  osc->s = osc->s * osc->cw + osc->c * osc->sw;
+  osc->c = c;
+  return s;
+}
+
+/* Linear interpolation at a fractional input position */
+static double interpolate(const Recording *in, double pos)
+{
+  size_t i;
+  double frac;
+
+  if (pos < 0)
+    return 0.0;
+  i = (size_t)pos;
+  if (i + 1 >= in->count)
+    return i < in->count ? in->samples[i] : 0.0;
+  frac = pos - i;
+  return in->samples[i] + (in->samples[i+1] - in->samples[i]) * frac;
+}
+
+/* Read a PCM WAV file (8-bit unsigned or 16-bit signed, any channel
+ * count, channels mixed down) into memory */
+static int readRecording(const char *filename, Recording *in)
+{
+  FILE *file;
+  unsigned char *data;
+  long size;
+  size_t pos = 12;
+  unsigned channels = 0, bits = 0;
+
+  if ((file = fopen(filename, "rb")) == NULL)
+    return -1;
+  size = getFileSize(file);
+  if (size < 12 || (data = (unsigned char*)malloc(size)) == NULL) {
+    fclose(file);
+    return -1;
+  }
+  if (fread(data, 1, size, file) != (size_t)size || memcmp(data, "RIFF", 4) ||
+      memcmp(data + 8, "WAVE", 4)) {
+    fclose(file);
+    free(data);
+    return -1;
+  }
+  fclose(file);
+
+  /* Chunks: 4-byte id, 4-byte little-endian size */
+  in->samples = NULL;
+  while (pos + 8 <= (size_t)size) {
+    const unsigned char *chunk = data + pos;
+    size_t length = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (uint32_t)chunk[7] << 24;
+
+    pos += 8;
+    if (length > (size_t)size - pos)
+      length = size - pos;
+    if (!memcmp(chunk, "fmt ", 4) && length >= 16) {
+      channels = chunk[10] | chunk[11] << 8;
+      in->rate = chunk[12] | chunk[13] << 8 | chunk[14] << 16 | (uint32_t)chunk[15] << 24;
+      bits = chunk[22] | chunk[23] << 8;
+    }
+    else if (!memcmp(chunk, "data", 4) && channels > 0 && (bits == 8 || bits == 16)) {
+      size_t frame = channels * bits / 8;
+      const unsigned char *p = data + pos;
+
+      in->count = length / frame;
+      if ((in->samples = (float*)malloc((in->count + 1) * sizeof(float))) == NULL)
+        break;
+      for (size_t i = 0; i < in->count; i++) {
+        int sum = 0;
+        for (unsigned ch = 0; ch < channels; ch++, p += bits / 8)
+          sum += bits == 8 ? (int)p[0] - 128 : (int16_t)(p[0] | p[1] << 8);
+        in->samples[i] = sum / (channels * (bits == 8 ? 128.0f : 32768.0f));
+      }
+      break;
+    }
+    pos += length + (length & 1);
+  }
+  free(data);
+  return in->samples != NULL && in->rate > 0 ? 0 : -1;
+}
+
+static void flushOutput(Output *out)
+{
+  fwrite(out->data, 1, out->used, out->file);
+  out->used = 0;
+}
+
+/* Quantise one sample, already clipped to -1..1 */
+static void putSample(Output *out, double value)
+{
+  if (out->used + 2 > OUTPUT_BUFFER)
+    flushOutput(out);
+  if (out->bits == 8)
+    out->data[out->used++] = (unsigned char)(lrint(value * 127.0) + 128);
+  else {
+    long v = lrint(value * 32767.0);
+    out->data[out->used++] = v & 0xff;
+    out->data[out->used++] = (v >> 8) & 0xff;
+  }
+}
+
+/* One channel of the signal chain after the heads: dropout, gain, hiss,
+ * DC drift, then clipping at the converter */
+static double degrade(const Channel *ch, double value, double dropout, double dc)
+{
+  value = value * dropout * ch->gain;
+  if (ch->hiss > 0)
+    value += ch->hiss * gaussian();
+  value += dc;
+  if (value > ch->clip)  value = ch->clip;
+  if (value < -ch->clip) value = -ch->clip;
+  return value;
+}
+
+/* Play the recording through the channel into a new WAV file.
+ * Returns the number of sample frames written, or -1 on error */
+static long long simulate(const Recording *in, const Channel *ch, uint32_t rate,
+                          int bits, const char *filename)
+{
+  WAVE_HEADER header;
+  Output *out;
+  Oscillator wow, flutter;
+  bool stereo = ch->azimuth > 0;
+  double step = (double)in->rate / rate;
+  double delay = ch->azimuth * 1e-6 * in->rate;
+  double pos = 0.0, dc = 0.0, dc_pole = 0.0, dc_scale = 0.0;
+  double dropout_chance = ch->dropouts / 60.0 / rate;
+  long dropout_left = 0, dropout_length = 1;
+  double dropout_depth = 0.0;
+  long long frames = 0;
+
+  if ((out = (Output*)malloc(sizeof(Output))) == NULL)
+    return -1;
+  if ((out->file = fopen(filename, "wb")) == NULL) {
+    free(out);
+    return -1;
+  }
+  out->used = 0;
+  out->bits = bits;
+
+  memcpy(header.RiffID, "RIFF", 4);
+  memcpy(header.WaveID, "WAVE", 4);
+  memcpy(header.FmtID, "fmt ", 4);
+  memcpy(header.DataID, "data", 4);
+  header.RiffSize = header.nDataBytes = 0;
+  header.FmtSize = 16;
+  header.wFormatTag = PCM_WAVE_FORMAT;
+  header.nChannels = stereo ? STEREO : MONO;
+  header.nSamplesPerSec = rate;
+  header.nBlockAlign = header.nChannels * bits / 8;
+  header.nAvgBytesPerSec = rate * header.nBlockAlign;
+  header.wBitsPerSample = bits;
+  fwrite(&header, sizeof(header), 1, out->file);
+
+  startOscillator(&wow, ch->wow_hz, rate);
+  startOscillator(&flutter, ch->flutter_hz, rate);
+
+  /* DC drift: white noise through a one-pole low-pass, scaled to RMS */
+  if (ch->drift > 0) {
+    dc_pole = exp(-2 * M_PI * ch->drift_hz / rate);
+    dc_scale = ch->drift / sqrt((1 - dc_pole) / (1 + dc_pole));
+  }
+
+  /* Variable-speed playback: the read position advances by the rate
+   * ratio, modulated by wow and flutter */
+  while (pos < in->count) {
+    double dropout = 1.0, left, right;
+
+    if (dc_scale > 0)
+      dc = dc_pole * dc + (1 - dc_pole) * gaussian();
+
+    /* Dropouts: random onsets, raised-cosine dip in level */
+    if (dropout_left == 0 && dropout_chance > 0 && uniform() < dropout_chance) {
+      dropout_length = dropout_left = 1 + (long)(ch->dropout_ms * 1e-3 * rate * (0.5 + uniform()));
+      dropout_depth = ch->dropout_depth * (0.5 + 0.5 * uniform());
+    }
+    if (dropout_left > 0) {
+      double shape = 0.5 - 0.5 * cos(2 * M_PI * dropout_left / dropout_length);
+      dropout = 1.0 - dropout_depth * shape;
+      dropout_left--;
+    }
+
+    left = degrade(ch, interpolate(in, pos), dropout, dc * dc_scale);
+    putSample(out, left);
+    if (stereo) {
+      /* Azimuth error: the second track lags by a fraction of a cycle */
+      right = degrade(ch, interpolate(in, pos - delay), dropout, dc * dc_scale);
+      putSample(out, right);
+    }
+    frames++;
+
+    pos += step * (1.0 + ch->wow * nextOscillator(&wow) + ch->flutter * nextOscillator(&flutter));
+  }
+
+  flushOutput(out);
+  updateWavHeader(out->file, &header);
+  if (ferror(out->file) | fclose(out->file))
+    frames = -1;
+  free(out);
+  return frames;
+}
+
+/* Parse "A[:B[:C]]", leaving unspecified values untouched */
+static void parseValues(const char *arg, double *a, double *b, double *c)
+{
+  char *end;
+
+  *a = strtod(arg, &end);
+  if (*end == ':' && b != NULL) {
+    *b = strtod(end + 1, &end);
+    if (*end == ':' && c != NULL)
+      *c = strtod(end + 1, &end);
+  }
+}
+
+/* Output name of capture k: the pattern's "%d" (optionally "%0Nd")
+ * replaced by k; false if the pattern has no such conversion */
+static bool captureName(char *name, size_t size, const char *pattern, int k)
+{
+  const char *p = strchr(pattern, '%');
+  const char *q;
+  int width;
+
+  if (p == NULL)
+    return false;
+  width = atoi(p + 1);
+  for (q = p + 1; *q >= '0' && *q <= '9'; q++)
+    ;
+  if (*q != 'd' || strchr(q, '%') != NULL)
+    return false;
+  snprintf(name, size, "%.*s%0*d%s", (int)(p - pattern), pattern, width, k, q + 1);
+  return true;
+}
+
+/* Display usage information and command-line options */
+static void showUsage(char *progname)
+{
+  printf("usage: %s [options] <ifile> <ofile>\n"
+         " -s seed           random seed (default: 1)\n"
+         " -n count          number of captures; ofile then needs a %%d, e.g. cap%%04d.wav\n"
+         " -V                vary each effect per capture between 0 and its setting\n"
+         " -r rate           output sample rate (default: input rate)\n"
+         " -b 8|16           output bits per sample (default: 16)\n"
+         " --wow %%[:hz]      speed variation, peak percent (default rate %.1f Hz)\n"
+         " --flutter %%[:hz]  fast speed variation, peak percent (default %.0f Hz)\n"
+         " --hiss dB         noise level, dB below full scale\n"
+         " --drift %%[:hz]    DC offset wander, RMS percent of full scale\n"
+         " --gain dB         playback gain (default: 0)\n"
+         " --clip level      clip at this fraction of full scale (default: 1)\n"
+         " --dropouts n[:ms[:depth]]  dropouts per minute, length, depth 0-1\n"
+         " --azimuth us      stereo output, second channel delayed by us\n"
+         " prints one JSON line per capture with the effects applied\n"
+   ,progname,WOW_HZ,FLUTTER_HZ);
+}
+
+int main(int argc, char* argv[])
+{
+  Channel base = { 0, WOW_HZ, 0, FLUTTER_HZ, 0, 0, DRIFT_HZ, 1.0, 1.0,
+                   0, DROPOUT_MS, DROPOUT_DEPTH, 0 };
+  const char *ifile = NULL, *ofile = NULL;
+  uint64_t seed = 1;
+  uint32_t rate = 0;
+  int count = 1, bits = 16;
+  bool vary = false;
+  double hiss_db = 0, gain_db = 0;
+  Recording in;
+
+  for (int i=1; i<argc; i++) {
+    if (argv[i][0]=='-' && argv[i][1]!='\0') {
+      if (!strcmp(argv[i], "-V"))
+        vary = true;
+      else if (i+1 >= argc) {
+        fprintf(stderr,"%s: invalid option '%s'\n",argv[0],argv[i]);
+        exit(1);
+      }
+      else if (!strcmp(argv[i], "-s"))
+        seed = strtoull(argv[++i], NULL, 0);
+      else if (!strcmp(argv[i], "-n"))
+        count = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-r"))
+        rate = strtoul(argv[++i], NULL, 0);
+      else if (!strcmp(argv[i], "-b"))
+        bits = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "--wow"))
+        parseValues(argv[++i], &base.wow, &base.wow_hz, NULL);
+      else if (!strcmp(argv[i], "--flutter"))
+        parseValues(argv[++i], &base.flutter, &base.flutter_hz, NULL);
+      else if (!strcmp(argv[i], "--hiss"))
+        hiss_db = -fabs(atof(argv[++i]));
+      else if (!strcmp(argv[i], "--drift"))
+        parseValues(argv[++i], &base.drift, &base.drift_hz, NULL);
+      else if (!strcmp(argv[i], "--gain"))
+        gain_db = atof(argv[++i]);
+      else if (!strcmp(argv[i], "--clip"))
+        base.clip = atof(argv[++i]);
+      else if (!strcmp(argv[i], "--dropouts"))
+        parseValues(argv[++i], &base.dropouts, &base.dropout_ms, &base.dropout_depth);
+      else if (!strcmp(argv[i], "--azimuth"))
+        base.azimuth = atof(argv[++i]);
+      else {
+        fprintf(stderr,"%s: invalid option '%s'\n",argv[0],argv[i]);
+        exit(1);
+      }
+      continue;
+    }
+    if (ifile == NULL) { ifile = argv[i]; continue; }
+    if (ofile == NULL) { ofile = argv[i]; continue; }
+    fprintf(stderr,"%s: too many arguments\n",argv[0]);
+    exit(1);
+  }
+  if (ofile == NULL || count < 1) {
+    showUsage(argv[0]);
+    exit(1);
+  }
+  if (bits != 8 && bits != 16) {
+    fprintf(stderr,"%s: output must be 8 or 16 bits\n",argv[0]);
+    exit(1);
+  }
+  if (base.clip <= 0 || base.clip > 1.0 || base.dropout_ms <= 0 ||
+      base.dropout_depth < 0 || base.dropout_depth > 1.0) {
+    fprintf(stderr,"%s: invalid channel settings\n",argv[0]);
+    exit(1);
+  }
+  if (count > 1) {
+    char name[8];
+    if (!captureName(name, sizeof(name), ofile, 0)) {
+      fprintf(stderr,"%s: '%s' needs a %%d for the capture number\n",argv[0],ofile);
+      exit(1);
+    }
+  }
+
+  base.wow /= 100.0;
+  base.flutter /= 100.0;
+  base.drift /= 100.0;
+  base.hiss = hiss_db < 0 ? pow(10.0, hiss_db / 20.0) : 0.0;
+  base.gain = pow(10.0, gain_db / 20.0);
+
+  if (readRecording(ifile, &in) < 0) {
+    fprintf(stderr,"%s: failed reading %s (8 or 16-bit PCM WAV expected)\n",argv[0],ifile);
+    exit(1);
+  }
+  if (rate == 0)
+    rate = in.rate;
+
+  for (int k = 0; k < count; k++) {
+    Channel ch = base;
+    char filename[4096];
+    long long frames;
+
+    /* Every capture has its own stream, so -n keeps earlier captures */
+    state = (seed + k) * 0x9E3779B97F4A7C15ULL + 1;
+    if (vary) {
+      ch.wow *= uniform();
+      ch.flutter *= uniform();
+      ch.hiss *= uniform();
+      ch.drift *= uniform();
+      ch.dropouts *= uniform();
+      ch.azimuth *= uniform();
+    }
+
+    if (count > 1)
+      captureName(filename, sizeof(filename), ofile, k);
+    else
+      snprintf(filename, sizeof(filename), "%s", ofile);
+
+    if ((frames = simulate(&in, &ch, rate, bits, filename)) < 0) {
+      fprintf(stderr,"%s: failed writing %s\n",argv[0],filename);
+      exit(1);
+    }
+    printf("{\"file\":\"%s\",\"seed\":%llu,\"rate\":%u,\"bits\":%d,\"samples\":%lld,"
+           "\"wow\":%.4f,\"flutter\":%.4f,\"hiss_db\":%.1f,\"drift\":%.4f,"
+           "\"gain_db\":%.1f,\"clip\":%.3f,\"dropouts\":%.2f,\"azimuth_us\":%.2f}\n",
+           filename, (unsigned long long)(seed + k), rate, bits, frames,
+           ch.wow * 100, ch.flutter * 100, ch.hiss > 0 ? 20 * log10(ch.hiss) : 0.0,
+           ch.drift * 100, gain_db, ch.clip, ch.dropouts, ch.azimuth);
+  }
+
+  free(in.samples);
+  return 0;
+}
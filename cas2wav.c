@@ -23,22 +23,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <errno.h>
 #include <string.h>
 #include "lib/caslib.h"
 #include "lib/clilib.h"
+#include "lib/trace.h"
+#include "lib/wavcache.h"
 
 int main(int argc, char* argv[])
 {
-  FILE *output;
+  FILE *output = NULL;
   WriteBuffer wb;      /* Buffered output context */
-  size_t pos;          /* Current position in CAS data */
-  bool eof;            /* Set when EOF marker or data block boundary reached */
+  char key[WAVCACHE_KEY_SIZE];        /* Cache key of input and options */
+  char cache_file[WAVCACHE_PATH_SIZE];/* New cache entry being encoded */
   unsigned char *cas;  /* CAS file data in memory */
   size_t cas_size;     /* Size of CAS file */
   ProgramArgs args;
+  uint64_t start;
 
   /* Parse command line arguments */
   parseArguments(argc, argv, &args);
+  if (args.stats != STATS_OFF)
+    statsStart();
+  if (args.perf_counters && statsPerfCounters() == 0)
+    fprintf(stderr,"%s: hardware counters unavailable (%s)\n",argv[0],strerror(errno));
 
   /* Preset WAV header template (sizes updated at program end with actual data size) */
   WAVE_HEADER waveheader =
@@ -58,78 +66,65 @@ int main(int argc, char* argv[])
     0                     /* Will be set to actual audio data size */
   };
 
-  /* Load CAS file and prepare output */
-  loadAndPrepareFiles(argv[0], &args, &cas, &cas_size, &output, &wb);
+  /* Load CAS file */
+  start = traceStart();
+  loadCasFile(argv[0], &args, &cas, &cas_size);
 
-  /* Write initial WAV header (size fields will be updated at end) */
-  fwrite(&waveheader,sizeof(waveheader),1,output);
-
-  pos=0;
-  /* Scan CAS file for HEADER markers (8-byte sync pattern) */
-  while (pos + sizeof(HEADER) <= cas_size) {
-    if (!memcmp(cas+pos, HEADER, sizeof(HEADER))) {
-      /* Header found - read the 10-byte file type identifier */
-      pos += sizeof(HEADER);
-      if (pos + 10 <= cas_size) {
-        FileType file_type = identifyFileType(cas+pos);
-        switch (file_type) {
-          case FILE_TYPE_ASCII:
-            /* ASCII file type: multiple data blocks with headers between them */
-            writeSilence(&wb, args.silence_time);
-            writeSync(&wb,SYNC_INITIAL);
-            /* Transmit first data block */
-            pos = writeData(cas, cas_size, &wb, pos, &eof);
-
-            /* Process subsequent data blocks until EOF or no more data */
-            while (!eof && pos + sizeof(HEADER) <= cas_size) {
-              writeSilence(&wb,SHORT_SILENCE);
-              writeSync(&wb,SYNC_BLOCK);
-              pos = writeData(cas, cas_size, &wb, pos+sizeof(HEADER), &eof);
-            }
-            break;
+  /* The output only depends on the CAS bytes and the options: serve it
+   * from the cache if an earlier run encoded it, else encode into it */
+  if (args.cache_dir != NULL) {
+    uint32_t params[3] = { args.baudrate, args.output_frequency, args.silence_time };
+    uint64_t size = countSamples(cas, cas_size, NULL, args.baudrate, args.output_frequency,
+                                 args.silence_time) + sizeof(WAVE_HEADER);
 
-          case FILE_TYPE_BINARY:
-            /* Binary/BASIC file type: two-block structure (header block + data block) */
-            writeSilence(&wb, args.silence_time);
-            writeSync(&wb,SYNC_INITIAL);
-            pos = writeData(cas, cas_size, &wb, pos, &eof);
-            writeSilence(&wb,SHORT_SILENCE);
-            writeSync(&wb,SYNC_BLOCK);
-            pos = writeData(cas, cas_size, &wb, pos + sizeof(HEADER), &eof);
-            break;
-
-          case FILE_TYPE_UNKNOWN:
-            /* Unknown file type - use single block with initial sync */
-            printf("unknown file type: using long header\n");
-            writeSilence(&wb,LONG_SILENCE);
-            writeSync(&wb,SYNC_INITIAL);
-            pos = writeData(cas, cas_size, &wb, pos, &eof);
-            break;
-        }
-      }
-      else {
-        /* File type identifier read failed; treat as unknown type */
-        printf("unknown file type: using initial sync\n");
-        writeSilence(&wb, args.silence_time);
-        writeSync(&wb,SYNC_INITIAL);
-        pos = writeData(cas, cas_size, &wb, pos, &eof);
-      }
-
-    } else {
-      /* Non-header data found - skip byte and continue (handles corrupted files) */
-      fprintf(stderr,"skipping unhandled data\n");
-      pos++;
+    cacheKey(cas, cas_size, params, 3, key);
+    statsEnter(STAGE_WRITE);
+    if (cacheFetch(args.cache_dir, key, size, args.output_file) >= 0) {
+      STATS_ADD(COUNT_CACHE_HITS, 1);
+      goto done;
+    }
+    STATS_ADD(COUNT_CACHE_MISSES, 1);
+    if ((output = cacheCreate(args.cache_dir, cache_file)) == NULL) {
+      fprintf(stderr,"%s: cache %s unavailable (%s)\n",argv[0],args.cache_dir,strerror(errno));
+      args.cache_dir = NULL;
     }
+    statsEnter(STAGE_NONE);
   }
+  if (output == NULL)
+    output = openOutputFile(argv[0], &args);
+  initWriteBuffer(&wb, output, args.baudrate, args.output_frequency);
 
-  /* Flush remaining buffered data */
-  flushWriteBuffer(&wb);
+  /* Write initial WAV header (size fields will be updated at end) */
+  fwrite(&waveheader,sizeof(waveheader),1,output);
+
+  /* Encode every file in the image; notes on odd data go to stderr */
+  encodeCas(cas, cas_size, &wb, args.silence_time, stderr);
 
   /* Update WAV header with final audio data size */
+  statsEnter(STAGE_WRITE);
   updateWavHeader(output, &waveheader);
 
-  fclose(output);
+  if (fclose(output) != 0 && args.cache_dir != NULL) {
+    fprintf(stderr,"%s: failed writing %s\n",argv[0],cache_file);
+    remove(cache_file);
+    return 1;
+  }
+  if (args.cache_dir != NULL &&
+      cacheCommit(args.cache_dir, key, cache_file, args.output_file, args.cache_limit) < 0) {
+    fprintf(stderr,"%s: failed writing %s\n",argv[0],args.output_file);
+    return 1;
+  }
+
+done:
+  statsEnter(STAGE_NONE);
+  traceSpan("file", "cas2wav", args.input_file, start);
   free(cas);
 
+  if (args.stats != STATS_OFF)
+    statsReport(stderr, args.stats, "cas2wav");
+  if (traceClose() < 0) {
+    fprintf(stderr,"%s: failed writing %s\n",argv[0],args.trace_file);
+    return 1;
+  }
   return 0;
 }
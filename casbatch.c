@@ -0,0 +1,645 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         casbatch.c                                               */
+/*                                                                        */
+/* description:  Batch runner: runs the cas2wav, wav2cas and casdir jobs  */
+/*               of a manifest on a pool of workers, keeping a journal    */
+/*               so an interrupted run resumes where it stopped.          */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/**************************************************************************/
+
+/* Manifest: one job per line, the tool and its command line as it would
+ * be typed, e.g. "cas2wav -2 tapes/game.cas out/game.wav". "quotes" keep
+ * spaces in a word, "> file" sends the job's standard output to file
+ * (for casdir), blank lines and lines starting with # are skipped.
+ *
+ * Journal: one line per finished job, "<id> ok|fail <status> <ms> <line>",
+ * appended as jobs finish. The id is a hash of the manifest line, so a job
+ * whose line changes runs again. Jobs journaled as ok are skipped. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "lib/cashash.h"
+#include "lib/workpool.h"
+
+extern char **environ;
+
+#define MAX_WORDS  64     /* Words on a manifest line */
+#define ERROR_TAIL 200    /* Bytes of a failed job's stderr kept */
+
+/* Tools a job may run */
+typedef enum {
+  TOOL_CAS2WAV,
+  TOOL_WAV2CAS,
+  TOOL_CASDIR,
+  TOOL_COUNT
+} Tool;
+
+static const char *tool_names[TOOL_COUNT] = { "cas2wav", "wav2cas", "casdir" };
+
+/* Job states */
+typedef enum {
+  JOB_PENDING,
+  JOB_SKIPPED,       /* Finished in an earlier run */
+  JOB_OK,
+  JOB_FAILED,
+  JOB_INTERRUPTED    /* Killed by the interrupt that stopped the run */
+} JobState;
+
+/* One manifest line */
+typedef struct {
+  char *text;                /* The line as written */
+  char *words;               /* Copy of text split into argv */
+  int line;                  /* Line number in the manifest */
+  uint64_t id;               /* hash64 of text */
+  Tool tool;
+  char *argv[MAX_WORDS + 1]; /* Command, NULL terminated */
+  const char *stdout_file;   /* "> file", or NULL */
+  JobState state;
+  int status;                /* Exit status, or 128 + signal */
+  double seconds;
+  uint64_t bytes_in;         /* Input and output file sizes */
+  uint64_t bytes_out;
+  char error[ERROR_TAIL + 1];/* Last line of stderr of a failed job */
+} Job;
+
+/* Shared state of the run */
+typedef struct {
+  Job *jobs;
+  size_t count;
+  size_t next;               /* Next job to hand out */
+  size_t finished;           /* Jobs done in this run */
+  size_t pending;            /* Jobs to run in this run */
+  pthread_mutex_t lock;
+  int journal;               /* Journal file descriptor */
+  const char *tool_dir;      /* Directory of casbatch, "" to search PATH */
+  bool quiet;
+} Batch;
+
+static volatile sig_atomic_t interrupted = 0;
+
+
+static void onInterrupt(int sig)
+{
+  (void)sig;
+  interrupted = 1;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Size of a regular file, 0 if missing */
+static uint64_t fileSize(const char *filename)
+{
+  struct stat st;
+
+  return stat(filename, &st) == 0 && S_ISREG(st.st_mode) ? (uint64_t)st.st_size : 0;
+}
+
+/* Flush a job's output file to disk; pipes and devices need nothing */
+static int syncFile(const char *filename)
+{
+  int fd, result;
+
+  if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0)
+    return -1;
+  result = fsync(fd);
+  if (result < 0 && (errno == EINVAL || errno == EROFS))
+    result = 0;
+  close(fd);
+  return result;
+}
+
+/* Split a manifest line into words in place; "..." groups a word.
+ * Returns the number of words, -1 if there are too many */
+static int splitWords(char *line, char *words[])
+{
+  int count = 0;
+  char *p = line;
+
+  for (;;) {
+    char *out;
+
+    while (*p == ' ' || *p == '\t')
+      p++;
+    if (*p == '\0')
+      return count;
+    if (count == MAX_WORDS)
+      return -1;
+    words[count++] = out = p;
+    while (*p != '\0' && *p != ' ' && *p != '\t') {
+      if (*p == '"') {
+        for (p++; *p != '\0' && *p != '"'; )
+          *out++ = *p++;
+        if (*p == '"')
+          p++;
+      }
+      else
+        *out++ = *p++;
+    }
+    if (*p != '\0')
+      p++;
+    *out = '\0';
+  }
+}
+
+/* Parse one manifest line into job; returns false with a message if it
+ * is not a job this runner knows */
+static bool parseJob(const char *line, Job *job, const char **problem)
+{
+  char *words[MAX_WORDS];
+  int count, argc = 0;
+
+  job->text = strdup(line);
+  job->words = strdup(line);
+  job->id = hash64(line, strlen(line), 0);
+  job->stdout_file = NULL;
+  if (job->text == NULL || job->words == NULL) {
+    *problem = "out of memory";
+    return false;
+  }
+  if ((count = splitWords(job->words, words)) < 0) {
+    *problem = "line too long";
+    return false;
+  }
+
+  for (job->tool = 0; job->tool < TOOL_COUNT; job->tool++)
+    if (!strcmp(words[0], tool_names[job->tool]))
+      break;
+  if (job->tool == TOOL_COUNT) {
+    *problem = "unknown tool";
+    return false;
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (!strcmp(words[i], ">")) {
+      if (i+1 >= count) {
+        *problem = "> without a file";
+        return false;
+      }
+      job->stdout_file = words[++i];
+    }
+    else
+      job->argv[argc++] = words[i];
+  }
+  job->argv[argc] = NULL;
+
+  /* cas2wav and wav2cas take <ifile> <ofile> last */
+  if (job->tool != TOOL_CASDIR && argc < 3) {
+    *problem = "missing input or output file";
+    return false;
+  }
+  return true;
+}
+
+/* Read the manifest; returns the number of jobs, exits on errors */
+static size_t readManifest(const char *progname, const char *filename, Job **jobs)
+{
+  FILE *file;
+  char *line = NULL;
+  size_t capacity = 0, count = 0, allocated = 0;
+  ssize_t length;
+  int number = 0;
+
+  if ((file = fopen(filename, "r")) == NULL) {
+    fprintf(stderr,"%s: failed reading %s\n",progname,filename);
+    exit(1);
+  }
+  *jobs = NULL;
+
+  while ((length = getline(&line, &capacity, file)) >= 0) {
+    const char *problem;
+    char *text = line;
+
+    number++;
+    while (length > 0 && (line[length-1] == '\n' || line[length-1] == '\r'))
+      line[--length] = '\0';
+    while (*text == ' ' || *text == '\t')
+      text++;
+    if (*text == '\0' || *text == '#')
+      continue;
+
+    if (count == allocated) {
+      allocated = allocated ? allocated * 2 : 256;
+      if ((*jobs = realloc(*jobs, allocated * sizeof(Job))) == NULL) {
+        fprintf(stderr,"%s: out of memory\n",progname);
+        exit(1);
+      }
+    }
+    memset(&(*jobs)[count], 0, sizeof(Job));
+    (*jobs)[count].line = number;
+    if (!parseJob(text, &(*jobs)[count], &problem)) {
+      fprintf(stderr,"%s: %s:%d: %s\n",progname,filename,number,problem);
+      exit(1);
+    }
+    count++;
+  }
+  free(line);
+  fclose(file);
+  return count;
+}
+
+/* Mark the jobs a previous run finished; returns how many */
+static size_t readJournal(const char *filename, Job *jobs, size_t count)
+{
+  FILE *file;
+  char line[256];
+  size_t done = 0;
+
+  if ((file = fopen(filename, "r")) == NULL)
+    return 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    unsigned long long id;
+    char state[8];
+
+    if (sscanf(line, "%16llx %7s", &id, state) != 2 || strcmp(state, "ok"))
+      continue;
+    for (size_t i = 0; i < count; i++)
+      if (jobs[i].id == id && jobs[i].state == JOB_PENDING) {
+        jobs[i].state = JOB_SKIPPED;
+        done++;
+      }
+  }
+  fclose(file);
+  return done;
+}
+
+/* A job that could not be started */
+static void failStart(Job *job, const char *what, const char *name, int error)
+{
+  job->state = JOB_FAILED;
+  job->status = 127;
+  snprintf(job->error, sizeof(job->error), "%s%s: %s", what, name, strerror(error));
+}
+
+/* Run one job; stderr is read for the failure summary, stdout goes to
+ * the "> file" of the job or is discarded */
+static void runJob(const Batch *batch, Job *job)
+{
+  char path[4096];
+  char tail[ERROR_TAIL + 1];
+  size_t kept = 0;
+  int pipe_fd[2], out, status, error;
+  double start = now();
+  posix_spawn_file_actions_t actions;
+  pid_t pid;
+
+  if (job->tool == TOOL_CASDIR) {
+    for (int i = 1; job->argv[i] != NULL; i++)
+      if (job->argv[i][0] != '-')
+        job->bytes_in += fileSize(job->argv[i]);
+  }
+  else {
+    int argc = 0;
+    while (job->argv[argc] != NULL)
+      argc++;
+    job->bytes_in = fileSize(job->argv[argc-2]);
+  }
+
+  /* Tools next to casbatch come first, then PATH */
+  snprintf(path, sizeof(path), "%s%s", batch->tool_dir, tool_names[job->tool]);
+  if (batch->tool_dir[0] != '\0' && access(path, X_OK) != 0)
+    snprintf(path, sizeof(path), "%s", tool_names[job->tool]);
+
+  /* Close-on-exec, or jobs started meanwhile would hold the pipe open */
+  out = job->stdout_file != NULL
+    ? open(job->stdout_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)
+    : open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (out < 0) {
+    failStart(job, "cannot write ", job->stdout_file != NULL ? job->stdout_file : "/dev/null", errno);
+    return;
+  }
+  if (pipe2(pipe_fd, O_CLOEXEC) < 0) {
+    failStart(job, "cannot start", "", errno);
+    close(out);
+    return;
+  }
+
+  /* posix_spawn, not fork: the child of a threaded process may only make
+   * async-signal-safe calls until exec, and the file actions are those */
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, pipe_fd[1], STDERR_FILENO);
+  error = posix_spawnp(&pid, path, &actions, NULL, job->argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(out);
+  close(pipe_fd[1]);
+  if (error != 0) {
+    failStart(job, "cannot run ", tool_names[job->tool], error);
+    close(pipe_fd[0]);
+    return;
+  }
+
+  /* Keep the end of stderr, for the last line */
+  for (;;) {
+    char chunk[4096];
+    ssize_t n = read(pipe_fd[0], chunk, sizeof(chunk));
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    if ((size_t)n >= ERROR_TAIL) {
+      memcpy(tail, chunk + n - ERROR_TAIL, ERROR_TAIL);
+      kept = ERROR_TAIL;
+    }
+    else {
+      if (kept + n > ERROR_TAIL) {
+        memmove(tail, tail + kept + n - ERROR_TAIL, ERROR_TAIL - n);
+        kept = ERROR_TAIL - n;
+      }
+      memcpy(tail + kept, chunk, n);
+      kept += n;
+    }
+  }
+  close(pipe_fd[0]);
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    ;
+
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+    const char *output = job->stdout_file;
+
+    if (job->tool != TOOL_CASDIR) {
+      int argc = 0;
+      while (job->argv[argc] != NULL)
+        argc++;
+      output = job->argv[argc-1];
+    }
+    /* The journal says ok only once the output is on disk, so a crash
+     * cannot leave a job skipped with its output lost */
+    if (output != NULL && syncFile(output) < 0) {
+      snprintf(job->error, sizeof(job->error), "cannot sync %s: %s", output, strerror(errno));
+      job->state = JOB_FAILED;
+      job->status = 1;
+    }
+    else {
+      job->state = JOB_OK;
+      job->status = 0;
+      if (output != NULL)
+        job->bytes_out = fileSize(output);
+    }
+    job->seconds = now() - start;
+    return;
+  }
+
+  job->seconds = now() - start;
+  job->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  job->state = interrupted && WIFSIGNALED(status) ? JOB_INTERRUPTED : JOB_FAILED;
+  while (kept > 0 && (tail[kept-1] == '\n' || tail[kept-1] == '\r'))
+    kept--;
+  tail[kept] = '\0';
+  snprintf(job->error, sizeof(job->error), "%s",
+           strrchr(tail, '\n') ? strrchr(tail, '\n') + 1 : tail);
+}
+
+/* Append a finished job to the journal in one write, so lines never mix,
+ * and flush it so a line once written survives a crash */
+static void journalJob(const Batch *batch, const Job *job)
+{
+  char line[128];
+  int length;
+
+  length = snprintf(line, sizeof(line), "%016llx %s %d %.0f %d\n",
+                    (unsigned long long)job->id, job->state == JOB_OK ? "ok" : "fail",
+                    job->status, job->seconds * 1000, job->line);
+  if (write(batch->journal, line, length) != length || fdatasync(batch->journal) < 0)
+    fprintf(stderr,"casbatch: failed writing the journal: %s\n",strerror(errno));
+}
+
+/* Worker thread: jobs are taken in manifest order but finish in any
+ * order, so a long job never holds up the journal of the others */
+static void *worker(void *arg)
+{
+  Batch *batch = arg;
+
+  for (;;) {
+    Job *job = NULL;
+
+    pthread_mutex_lock(&batch->lock);
+    while (!interrupted && batch->next < batch->count && job == NULL) {
+      if (batch->jobs[batch->next].state == JOB_PENDING)
+        job = &batch->jobs[batch->next];
+      batch->next++;
+    }
+    pthread_mutex_unlock(&batch->lock);
+    if (job == NULL)
+      break;
+
+    runJob(batch, job);
+
+    pthread_mutex_lock(&batch->lock);
+    if (job->state != JOB_INTERRUPTED)
+      journalJob(batch, job);
+    batch->finished++;
+    if (!batch->quiet) {
+      int width = snprintf(NULL, 0, "%zu", batch->pending);
+      printf("[%*zu/%zu] %-4s %7.2fs  %s\n", width, batch->finished, batch->pending,
+             job->state == JOB_OK ? "ok" : "FAIL", job->seconds, job->text);
+      fflush(stdout);
+    }
+    pthread_mutex_unlock(&batch->lock);
+  }
+  return NULL;
+}
+
+/* Print totals per tool and the failed jobs */
+static int printSummary(const Batch *batch, size_t skipped, double wall)
+{
+  size_t ok[TOOL_COUNT] = { 0 }, failed = 0, interrupted_jobs = 0, left = 0;
+  uint64_t bytes_in[TOOL_COUNT] = { 0 }, bytes_out[TOOL_COUNT] = { 0 };
+  double seconds[TOOL_COUNT] = { 0 };
+  uint64_t total_in = 0;
+
+  for (size_t i = 0; i < batch->count; i++) {
+    const Job *job = &batch->jobs[i];
+
+    if (job->state == JOB_OK) {
+      ok[job->tool]++;
+      bytes_in[job->tool] += job->bytes_in;
+      bytes_out[job->tool] += job->bytes_out;
+      seconds[job->tool] += job->seconds;
+      total_in += job->bytes_in;
+    }
+    failed += job->state == JOB_FAILED;
+    interrupted_jobs += job->state == JOB_INTERRUPTED;
+    left += job->state == JOB_PENDING;
+  }
+
+  fprintf(stderr, "casbatch: %zu jobs, %zu done before, %zu ok, %zu failed",
+          batch->count, skipped, ok[0] + ok[1] + ok[2], failed);
+  if (interrupted_jobs + left > 0)
+    fprintf(stderr, ", %zu left (interrupted)", interrupted_jobs + left);
+  fprintf(stderr, " in %.1f s, %.2f MB/s in\n", wall, wall > 0 ? total_in / wall / 1e6 : 0);
+
+  /* Rates per tool are over the time its jobs ran, summed */
+  for (int t = 0; t < TOOL_COUNT; t++)
+    if (ok[t] > 0)
+      fprintf(stderr, "  %-8s %6zu ok %9.1f MB in %9.1f MB out %9.1f job-s %8.2f MB/s in %8.2f MB/s out\n",
+              tool_names[t], ok[t], bytes_in[t] / 1e6, bytes_out[t] / 1e6, seconds[t],
+              seconds[t] > 0 ? bytes_in[t] / seconds[t] / 1e6 : 0,
+              seconds[t] > 0 ? bytes_out[t] / seconds[t] / 1e6 : 0);
+
+  for (size_t i = 0; i < batch->count; i++) {
+    const Job *job = &batch->jobs[i];
+    if (job->state == JOB_FAILED)
+      fprintf(stderr, "  failed line %d (status %d): %s\n    %s\n",
+              job->line, job->status, job->text, job->error);
+  }
+  return failed > 0 || interrupted_jobs + left > 0;
+}
+
+/* Display usage information and command-line options */
+static void showUsage(char *progname)
+{
+  printf("usage: %s [-j threads] [--journal file] [--fresh] [-q] <manifest>\n"
+         " -j        number of jobs run at a time (default: number of CPUs)\n"
+         " --journal record finished jobs in file (default: <manifest>.journal);\n"
+         "           jobs it lists as ok are skipped when the run is repeated\n"
+         " --fresh   ignore and truncate the journal: run every job\n"
+         " -q        no line per finished job, only the summary\n"
+         "Manifest lines are cas2wav, wav2cas or casdir command lines;\n"
+         "\"> file\" saves the standard output of a job.\n"
+   ,progname);
+}
+
+int main(int argc, char* argv[])
+{
+  Batch batch;
+  const char *manifest = NULL;
+  const char *journal = NULL;
+  char *journal_default = NULL, *tool_dir;
+  bool fresh = false;
+  int threads = 0;
+  size_t skipped;
+  pthread_t *workers;
+  struct sigaction action;
+  double start;
+  int status;
+
+  memset(&batch, 0, sizeof(batch));
+
+  /* Parse command line options */
+  for (int i=1; i<argc; i++) {
+    if (argv[i][0]=='-' && argv[i][1]!='\0') {
+      if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--journal")) {
+        if (i+1 >= argc) {
+          fprintf(stderr,"%s: option %s requires an argument\n",argv[0],argv[i]);
+          exit(1);
+        }
+        if (argv[i][1] == 'j')
+          threads = atoi(argv[++i]);
+        else
+          journal = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--fresh"))
+        fresh = true;
+      else if (!strcmp(argv[i], "-q"))
+        batch.quiet = true;
+      else {
+        fprintf(stderr,"%s: invalid option '%s'\n",argv[0],argv[i]);
+        exit(1);
+      }
+      continue;
+    }
+    if (manifest != NULL) {
+      fprintf(stderr,"%s: too many arguments\n",argv[0]);
+      exit(1);
+    }
+    manifest = argv[i];
+  }
+  if (manifest == NULL) {
+    showUsage(argv[0]);
+    exit(1);
+  }
+  if (threads < 1)
+    threads = defaultWorkerCount();
+
+  /* Tools are looked up next to casbatch when it was run by path */
+  tool_dir = strdup(argv[0]);
+  if (tool_dir == NULL) {
+    fprintf(stderr,"%s: out of memory\n",argv[0]);
+    exit(1);
+  }
+  if (strrchr(tool_dir, '/') != NULL)
+    strrchr(tool_dir, '/')[1] = '\0';
+  else
+    tool_dir[0] = '\0';
+  batch.tool_dir = tool_dir;
+
+  batch.count = readManifest(argv[0], manifest, &batch.jobs);
+  if (journal == NULL) {
+    if ((journal_default = malloc(strlen(manifest) + 9)) == NULL) {
+      fprintf(stderr,"%s: out of memory\n",argv[0]);
+      exit(1);
+    }
+    sprintf(journal_default, "%s.journal", manifest);
+    journal = journal_default;
+  }
+  skipped = fresh ? 0 : readJournal(journal, batch.jobs, batch.count);
+  batch.pending = batch.count - skipped;
+
+  batch.journal = open(journal, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC |
+                       (fresh ? O_TRUNC : 0), 0666);
+  if (batch.journal < 0) {
+    fprintf(stderr,"%s: failed writing %s\n",argv[0],journal);
+    exit(1);
+  }
+
+  /* Stop handing out jobs on an interrupt. Ctrl-C also reaches the running
+   * jobs; after SIGTERM they finish and are journaled */
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onInterrupt;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  pthread_mutex_init(&batch.lock, NULL);
+  if ((workers = malloc(threads * sizeof(pthread_t))) == NULL) {
+    fprintf(stderr,"%s: out of memory\n",argv[0]);
+    exit(1);
+  }
+  start = now();
+  for (int i = 0; i < threads; i++)
+    if (pthread_create(&workers[i], NULL, worker, &batch) != 0) {
+      fprintf(stderr,"%s: cannot start worker threads\n",argv[0]);
+      exit(1);
+    }
+  for (int i = 0; i < threads; i++)
+    pthread_join(workers[i], NULL);
+
+  close(batch.journal);
+  status = printSummary(&batch, skipped, now() - start);
+
+  for (size_t i = 0; i < batch.count; i++) {
+    free(batch.jobs[i].text);
+    free(batch.jobs[i].words);
+  }
+  free(batch.jobs);
+  free(workers);
+  free(journal_default);
+  free(tool_dir);
+  return status;
+}
@@ -21,126 +21,1151 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <memory.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>    /* Also provided by MinGW */
+#include <sys/stat.h>
 #include "lib/caslib.h"
+#include "lib/casindex.h"
+#include "lib/catindex.h"
+#include "lib/cashash.h"
+#include "lib/workpool.h"
+#include "lib/msxbasic.h"
+#include "lib/stats.h"
+#include "lib/trace.h"
 
-/* State machine for tracking expected next block type */
-enum next {
-  NEXT_NONE,    /* No specific block expected */
-  NEXT_ASCII,   /* Expecting ASCII data continuation */
-  NEXT_BINARY,  /* Expecting binary header info */
-  NEXT_DATA     /* Expecting BASIC data */
-};
+/* Output formats */
+typedef enum {
+  FORMAT_TEXT,   /* Classic human readable listing */
+  FORMAT_JSON,   /* One JSON object per CAS file */
+  FORMAT_CSV     /* One CSV row per entry */
+} OutputFormat;
 
-int main(int argc, char* argv[])
+/* Entry filter; negative fields and a NULL name match anything */
+typedef struct {
+  int type;            /* CasEntryType */
+  const char *name;    /* Filename, trailing spaces ignored */
+  long start;          /* BIN/BASIC load address */
+  long stop;           /* BIN/BASIC end address */
+  long exec;           /* BIN/BASIC exec address (start if not stored) */
+} Query;
+
+/* Parse a query such as "type=binary,start=c000" (addresses in hex) */
+static int parseQuery(char *expr, Query *query)
 {
-  FILE *ifile;
-  /* Union allows reading data as bytes or interpreting as binary header */
-  union {
-    uint8_t data[10];
-    struct binary_header_t {
-      uint16_t start, stop, exec;  /* Binary: start addr, end addr, exec addr */
-    } binary_header;
-  } buffer;
-  char filename[6];  /* MSX filenames are 6 characters */
-  long position;     /* Current file position */
-  int  next = NEXT_NONE;  /* Expected next block type */
-
-  if (argc != 2) {
-
-    printf("usage: %s <ifile>\n",argv[0]);
-    exit(0);
+  char *term, *value, *end;
+
+  query->type = -1;
+  query->name = NULL;
+  query->start = query->stop = query->exec = -1;
+
+  for (term = strtok(expr, ","); term != NULL; term = strtok(NULL, ",")) {
+    if ((value = strchr(term, '=')) == NULL)
+      return -1;
+    *value++ = '\0';
+
+    if (!strcmp(term, "type")) {
+      for (query->type = ENTRY_ASCII; query->type <= ENTRY_CUSTOM; query->type++)
+        if (!strcmp(value, entryTypeName(query->type)))
+          break;
+      if (query->type > ENTRY_CUSTOM)
+        return -1;
+    }
+    else if (!strcmp(term, "name"))
+      query->name = value;
+    else {
+      long address = strtol(value, &end, 16);
+      if (*value == '\0' || *end != '\0' || address < 0 || address > 0xffff)
+        return -1;
+      if (!strcmp(term, "start"))
+        query->start = address;
+      else if (!strcmp(term, "stop"))
+        query->stop = address;
+      else if (!strcmp(term, "exec"))
+        query->exec = address;
+      else
+        return -1;
+    }
+  }
+  return 0;
+}
+
+/* Check an entry against a query (NULL matches everything) */
+static bool matchEntry(const Query *query, const CasEntry *entry)
+{
+  if (query == NULL)
+    return true;
+  if (query->type >= 0 && entry->type != (CasEntryType)query->type)
+    return false;
+
+  if (query->name != NULL) {
+    size_t length = strlen(entry->name);
+    while (length > 0 && entry->name[length-1] == ' ')
+      length--;
+    if (entry->type == ENTRY_CUSTOM || strlen(query->name) != length ||
+        strncmp(query->name, entry->name, length))
+      return false;
+  }
+
+  if (query->start >= 0 || query->stop >= 0 || query->exec >= 0) {
+    uint16_t exec = entry->exec ? entry->exec : entry->start;
+    if ((entry->type != ENTRY_BINARY && entry->type != ENTRY_BASIC) || !entry->complete)
+      return false;
+    if ((query->start >= 0 && entry->start != query->start) ||
+        (query->stop >= 0 && entry->stop != query->stop) ||
+        (query->exec >= 0 && exec != query->exec))
+      return false;
+  }
+  return true;
+}
+
+/* Check whether any entry of an image matches */
+static bool hasMatch(const Query *query, const CasIndex *index)
+{
+  for (size_t i = 0; i < index->entry_count; i++)
+    if (matchEntry(query, &index->entries[i]))
+      return true;
+  return false;
+}
+
+/* Print one entry in the classic casdir format */
+static void printEntry(FILE *out, const CasIndex *index, const CasEntry *entry)
+{
+  uint16_t exec;
+
+  switch (entry->type) {
+
+    case ENTRY_ASCII:
+      fprintf(out, "%.6s  ascii\n", entry->name);
+      break;
+
+    case ENTRY_BASIC:
+      fprintf(out, "%.6s  basic\n", entry->name);
+      break;
+
+    case ENTRY_BINARY:
+      /* Only listed once the address block has been seen */
+      if (!entry->complete)
+        break;
+      /* If no exec address specified, default to start address */
+      exec = entry->exec ? entry->exec : entry->start;
+      fprintf(out, "%.6s  binary  %.4x,%.4x,%.4x\n", entry->name,
+              entry->start, entry->stop, exec);
+      break;
+
+    case ENTRY_CUSTOM:
+      fprintf(out, "------  custom  %.6x\n", (int)index->blocks[entry->block].offset);
+      break;
+  }
+}
+
+/* Write a JSON string literal; bytes outside printable ASCII are escaped */
+static void printJsonString(FILE *out, const char *s)
+{
+  fputc('"', out);
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\')
+      fprintf(out, "\\%c", c);
+    else if (c < 0x20 || c >= 0x7f)
+      fprintf(out, "\\u%04x", c);
+    else
+      fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+/* Write a CSV field, quoted with embedded quotes doubled */
+static void printCsvString(FILE *out, const char *s)
+{
+  fputc('"', out);
+  for (; *s; s++) {
+    if (*s == '"')
+      fputc('"', out);
+    fputc(*s, out);
+  }
+  fputc('"', out);
+}
+
+/* List one image as a single-line JSON object */
+static void printJson(FILE *out, const char *filename, uint64_t size,
+                      const CasIndex *index, const Query *query, bool hashes,
+                      int64_t samples, int output_frequency)
+{
+  bool first = true;
+
+  fprintf(out, "{\"file\":");
+  printJsonString(out, filename);
+  fprintf(out, ",\"size\":%llu", (unsigned long long)size);
+  if (samples >= 0)
+    fprintf(out, ",\"samples\":%lld,\"seconds\":%.2f", (long long)samples,
+            (double)samples / output_frequency);
+  fprintf(out, ",\"entries\":[");
+
+  for (size_t i = 0; i < index->entry_count; i++) {
+    const CasEntry *entry = &index->entries[i];
+    const CasBlock *block = &index->blocks[entry->block];
+
+    if (!matchEntry(query, entry))
+      continue;
+    fprintf(out, "%s{\"type\":\"%s\"", first ? "" : ",", entryTypeName(entry->type));
+    first = false;
+    if (entry->type != ENTRY_CUSTOM) {
+      fprintf(out, ",\"name\":");
+      printJsonString(out, entry->name);
+    }
+    fprintf(out, ",\"offset\":%zu,\"blocks\":[", block->header);
+    for (size_t b = 0; b < entry->blocks; b++)
+      fprintf(out, "%s{\"offset\":%zu,\"length\":%zu}", b ? "," : "",
+              block[b].offset, block[b].length);
+    fprintf(out, "],\"data_blocks\":%zu,\"payload\":%zu,\"complete\":%s",
+            entry->blocks - 1, entry->payload,
+            entry->complete ? "true" : "false");
+    if ((entry->type == ENTRY_BINARY || entry->type == ENTRY_BASIC) && entry->complete)
+      fprintf(out, ",\"start\":%u,\"stop\":%u,\"exec\":%u",
+              entry->start, entry->stop, entry->exec);
+    if (hashes)
+      fprintf(out, ",\"hash\":\"%016llx\"", (unsigned long long)entry->hash);
+    fputc('}', out);
   }
+  fprintf(out, "]}\n");
+}
+
+/* CSV column names, printed once before the first row; tape_samples is
+ * an image-level value, set only on the "image" row of --duration */
+static const char csv_columns[] =
+  "file,entry,type,name,offset,blocks,data_blocks,block_offsets,block_lengths,"
+  "payload,complete,start,stop,exec,hash,tape_samples\n";
+
+/* List one image as one CSV row per entry, after an "image" row with the
+ * tape length when it was computed */
+static void printCsv(FILE *out, const char *filename, const CasIndex *index,
+                     const Query *query, bool hashes, int64_t samples)
+{
+  if (samples >= 0) {
+    printCsvString(out, filename);
+    fprintf(out, ",,image,,,,,,,,,,,,,%lld\n", (long long)samples);
+  }
+  for (size_t i = 0; i < index->entry_count; i++) {
+    const CasEntry *entry = &index->entries[i];
+    const CasBlock *block = &index->blocks[entry->block];
+
+    if (!matchEntry(query, entry))
+      continue;
+    printCsvString(out, filename);
+    fprintf(out, ",%zu,%s,", i, entryTypeName(entry->type));
+    if (entry->type != ENTRY_CUSTOM)
+      printCsvString(out, entry->name);
+    fprintf(out, ",%zu,%zu,%zu,", block->header, entry->blocks, entry->blocks - 1);
+    for (size_t b = 0; b < entry->blocks; b++)
+      fprintf(out, "%s%zu", b ? ";" : "", block[b].offset);
+    fputc(',', out);
+    for (size_t b = 0; b < entry->blocks; b++)
+      fprintf(out, "%s%zu", b ? ";" : "", block[b].length);
+    fprintf(out, ",%zu,%d", entry->payload,
+            entry->complete ? 1 : 0);
+    if ((entry->type == ENTRY_BINARY || entry->type == ENTRY_BASIC) && entry->complete)
+      fprintf(out, ",%u,%u,%u,", entry->start, entry->stop, entry->exec);
+    else
+      fprintf(out, ",,,,");
+    if (hashes)
+      fprintf(out, "%016llx", (unsigned long long)entry->hash);
+    fputs(",\n", out);
+  }
+}
+
+/* CSV column names of the verification report */
+static const char csv_verify_columns[] = "file,valid,offset,problem\n";
+
+/* Report the verification result of one image (violation NULL if valid) */
+static void printVerdict(FILE *out, OutputFormat format, const char *filename,
+                         const CasViolation *violation)
+{
+  switch (format) {
+
+    case FORMAT_JSON:
+      fprintf(out, "{\"file\":");
+      printJsonString(out, filename);
+      if (violation == NULL)
+        fprintf(out, ",\"valid\":true}\n");
+      else {
+        fprintf(out, ",\"valid\":false,\"offset\":%zu,\"problem\":", violation->offset);
+        printJsonString(out, violation->problem);
+        fprintf(out, "}\n");
+      }
+      break;
+
+    case FORMAT_CSV:
+      printCsvString(out, filename);
+      if (violation == NULL)
+        fprintf(out, ",1,,\n");
+      else {
+        fprintf(out, ",0,%zu,", violation->offset);
+        printCsvString(out, violation->problem);
+        fputc('\n', out);
+      }
+      break;
+
+    case FORMAT_TEXT:
+      if (violation == NULL)
+        fprintf(out, "%s: ok\n", filename);
+      else
+        fprintf(out, "%s: %.6zx: %s\n", filename, violation->offset, violation->problem);
+      break;
+  }
+}
 
-  /* Open CAS file for reading */
-  if ( (ifile = fopen(argv[1],"rb")) == NULL) {
+/* Growable list of image paths */
+typedef struct {
+  char **paths;
+  size_t count;
+  size_t capacity;
+} FileList;
 
-    fprintf(stderr,"%s: failed opening %s\n",argv[0],argv[1]);
+/* One program occurrence, for duplicate detection */
+typedef struct {
+  uint64_t hash;
+  CasEntryType type;
+  size_t payload;
+  const char *file;      /* Image path (owned by the file list or index) */
+  size_t entry;          /* Entry number within the image */
+  size_t order;          /* Position in listing order */
+  char name[7];
+} Copy;
+
+/* Growable list of program occurrences */
+typedef struct {
+  Copy *items;
+  size_t count;
+  size_t capacity;
+} DupList;
+
+/* Listing options shared by all workers */
+typedef struct {
+  const char *progname;
+  OutputFormat format;
+  const Query *query;      /* Entry filter, NULL to list everything */
+  FileList files;
+  const char *index_file;  /* Catalog index to maintain, or NULL */
+  CatIndex previous;       /* Index as loaded at startup */
+  CatIndex updated;        /* Index to save: this run's files in order, then the rest */
+  bool hashes;             /* Compute program hashes */
+  bool dups;               /* Report duplicate programs instead of listing */
+  bool list;               /* List BASIC programs below their entries */
+  bool verify;             /* Check image structure instead of listing */
+  bool duration;           /* Compute the cas2wav tape length */
+  int baudrate;            /* cas2wav profile for the tape length */
+  int output_frequency;
+  uint32_t silence_time;
+  DupList copies;          /* Hashed entries, for the duplicate report */
+  /* Summary, accumulated in file order */
+  size_t reparsed;
+  size_t unreadable;
+  size_t errors;
+  size_t entries[ENTRY_CUSTOM + 1];
+  size_t payload;
+  size_t truncated;
+  size_t invalid;
+  uint64_t samples;
+} Catalog;
+
+/* Result of listing one image */
+typedef struct {
+  CatRecord record;                 /* Image identity and block index */
+  bool reparsed;                    /* Index rebuilt from the image */
+  char *text;                       /* Rendered listing */
+  size_t length;
+  bool failed;                      /* Unreadable image */
+  bool empty;                       /* No HEADER found */
+  size_t entries[ENTRY_CUSTOM + 1]; /* Entries per type */
+  size_t payload;                   /* Payload bytes of all entries */
+  size_t truncated;                 /* Entries missing blocks or EOF */
+  bool invalid;                     /* Failed verification */
+  int64_t samples;                  /* Tape length, -1 if not computed */
+} ListResult;
+
+/* Append a copy of path to the list */
+static void addFile(FileList *list, const char *path)
+{
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 256;
+    list->paths = (char**)realloc(list->paths, list->capacity * sizeof(char*));
+    if (list->paths == NULL) {
+      fprintf(stderr,"out of memory\n");
+      exit(1);
+    }
+  }
+  if ((list->paths[list->count++] = strdup(path)) == NULL) {
+    fprintf(stderr,"out of memory\n");
     exit(1);
   }
+}
+
+static int comparePaths(const void *a, const void *b)
+{
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/* Check for a .cas extension (any case) */
+static bool isCasName(const char *name)
+{
+  size_t length = strlen(name);
+  return length > 4 && !strcasecmp(name + length - 4, ".cas");
+}
+
+/* Recursively collect .cas files below dir in sorted order.
+ * Symbolic links to directories are not followed. */
+static void walkDirectory(const char *progname, const char *dir, FileList *list)
+{
+  FileList names = { NULL, 0, 0 };
+  DIR *handle;
+  struct dirent *ent;
+  struct stat st;
+
+  if ((handle = opendir(dir)) == NULL) {
+    fprintf(stderr,"%s: failed opening directory %s\n",progname,dir);
+    return;
+  }
+  while ((ent = readdir(handle)) != NULL)
+    if (strcmp(ent->d_name, ".") && strcmp(ent->d_name, ".."))
+      addFile(&names, ent->d_name);
+  closedir(handle);
+
+  /* Sort each directory so the listing order is stable */
+  qsort(names.paths, names.count, sizeof(char*), comparePaths);
+
+  for (size_t i = 0; i < names.count; i++) {
+    size_t length = strlen(dir) + strlen(names.paths[i]) + 2;
+    char *path = (char*)malloc(length);
+    if (path == NULL) {
+      fprintf(stderr,"out of memory\n");
+      exit(1);
+    }
+    snprintf(path, length, "%s/%s", dir, names.paths[i]);
+
+#ifndef _WIN32
+    if (lstat(path, &st) == 0) {
+#else
+    /* No symbolic links to skip; MinGW has no lstat */
+    if (stat(path, &st) == 0) {
+#endif
+      if (S_ISDIR(st.st_mode))
+        walkDirectory(progname, path, list);
+      else if (isCasName(names.paths[i]) &&
+               (S_ISREG(st.st_mode) || (stat(path, &st) == 0 && S_ISREG(st.st_mode))))
+        addFile(list, path);
+    }
+    free(path);
+    free(names.paths[i]);
+  }
+  free(names.paths);
+}
+
+/* Open an in-memory stream collecting the rendered listing */
+static FILE *openTextStream(ListResult *result)
+{
+#ifndef _WIN32
+  return open_memstream(&result->text, &result->length);
+#else
+  return tmpfile();
+#endif
+}
+
+/* Close the listing stream, leaving its contents in result->text */
+static void closeTextStream(FILE *out, ListResult *result)
+{
+#ifndef _WIN32
+  fclose(out);
+#else
+  result->length = ftell(out);
+  result->text = (char*)malloc(result->length + 1);
+  rewind(out);
+  if (result->text != NULL)
+    result->length = fread(result->text, 1, result->length, out);
+  else
+    result->length = 0;
+  fclose(out);
+#endif
+}
 
-  position=0;
-  /* Scan file in 8-byte chunks looking for HEADER markers */
-  while (fread(&buffer,1,8,ifile)==8) {
-
-    position += 8;
-
-    /* Found a HEADER marker - process based on state machine */
-    if (!memcmp(&buffer,HEADER,8)) {
-
-      switch (next) {
-
-	case NEXT_NONE:
-	default:
-          if (fread(&buffer,1,10,ifile)==10) {
-	    /* ASCII file: read filename and print */
-	    if (!memcmp(&buffer,ASCII,10)) {
-
-	      fread(filename,1,6,ifile); next=NEXT_ASCII;
-	      printf("%.6s  ascii\n",filename);
-	      position += 16;
-	    }
-
-	    /* Binary file: store filename, wait for header block */
-	    else if (!memcmp(&buffer,BIN,10)) {
-
-	      fread(filename,1,6,ifile); next=NEXT_BINARY;
-	      position += 16;
-	    }
-
-	    /* BASIC program: read filename and print */
-	    else if (!memcmp(&buffer,BASIC,10)) {
-
-	      fread(filename,1,6,ifile); next=NEXT_DATA;
-	      printf("%.6s  basic\n", filename);
-	      position += 16;
-	    }
-
-	    /* Unknown/custom file type */
-	    else {
-
-	      printf("------  custom  %.6x\n",(int)position);
-	      fseek(ifile, -2, SEEK_CUR);
-	      position += 8;
-	    }
-	  }
-	  break;
-
-	/* Skip ASCII data blocks until EOF marker (0x1A) found */
-	case NEXT_ASCII:
-	  while (fread(&buffer,1,8,ifile) == 8 &&
-	         memchr(&buffer, 0x1a, 8) == NULL)
-	    position += 8;
-	  position += 8;
-
-	  next = NEXT_NONE;
-	  break;
-
-	/* Binary file: read and display header info (start, end, exec addresses) */
-	case NEXT_BINARY:
-	  if (fread(&buffer,1,8,ifile)==8) {
-	    /* If no exec address specified, default to start address */
-	    if (!buffer.binary_header.exec)
-	       buffer.binary_header.exec=buffer.binary_header.start;
-
-	    printf("%.6s  binary  %.4x,%.4x,%.4x\n",filename,
-	    		buffer.binary_header.start,
-	    		buffer.binary_header.stop,
-	    		buffer.binary_header.exec);
-	    position += 8;
-	    next=NEXT_NONE;
-	  }
-	  break;
-
-	case NEXT_DATA:
-	  next=NEXT_NONE;
-	  break;
+/* Modification time of a file with sub-second precision where available */
+static void fileTime(const struct stat *st, int64_t *sec, uint32_t *nsec)
+{
+  *sec = st->st_mtime;
+#if defined(__APPLE__)
+  *nsec = st->st_mtimespec.tv_nsec;
+#elif !defined(_WIN32)
+  *nsec = st->st_mtim.tv_nsec;
+#else
+  *nsec = 0;
+#endif
+}
+
+/* Fill the record of an image: reuse the indexed block table while the
+ * file is unchanged, re-parse it otherwise. With contents set the image
+ * stays mapped there (also when its table comes from the index), for the
+ * caller to close even on failure. Returns -1 if unreadable. */
+static int refreshRecord(Catalog *catalog, const char *filename,
+                         CatRecord *record, bool *reparsed, CasImage *contents)
+{
+  const CatRecord *old = NULL;
+  CasImage mapped = { NULL, 0, false };
+  CasImage *image = contents != NULL ? contents : &mapped;
+  struct stat st;
+
+  if (catalog->index_file != NULL) {
+    if (stat(filename, &st) < 0)
+      return -1;
+    record->size = st.st_size;
+    fileTime(&st, &record->mtime, &record->mtime_nsec);
+
+    /* Same size and time stamp: trust the stored block table */
+    old = findCatRecord(&catalog->previous, filename);
+    if (old != NULL && old->size == record->size &&
+        old->mtime == record->mtime && old->mtime_nsec == record->mtime_nsec) {
+      record->hash = old->hash;
+      if (contents != NULL) {
+        if (openCasImage(filename, contents) < 0)
+          return -1;
+        STATS_ADD(COUNT_BYTES_READ, contents->size);
       }
+      return copyCasIndex(&record->index, &old->index);
     }
   }
 
-  fclose(ifile);
+  /* Map CAS file into memory and locate all blocks */
+  if (openCasImage(filename, image) < 0)
+    return -1;
+  record->size = image->size;
+  STATS_ADD(COUNT_BYTES_READ, image->size);
+  statsEnter(STAGE_INDEX);
+
+  if (catalog->index_file != NULL) {
+    /* Touched but identical content keeps its block table */
+    record->hash = hash64(image->data, image->size, 0);
+    if (old != NULL && old->size == record->size && old->hash == record->hash) {
+      closeCasImage(&mapped);
+      return copyCasIndex(&record->index, &old->index);
+    }
+  }
 
+  if (buildCasIndex(image->data, image->size, &record->index) < 0) {
+    fprintf(stderr,"%s: out of memory indexing %s\n",catalog->progname,filename);
+    exit(1);
+  }
+  if (catalog->hashes)
+    hashEntries(image->data, &record->index);
+  *reparsed = true;
+  closeCasImage(&mapped);
   return 0;
 }
 
+/* List the tokenised program of a BASIC entry */
+static void printProgram(FILE *out, const CasImage *image, const CasIndex *index,
+                         const CasEntry *entry)
+{
+  const CasBlock *block = &index->blocks[entry->block + 1];
+  const unsigned char *data = image->data + block->offset;
+  long start;
+
+  /* The image may have changed since it was indexed */
+  if (entry->blocks < 2 || block->offset + block->length > image->size)
+    return;
+  if ((start = findBasicProgram(data, block->length)) >= 0)
+    listBasic(out, data + start, block->length - start);
+}
+
+/* Render the listing of one image; the image contents are needed to list
+ * BASIC programs (NULL when answering from the index), samples is the tape
+ * length (-1 if not computed) */
+static void renderListing(FILE *out, const Catalog *catalog, const char *filename,
+                          uint64_t size, const CasIndex *index, const CasImage *image,
+                          int64_t samples)
+{
+  if (catalog->dups || (catalog->query != NULL && !hasMatch(catalog->query, index)))
+    return;
+
+  switch (catalog->format) {
+
+    case FORMAT_JSON:
+      printJson(out, filename, size, index, catalog->query, catalog->hashes,
+                samples, catalog->output_frequency);
+      break;
+
+    case FORMAT_CSV:
+      printCsv(out, filename, index, catalog->query, catalog->hashes, samples);
+      break;
+
+    case FORMAT_TEXT:
+      for (size_t i = 0; i < index->entry_count; i++)
+        if (matchEntry(catalog->query, &index->entries[i])) {
+          printEntry(out, index, &index->entries[i]);
+          if (catalog->list && image != NULL && index->entries[i].type == ENTRY_BASIC)
+            printProgram(out, image, index, &index->entries[i]);
+        }
+      if (samples >= 0) {
+        double seconds = (double)samples / catalog->output_frequency;
+        int minutes = (int)(seconds / 60);
+        fprintf(out, "length  %d:%05.2f  %lld samples\n",
+                minutes, seconds - minutes * 60, (long long)samples);
+      }
+      break;
+  }
+}
+
+/* Worker: index one image and render its listing */
+static void listFile(void *ctx, size_t item, void *data)
+{
+  Catalog *catalog = (Catalog*)ctx;
+  ListResult *result = (ListResult*)data;
+  const char *filename = catalog->files.paths[item];
+  CasIndex *index = &result->record.index;
+  CasImage image = { NULL, 0, false };
+  FILE *out;
+  uint64_t start = traceStart();
+
+  /* Listings and checks need the image contents, not just its index */
+  statsEnter(STAGE_READ);
+  STATS_ADD(COUNT_FILES, 1);
+  if (refreshRecord(catalog, filename, &result->record, &result->reparsed,
+                    catalog->list || catalog->verify || catalog->duration ? &image : NULL) < 0) {
+    closeCasImage(&image);
+    result->failed = true;
+    statsEnter(STAGE_NONE);
+    traceSpan("file", "list", filename, start);
+    return;
+  }
+  statsEnter(STAGE_INDEX);
+
+  result->empty = index->block_count == 0;
+  for (size_t i = 0; i < index->entry_count; i++) {
+    const CasEntry *entry = &index->entries[i];
+    result->entries[entry->type]++;
+    result->payload += entry->payload;
+    if (!entry->complete && entry->type != ENTRY_CUSTOM)
+      result->truncated++;
+  }
+
+  if ((out = openTextStream(result)) == NULL) {
+    fprintf(stderr,"%s: out of memory listing %s\n",catalog->progname,filename);
+    exit(1);
+  }
+  if (catalog->verify) {
+    CasViolation violation;
+    result->invalid = verifyCasImage(image.data, image.size, index, &violation) < 0;
+    printVerdict(out, catalog->format, filename, result->invalid ? &violation : NULL);
+  }
+  else {
+    result->samples = !catalog->duration ? -1 :
+      (int64_t)countSamples(image.data, image.size, index, catalog->baudrate,
+                            catalog->output_frequency, catalog->silence_time);
+    renderListing(out, catalog, filename, result->record.size, index,
+                  catalog->list ? &image : NULL, result->samples);
+  }
+  closeTextStream(out, result);
+  closeCasImage(&image);
+  statsEnter(STAGE_NONE);
+  traceSpan("file", "list", filename, start);
+}
+
+/* Remember the matching entries of an image for the duplicate report */
+static void collectCopies(Catalog *catalog, const char *filename, const CasIndex *index)
+{
+  DupList *list = &catalog->copies;
+
+  for (size_t i = 0; i < index->entry_count; i++) {
+    const CasEntry *entry = &index->entries[i];
+    Copy *copy;
+
+    if (!matchEntry(catalog->query, entry))
+      continue;
+    if (list->count == list->capacity) {
+      list->capacity = list->capacity ? list->capacity * 2 : 1024;
+      list->items = (Copy*)realloc(list->items, list->capacity * sizeof(Copy));
+      if (list->items == NULL) {
+        fprintf(stderr,"%s: out of memory\n",catalog->progname);
+        exit(1);
+      }
+    }
+    copy = &list->items[list->count];
+    copy->hash = entry->hash;
+    copy->type = entry->type;
+    copy->payload = entry->payload;
+    copy->file = filename;
+    copy->entry = i;
+    copy->order = list->count++;
+    memcpy(copy->name, entry->name, sizeof(copy->name));
+  }
+}
+
+/* Order copies by program, then by listing order */
+static int compareCopies(const void *a, const void *b)
+{
+  const Copy *x = (const Copy*)a, *y = (const Copy*)b;
+
+  if (x->hash != y->hash)
+    return x->hash < y->hash ? -1 : 1;
+  if (x->type != y->type)
+    return x->type < y->type ? -1 : 1;
+  if (x->payload != y->payload)
+    return x->payload < y->payload ? -1 : 1;
+  return x->order < y->order ? -1 : x->order > y->order;
+}
+
+/* Order groups by their first occurrence */
+static int compareGroups(const void *a, const void *b)
+{
+  const Copy *x = *(Copy* const*)a, *y = *(Copy* const*)b;
+  return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static bool sameProgram(const Copy *x, const Copy *y)
+{
+  return x->hash == y->hash && x->type == y->type && x->payload == y->payload;
+}
+
+/* Print every program found more than once, in order of first occurrence */
+static void printDuplicates(Catalog *catalog)
+{
+  DupList *list = &catalog->copies;
+  Copy **groups;
+  size_t group_count = 0, redundant = 0, bytes = 0;
+
+  qsort(list->items, list->count, sizeof(Copy), compareCopies);
+
+  /* Collect the first copy of every program that has several */
+  groups = (Copy**)malloc((list->count / 2 + 1) * sizeof(Copy*));
+  if (groups == NULL) {
+    fprintf(stderr,"%s: out of memory\n",catalog->progname);
+    exit(1);
+  }
+  for (size_t i = 0; i + 1 < list->count; ) {
+    size_t j = i + 1;
+    while (j < list->count && sameProgram(&list->items[i], &list->items[j]))
+      j++;
+    if (j - i > 1) {
+      groups[group_count++] = &list->items[i];
+      redundant += j - i - 1;
+      bytes += (j - i - 1) * list->items[i].payload;
+    }
+    i = j;
+  }
+  qsort(groups, group_count, sizeof(Copy*), compareGroups);
+
+  if (catalog->format == FORMAT_CSV)
+    fputs("hash,type,payload,file,entry,name\n", stdout);
+
+  for (size_t g = 0; g < group_count; g++) {
+    const Copy *first = groups[g];
+    const Copy *end = list->items + list->count;
+    const Copy *copy;
+    size_t copies = 0;
+
+    for (copy = first; copy < end && sameProgram(copy, first); copy++)
+      copies++;
+
+    switch (catalog->format) {
+
+      case FORMAT_TEXT:
+        printf("%s%016llx  %s  %zu bytes  %zu copies\n", g ? "\n" : "",
+               (unsigned long long)first->hash, entryTypeName(first->type),
+               first->payload, copies);
+        for (copy = first; copy < first + copies; copy++)
+          printf("  %s  %.6s\n", copy->file,
+                 copy->type == ENTRY_CUSTOM ? "------" : copy->name);
+        break;
+
+      case FORMAT_JSON:
+        printf("{\"hash\":\"%016llx\",\"type\":\"%s\",\"payload\":%zu,\"copies\":[",
+               (unsigned long long)first->hash, entryTypeName(first->type), first->payload);
+        for (copy = first; copy < first + copies; copy++) {
+          printf("%s{\"file\":", copy == first ? "" : ",");
+          printJsonString(stdout, copy->file);
+          printf(",\"entry\":%zu", copy->entry);
+          if (copy->type != ENTRY_CUSTOM) {
+            printf(",\"name\":");
+            printJsonString(stdout, copy->name);
+          }
+          putchar('}');
+        }
+        printf("]}\n");
+        break;
+
+      case FORMAT_CSV:
+        for (copy = first; copy < first + copies; copy++) {
+          printf("%016llx,%s,%zu,", (unsigned long long)copy->hash,
+                 entryTypeName(copy->type), copy->payload);
+          printCsvString(stdout, copy->file);
+          printf(",%zu,", copy->entry);
+          if (copy->type != ENTRY_CUSTOM)
+            printCsvString(stdout, copy->name);
+          putchar('\n');
+        }
+        break;
+    }
+  }
+
+  fprintf(stderr,"%zu duplicate groups, %zu redundant copies, %zu redundant payload bytes\n",
+          group_count, redundant, bytes);
+  free(groups);
+}
+
+/* Print a rendered listing, preceded by the filename when listing several
+ * images in text format */
+static void printText(Catalog *catalog, const char *filename, const char *text, size_t length)
+{
+  static bool first = true;
+
+  if (catalog->dups || (length == 0 && catalog->query != NULL))
+    return;
+  if (catalog->format == FORMAT_TEXT && !catalog->verify &&
+      (catalog->files.count > 1 || catalog->query != NULL)) {
+    printf("%s%s:\n", first ? "" : "\n", filename);
+    first = false;
+  }
+  fwrite(text, 1, length, stdout);
+}
+
+/* Move the records of images this run did not list into the updated
+ * index, so indexing some files keeps the rest; images that no longer
+ * exist are dropped */
+static void keepUnlisted(Catalog *catalog)
+{
+  char **listed = (char**)malloc(catalog->files.count * sizeof(char*) + 1);
+  struct stat st;
+
+  if (listed == NULL) {
+    fprintf(stderr,"%s: out of memory\n",catalog->progname);
+    exit(1);
+  }
+  memcpy(listed, catalog->files.paths, catalog->files.count * sizeof(char*));
+  qsort(listed, catalog->files.count, sizeof(char*), comparePaths);
+
+  for (size_t i = 0; i < catalog->previous.count; i++) {
+    CatRecord *record = &catalog->previous.records[i];
+    char *path = record->path;
+
+    if (bsearch(&path, listed, catalog->files.count, sizeof(char*), comparePaths) != NULL ||
+        stat(path, &st) < 0)
+      continue;
+    if (addCatRecord(&catalog->updated, record) < 0) {
+      fprintf(stderr,"%s: out of memory\n",catalog->progname);
+      exit(1);
+    }
+    /* Owned by the updated index now */
+    record->path = NULL;
+    memset(&record->index, 0, sizeof(record->index));
+  }
+  free(listed);
+}
+
+/* Answer a query from the loaded index alone */
+static void queryIndex(Catalog *catalog)
+{
+  for (size_t i = 0; i < catalog->previous.count; i++) {
+    const CatRecord *record = &catalog->previous.records[i];
+    ListResult result;
+    FILE *out;
+
+    memset(&result, 0, sizeof(result));
+    if ((out = openTextStream(&result)) == NULL) {
+      fprintf(stderr,"%s: out of memory\n",catalog->progname);
+      exit(1);
+    }
+    renderListing(out, catalog, record->path, record->size, &record->index, NULL, -1);
+    closeTextStream(out, &result);
+    if (catalog->dups)
+      collectCopies(catalog, record->path, &record->index);
+    printText(catalog, record->path, result.text, result.length);
+    free(result.text);
+  }
+}
+
+/* Consumer: print listings in file order and update the summary */
+static void printResult(void *ctx, size_t item, void *data)
+{
+  Catalog *catalog = (Catalog*)ctx;
+  ListResult *result = (ListResult*)data;
+  const char *filename = catalog->files.paths[item];
+
+  if (result->failed) {
+    fprintf(stderr,"%s: failed opening %s\n",catalog->progname,filename);
+    freeCasIndex(&result->record.index);
+    catalog->unreadable++;
+    catalog->errors++;
+    return;
+  }
+
+  uint64_t start = traceStart();
+
+  statsEnter(STAGE_WRITE);
+  printText(catalog, filename, result->text, result->length);
+  statsEnter(STAGE_NONE);
+  traceSpan("file", "print", filename, start);
+  free(result->text);
+  if (catalog->dups)
+    collectCopies(catalog, filename, &result->record.index);
+
+  /* Keep the record for the updated index */
+  if (catalog->index_file != NULL) {
+    if ((result->record.path = strdup(filename)) == NULL ||
+        addCatRecord(&catalog->updated, &result->record) < 0) {
+      fprintf(stderr,"%s: out of memory\n",catalog->progname);
+      exit(1);
+    }
+  }
+  else
+    freeCasIndex(&result->record.index);
+  if (result->reparsed)
+    catalog->reparsed++;
+
+  if (result->empty)
+    catalog->errors++;
+  if (result->invalid)
+    catalog->invalid++;
+  for (int type = 0; type <= ENTRY_CUSTOM; type++)
+    catalog->entries[type] += result->entries[type];
+  catalog->payload += result->payload;
+  catalog->truncated += result->truncated;
+  if (result->samples > 0)
+    catalog->samples += result->samples;
+}
+
+/* Print scan totals to stderr, keeping stdout machine readable */
+static void printSummary(const Catalog *catalog)
+{
+  size_t entries = 0;
+
+  for (int type = 0; type <= ENTRY_CUSTOM; type++)
+    entries += catalog->entries[type];
+
+  fprintf(stderr,"%zu files, %zu errors, %zu entries "
+          "(%zu ascii, %zu binary, %zu basic, %zu custom), "
+          "%zu payload bytes, %zu truncated, %zu parsed",
+          catalog->files.count, catalog->errors, entries,
+          catalog->entries[ENTRY_ASCII], catalog->entries[ENTRY_BINARY],
+          catalog->entries[ENTRY_BASIC], catalog->entries[ENTRY_CUSTOM],
+          catalog->payload, catalog->truncated, catalog->reparsed);
+  if (catalog->duration) {
+    uint64_t seconds = catalog->samples / catalog->output_frequency;
+    fprintf(stderr,", %u:%02u:%02u tape", (unsigned)(seconds / 3600),
+            (unsigned)(seconds / 60 % 60), (unsigned)(seconds % 60));
+  }
+  fputc('\n', stderr);
+}
+
+/* Display usage information and command-line options */
+static void showUsage(char *progname)
+{
+  printf("usage: %s [--json|--csv] [-r] [-j threads] [--index file] [--query expr]\n"
+         "       [--hash] [--dups] [--list] [--verify] [--duration [-2] [-s seconds]]\n"
+         "       [--stats[=json]] [--perf-counters] [--trace file]\n"
+         "       <ifile|dir> ...\n"
+         " --json  one JSON object per file with offsets, lengths and addresses\n"
+         " --csv   one CSV row per entry with offsets, lengths and addresses\n"
+         "         (with --duration, an \"image\" row first with tape_samples)\n"
+         " -r      scan directories recursively for .cas files and print a summary\n"
+         " -j      number of worker threads (default: number of CPUs)\n"
+         " --index maintain a catalog index, re-parsing only changed files and\n"
+         "         keeping the records of other files while they exist;\n"
+         "         without input files, answer --query from the index alone\n"
+         " --query list matching entries only, e.g. type=binary,start=c000\n"
+         "         (terms: type, name, start, stop, exec; addresses in hex)\n"
+         " --hash  add program content hashes to JSON/CSV output\n"
+         " --dups  report programs found more than once instead of listing\n"
+         " --list  list tokenised BASIC programs below their entries (text output)\n"
+         " --verify check image structure and report the first problem of each\n"
+         "         file; exit status 1 if any file fails\n"
+         " --duration add the length of the tape cas2wav would write\n"
+         " -2      tape length at 2400 baud\n"
+         " -s      tape length with this gap time (in seconds) between files\n"
+         " --stats print time per stage (summed over threads) and counters to\n"
+         "         stderr, as text or json\n"
+         " --perf-counters add cycles, instructions, cache and branch misses\n"
+         "         per stage to the --stats report (Linux perf_event_open)\n"
+         " --trace write a Chrome trace-event file with a span per file, stage,\n"
+         "         worker thread and wait\n"
+   ,progname);
+}
+
+int main(int argc, char* argv[])
+{
+  Catalog catalog;
+  Query query;
+  bool recursive = false;
+  int threads = 0;
+  StatsFormat stats = STATS_OFF;
+  bool perf_counters = false;
+  const char *trace_file = NULL;
+  struct stat st;
+
+  memset(&catalog, 0, sizeof(catalog));
+  catalog.progname = argv[0];
+  catalog.format = FORMAT_TEXT;
+  catalog.baudrate = 1200;
+  catalog.output_frequency = OUTPUT_FREQUENCY;
+  catalog.silence_time = LONG_SILENCE;
+
+  /* Parse command line options */
+  for (int i=1; i<argc; i++) {
+    if (argv[i][0]=='-' && argv[i][1]!='\0') {
+      if (!strcmp(argv[i], "--json"))
+        catalog.format = FORMAT_JSON;
+      else if (!strcmp(argv[i], "--csv"))
+        catalog.format = FORMAT_CSV;
+      else if (!strcmp(argv[i], "--hash"))
+        catalog.hashes = true;
+      else if (!strcmp(argv[i], "--dups"))
+        catalog.dups = true;
+      else if (!strcmp(argv[i], "--list"))
+        catalog.list = true;
+      else if (!strcmp(argv[i], "--verify"))
+        catalog.verify = true;
+      else if (!strcmp(argv[i], "--duration"))
+        catalog.duration = true;
+      else if (statsFormat(argv[i]) != STATS_OFF)
+        stats = statsFormat(argv[i]);
+      else if (!strcmp(argv[i], "--perf-counters"))
+        perf_counters = true;
+      else if (!strcmp(argv[i], "--trace")) {
+        if (i+1 >= argc) {
+          fprintf(stderr,"%s: option --trace requires an argument\n",argv[0]);
+          exit(1);
+        }
+        trace_file = argv[++i];
+      }
+      else if (!strcmp(argv[i], "-2")) {
+        /* Same profile as cas2wav -2: double baud rate and sample rate */
+        catalog.baudrate = 2400;
+        catalog.output_frequency = OUTPUT_FREQUENCY * 2;
+      }
+      else if (!strcmp(argv[i], "-s")) {
+        if (i+1 >= argc) {
+          fprintf(stderr,"%s: option -s requires an argument\n",argv[0]);
+          exit(1);
+        }
+        catalog.silence_time = OUTPUT_FREQUENCY * atof(argv[++i]);
+      }
+      else if (!strcmp(argv[i], "-r"))
+        recursive = true;
+      else if (!strcmp(argv[i], "--index")) {
+        if (i+1 >= argc) {
+          fprintf(stderr,"%s: option --index requires an argument\n",argv[0]);
+          exit(1);
+        }
+        catalog.index_file = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--query")) {
+        if (i+1 >= argc || parseQuery(argv[++i], &query) < 0) {
+          fprintf(stderr,"%s: option --query requires terms such as type=binary,start=c000\n",argv[0]);
+          exit(1);
+        }
+        catalog.query = &query;
+      }
+      else if (!strcmp(argv[i], "-j")) {
+        if (i+1 >= argc || (threads = atoi(argv[++i])) < 1) {
+          fprintf(stderr,"%s: option -j requires a positive thread count\n",argv[0]);
+          exit(1);
+        }
+      }
+      else {
+        fprintf(stderr,"%s: invalid option '%s'\n",argv[0],argv[i]);
+        exit(1);
+      }
+      continue;
+    }
+
+    /* Directories are expanded in place, in sorted order */
+    if (recursive && stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+      walkDirectory(argv[0], argv[i], &catalog.files);
+    else
+      addFile(&catalog.files, argv[i]);
+  }
+
+  if (catalog.verify && (catalog.dups || catalog.list)) {
+    fprintf(stderr,"%s: option --verify cannot be combined with --dups or --list\n",argv[0]);
+    exit(1);
+  }
+  if (catalog.list && catalog.format != FORMAT_TEXT) {
+    fprintf(stderr,"%s: option --list requires text output\n",argv[0]);
+    exit(1);
+  }
+
+  if (catalog.index_file != NULL &&
+      loadCatIndex(catalog.index_file, &catalog.previous) < 0) {
+    fprintf(stderr,"%s: failed reading index %s\n",argv[0],catalog.index_file);
+    exit(1);
+  }
+
+  /* Indexes always carry program hashes, so they can answer --dups */
+  catalog.hashes = catalog.hashes || catalog.dups || catalog.index_file != NULL;
+
+  if (catalog.files.count == 0) {
+
+    /* Queries without input files are answered from the index */
+    if (catalog.index_file != NULL && (catalog.query != NULL || catalog.dups)) {
+      if (catalog.format == FORMAT_CSV && !catalog.dups)
+        fputs(csv_columns, stdout);
+      queryIndex(&catalog);
+      if (catalog.dups)
+        printDuplicates(&catalog);
+      freeCatIndex(&catalog.previous);
+      exit(0);
+    }
+    if (!recursive)
+      showUsage(argv[0]);
+    exit(0);
+  }
+
+  if (catalog.format == FORMAT_CSV && !catalog.dups)
+    fputs(catalog.verify ? csv_verify_columns : csv_columns, stdout);
+  if (perf_counters && stats == STATS_OFF)
+    stats = STATS_TEXT;
+  if (stats != STATS_OFF)
+    statsStart();
+  if (perf_counters && statsPerfCounters() == 0)
+    fprintf(stderr,"%s: hardware counters unavailable (%s)\n",argv[0],strerror(errno));
+  if (trace_file != NULL && traceOpen(trace_file) < 0) {
+    fprintf(stderr,"%s: failed writing %s\n",argv[0],trace_file);
+    exit(1);
+  }
+
+  /* List images in parallel, printing them in the order collected */
+  if (runOrdered(catalog.files.count, threads, sizeof(ListResult),
+                 listFile, printResult, &catalog) < 0) {
+    fprintf(stderr,"%s: failed starting worker threads\n",argv[0]);
+    exit(1);
+  }
+
+  if (catalog.index_file != NULL)
+    keepUnlisted(&catalog);
+  if (catalog.index_file != NULL &&
+      saveCatIndex(catalog.index_file, &catalog.updated) < 0) {
+    fprintf(stderr,"%s: failed writing index %s\n",argv[0],catalog.index_file);
+    catalog.unreadable++;
+  }
+
+  if (catalog.dups)
+    printDuplicates(&catalog);
+  if (catalog.verify)
+    fprintf(stderr,"%zu files, %zu invalid, %zu unreadable\n",
+            catalog.files.count, catalog.invalid, catalog.unreadable);
+  else if (recursive || catalog.index_file != NULL)
+    printSummary(&catalog);
+  if (stats != STATS_OFF)
+    statsReport(stderr, stats, "casdir");
+  if (traceClose() < 0) {
+    fprintf(stderr,"%s: failed writing %s\n",argv[0],trace_file);
+    catalog.unreadable++;
+  }
+  free(catalog.copies.items);
+  freeCatIndex(&catalog.previous);
+  freeCatIndex(&catalog.updated);
+
+  for (size_t i = 0; i < catalog.files.count; i++)
+    free(catalog.files.paths[i]);
+  free(catalog.files.paths);
+
+  return catalog.unreadable || catalog.invalid ? 1 : 0;
+}
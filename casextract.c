@@ -0,0 +1,377 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         casextract.c                                             */
+/*                                                                        */
+/* description:  This tool extracts the programs stored in a .cas file    */
+/*               to disk files: BIN and BASIC files get their 0xFE/0xFF   */
+/*               disk prefix, ASCII files are cut at the 0x1A EOF.        */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "lib/caslib.h"
+#include "lib/casindex.h"
+#include "lib/segwrite.h"
+#include "lib/msxbasic.h"
+#include "lib/workpool.h"
+#include "lib/stats.h"
+#include "lib/trace.h"
+
+/* Extraction options shared by all workers */
+typedef struct {
+  const char *progname;
+  const char *output_dir;
+  char **files;
+  int file_count;
+  int failures;      /* Images with at least one error */
+} Extractor;
+
+/* Growable text, collected by a worker and printed in input order */
+typedef struct {
+  char *text;
+  size_t length;
+  size_t capacity;
+} Report;
+
+/* Result of extracting one image */
+typedef struct {
+  Report out;        /* Extracted files, in entry order */
+  Report err;        /* Problems, in entry order */
+  int errors;
+} ExtractResult;
+
+/* Append formatted text to a report */
+static void report(Report *report, const char *format, ...)
+{
+  va_list args;
+  int length;
+
+  for (;;) {
+    va_start(args, format);
+    length = vsnprintf(report->text + report->length,
+                       report->capacity - report->length, format, args);
+    va_end(args);
+    if (length < 0)
+      return;
+    if (report->length + length < report->capacity)
+      break;
+    report->capacity = (report->capacity + length) * 2 + 256;
+    if ((report->text = (char*)realloc(report->text, report->capacity)) == NULL) {
+      fprintf(stderr,"out of memory\n");
+      exit(1);
+    }
+  }
+  report->length += length;
+}
+
+/* Turn a CAS filename into a safe disk filename stem */
+static void diskName(const char *name, char *stem)
+{
+  int length = 6;
+
+  while (length > 0 && (name[length-1] == ' ' || name[length-1] == '\0'))
+    length--;
+  for (int i = 0; i < length; i++) {
+    unsigned char c = name[i];
+    stem[i] = (c <= ' ' || c >= 0x7f || c == '/' || c == '\\' || c == ':' ||
+               c == '*' || c == '?' || c == '"' || c == '<' || c == '>' ||
+               c == '|') ? '_' : c;
+  }
+  if (length == 0)
+    stem[length++] = '_';
+  stem[length] = '\0';
+}
+
+/* Create a new output file, adding -2, -3, ... to the stem if taken */
+static int createOutput(const char *dir, const char *stem, const char *extension,
+                        char *path, size_t size)
+{
+  for (int n = 1; ; n++) {
+    int fd, length;
+
+    if (n == 1)
+      length = snprintf(path, size, "%s/%s.%s", dir, stem, extension);
+    else
+      length = snprintf(path, size, "%s/%s-%d.%s", dir, stem, n, extension);
+    if (length < 0 || (size_t)length >= size) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL
+#ifdef O_BINARY
+              | O_BINARY
+#endif
+              , 0666);
+    if (fd >= 0 || errno != EEXIST)
+      return fd;
+  }
+}
+
+/* Create dir (and missing parents) */
+static int makeDirectory(char *dir)
+{
+  struct stat st;
+
+  if (stat(dir, &st) == 0)
+    return S_ISDIR(st.st_mode) ? 0 : -1;
+
+  for (char *p = dir + 1; *p; p++) {
+    if (*p != '/')
+      continue;
+    *p = '\0';
+    if (stat(dir, &st) != 0)
+#ifdef _WIN32
+      mkdir(dir);
+#else
+      mkdir(dir, 0777);
+#endif
+    *p = '/';
+  }
+#ifdef _WIN32
+  return mkdir(dir);
+#else
+  return mkdir(dir, 0777);
+#endif
+}
+
+/* Write one entry as a disk file */
+static int extractEntry(const CasImage *image, const CasIndex *index,
+                        const CasEntry *entry, const char *dir,
+                        ExtractResult *result)
+{
+  const CasBlock *block = &index->blocks[entry->block];
+  struct iovec *iov;
+  unsigned char prefix;
+  int segments = 0;
+  const char *extension;
+  char stem[8], path[4096];
+  int fd, status;
+
+  /* Prefix plus one segment per data block at most */
+  if ((iov = (struct iovec*)malloc((entry->blocks + 1) * sizeof(struct iovec))) == NULL) {
+    fprintf(stderr,"out of memory\n");
+    exit(1);
+  }
+
+  switch (entry->type) {
+
+    case ENTRY_BINARY:
+    case ENTRY_BASIC:
+      if (!entry->complete || block[1].length < DATA_HEADER_SIZE) {
+        report(&result->err, "%.6s  %s  skipped: missing data block\n",
+               entry->name, entryTypeName(entry->type));
+        free(iov);
+        return -1;
+      }
+      /* ID byte, then the data block as stored: the address header and
+       * program, or for BASIC saved with CSAVE the tokenised lines alone */
+      prefix = entry->type == ENTRY_BINARY ? DISK_ID_BINARY : DISK_ID_BASIC;
+      extension = entry->type == ENTRY_BINARY ? "bin" : "bas";
+      iov[segments].iov_base = &prefix;
+      iov[segments++].iov_len = 1;
+      iov[segments].iov_base = (void*)(image->data + block[1].offset);
+      iov[segments++].iov_len = DATA_HEADER_SIZE + entry->payload;
+      if (entry->type == ENTRY_BASIC &&
+          findBasicProgram(image->data + block[1].offset, block[1].length) == 0)
+        iov[segments-1].iov_len = basicProgramSize(image->data + block[1].offset,
+                                                   block[1].length);
+      break;
+
+    case ENTRY_ASCII: {
+      /* Text of all data blocks, up to the EOF marker */
+      size_t left = entry->payload;
+      extension = "asc";
+      for (size_t b = 1; b < entry->blocks && left > 0; b++) {
+        size_t length = block[b].length < left ? block[b].length : left;
+        iov[segments].iov_base = (void*)(image->data + block[b].offset);
+        iov[segments++].iov_len = length;
+        left -= length;
+      }
+      if (!entry->complete)
+        report(&result->err, "%.6s  ascii  warning: no EOF marker\n", entry->name);
+      break;
+    }
+
+    default:
+      report(&result->out, "------  custom  %.6zx  skipped\n", block->offset);
+      free(iov);
+      return 0;
+  }
+
+  diskName(entry->name, stem);
+  if ((fd = createOutput(dir, stem, extension, path, sizeof(path))) < 0) {
+    report(&result->err, "%.6s  %s  failed creating %s\n", entry->name,
+           entryTypeName(entry->type), path);
+    free(iov);
+    return -1;
+  }
+
+  status = writeSegments(fd, iov, segments);
+  free(iov);
+  if (close(fd) != 0)
+    status = -1;
+  if (status < 0) {
+    report(&result->err, "%.6s  %s  failed writing %s\n", entry->name,
+           entryTypeName(entry->type), path);
+    return -1;
+  }
+
+  report(&result->out, "%.6s  %-6s  %s\n", entry->name, entryTypeName(entry->type), path);
+  return 0;
+}
+
+/* Worker: extract every program of one image */
+static void extractFile(void *ctx, size_t item, void *data)
+{
+  Extractor *extractor = (Extractor*)ctx;
+  ExtractResult *result = (ExtractResult*)data;
+  const char *filename = extractor->files[item];
+  CasImage image;
+  CasIndex index;
+  char dir[4096];
+  uint64_t start = traceStart();
+
+  /* Several images: one subdirectory each, named after the image */
+  if (extractor->file_count > 1) {
+    const char *base = strrchr(filename, '/');
+    base = base ? base + 1 : filename;
+    int length = strlen(base);
+    if (length > 4 && !strcasecmp(base + length - 4, ".cas"))
+      length -= 4;
+    snprintf(dir, sizeof(dir), "%s/%.*s", extractor->output_dir, length, base);
+  }
+  else
+    snprintf(dir, sizeof(dir), "%s", extractor->output_dir);
+
+  statsEnter(STAGE_READ);
+  if (openCasImage(filename, &image) < 0) {
+    report(&result->err, "failed opening %s\n", filename);
+    result->errors++;
+    statsEnter(STAGE_NONE);
+    traceSpan("file", "extract", filename, start);
+    return;
+  }
+  statsEnter(STAGE_INDEX);
+  if (buildCasIndex(image.data, image.size, &index) < 0) {
+    fprintf(stderr,"%s: out of memory indexing %s\n",extractor->progname,filename);
+    exit(1);
+  }
+
+  if (index.entry_count > 0 && makeDirectory(dir) < 0) {
+    report(&result->err, "failed creating directory %s\n", dir);
+    result->errors++;
+  }
+  else {
+    statsEnter(STAGE_WRITE);
+    for (size_t i = 0; i < index.entry_count; i++)
+      if (extractEntry(&image, &index, &index.entries[i], dir, result) < 0)
+        result->errors++;
+  }
+
+  freeCasIndex(&index);
+  closeCasImage(&image);
+  statsEnter(STAGE_NONE);
+  traceSpan("file", "extract", filename, start);
+}
+
+/* Consumer: print reports in input order */
+static void printReport(void *ctx, size_t item, void *data)
+{
+  Extractor *extractor = (Extractor*)ctx;
+  ExtractResult *result = (ExtractResult*)data;
+
+  if (extractor->file_count > 1)
+    printf("%s%s:\n", item ? "\n" : "", extractor->files[item]);
+  fwrite(result->out.text, 1, result->out.length, stdout);
+  if (result->err.length > 0) {
+    fflush(stdout);
+    fprintf(stderr, "%s: %s: %.*s", extractor->progname, extractor->files[item],
+            (int)result->err.length, result->err.text);
+  }
+  free(result->out.text);
+  free(result->err.text);
+  if (result->errors)
+    extractor->failures++;
+}
+
+/* Display usage information and command-line options */
+static void showUsage(char *progname)
+{
+  printf("usage: %s [-o dir] [-j threads] [--trace file] <ifile> [<ifile> ...]\n"
+         " -o   output directory (default: current directory); with several\n"
+         "      input files each gets a subdirectory named after it\n"
+         " -j   number of worker threads (default: number of CPUs)\n"
+         " --trace  write a Chrome trace-event file with a span per file, stage,\n"
+         "      worker thread and wait\n"
+   ,progname);
+}
+
+int main(int argc, char* argv[])
+{
+  Extractor extractor;
+  int threads = 0;
+  const char *trace_file = NULL;
+
+  extractor.progname = argv[0];
+  extractor.output_dir = ".";
+  extractor.files = argv + 1;
+  extractor.file_count = 0;
+  extractor.failures = 0;
+
+  /* Parse command line options */
+  for (int i=1; i<argc; i++) {
+    if (argv[i][0]=='-' && argv[i][1]!='\0') {
+      if (!strcmp(argv[i], "-o") && i+1 < argc)
+        extractor.output_dir = argv[++i];
+      else if (!strcmp(argv[i], "-j") && i+1 < argc && atoi(argv[i+1]) > 0)
+        threads = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "--trace") && i+1 < argc)
+        trace_file = argv[++i];
+      else {
+        fprintf(stderr,"%s: invalid option '%s'\n",argv[0],argv[i]);
+        exit(1);
+      }
+      continue;
+    }
+    /* Move filenames to the front of argv */
+    extractor.files[extractor.file_count++] = argv[i];
+  }
+
+  if (extractor.file_count == 0) {
+    showUsage(argv[0]);
+    exit(1);
+  }
+
+  if (trace_file != NULL && traceOpen(trace_file) < 0) {
+    fprintf(stderr,"%s: failed writing %s\n",argv[0],trace_file);
+    exit(1);
+  }
+
+  if (runOrdered(extractor.file_count, threads, sizeof(ExtractResult),
+                 extractFile, printReport, &extractor) < 0) {
+    fprintf(stderr,"%s: failed starting worker threads\n",argv[0]);
+    exit(1);
+  }
+
+  if (traceClose() < 0) {
+    fprintf(stderr,"%s: failed writing %s\n",argv[0],trace_file);
+    extractor.failures++;
+  }
+  return extractor.failures ? 1 : 0;
+}
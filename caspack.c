@@ -0,0 +1,220 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         caspack.c                                                */
+/*                                                                        */
+/* description:  This tool builds a .cas file from BIN, BASIC and ASCII   */
+/*               disk files, the reverse of casextract.                   */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "lib/caslib.h"
+#include "lib/casindex.h"
+#include "lib/segwrite.h"
+#include "lib/msxbasic.h"
+
+/* One input file and the header block that introduces it */
+typedef struct {
+  const char *filename;
+  CasImage image;                          /* Mapped disk file */
+  unsigned char header[FILE_HEADER_SIZE];  /* Type marker + name */
+} Input;
+
+/* Output layout, as a list of segments pointing into the inputs */
+typedef struct {
+  struct iovec *iov;
+  int count;
+  int capacity;
+  size_t size;      /* Bytes laid out so far, to keep HEADERs aligned */
+} Layout;
+
+/* Constant filler segments */
+static const unsigned char zero_padding[8];
+static unsigned char eof_padding[ASCII_BLOCK];
+
+/* Append one segment to the layout */
+static void addSegment(Layout *layout, const void *data, size_t size)
+{
+  if (size == 0)
+    return;
+  if (layout->count == layout->capacity) {
+    layout->capacity = layout->capacity ? layout->capacity * 2 : 256;
+    layout->iov = (struct iovec*)realloc(layout->iov, layout->capacity * sizeof(struct iovec));
+    if (layout->iov == NULL) {
+      fprintf(stderr,"out of memory\n");
+      exit(1);
+    }
+  }
+  layout->iov[layout->count].iov_base = (void*)data;
+  layout->iov[layout->count].iov_len = size;
+  layout->count++;
+  layout->size += size;
+}
+
+/* Zero-pad to the next 8-byte boundary and add a HEADER */
+static void addHeader(Layout *layout)
+{
+  addSegment(layout, zero_padding, (8 - (layout->size & 7)) & 7);
+  addSegment(layout, HEADER, sizeof(HEADER));
+}
+
+/* Fill the 6-byte CAS name: explicit name, or the file's base name
+ * without extension, space-padded */
+static void casName(const char *filename, const char *name, unsigned char *out)
+{
+  size_t length;
+
+  if (name == NULL) {
+    const char *base = strrchr(filename, '/');
+    const char *dot;
+    name = base ? base + 1 : filename;
+    dot = strrchr(name, '.');
+    length = dot && dot != name ? (size_t)(dot - name) : strlen(name);
+  }
+  else
+    length = strlen(name);
+
+  for (size_t i = 0; i < 6; i++)
+    out[i] = i < length ? name[i] : ' ';
+}
+
+/* Lay out one input file: header block, then its data block(s).
+ * Returns NULL, or why the file cannot be stored */
+static const char *addFile(Layout *layout, Input *input, const char *name)
+{
+  const unsigned char *data = input->image.data;
+  size_t size = input->image.size;
+
+  /* BIN and BASIC disk files start with their ID byte */
+  if (size > 0 && (data[0] == DISK_ID_BINARY || data[0] == DISK_ID_BASIC)) {
+
+    /* BASIC may be tokenised lines alone, as CSAVE stores them; else
+     * the load, end and exec addresses come first */
+    if (data[0] == DISK_ID_BINARY || findBasicProgram(data + 1, size - 1) != 0) {
+      if (size < 1 + DATA_HEADER_SIZE)
+        return "shorter than its address header";
+      if ((data[3] | data[4] << 8) < (data[1] | data[2] << 8))
+        return "end address below start address";
+    }
+
+    memcpy(input->header, data[0] == DISK_ID_BINARY ? BIN : BASIC, 10);
+    casName(input->filename, name, input->header + 10);
+
+    addHeader(layout);
+    addSegment(layout, input->header, FILE_HEADER_SIZE);
+
+    /* Address header and program, without the ID byte */
+    addHeader(layout);
+    addSegment(layout, data + 1, size - 1);
+    return NULL;
+  }
+
+  /* Anything else is ASCII text, ending at the first EOF marker */
+  const unsigned char *eof = memchr(data, EOF_MARKER, size);
+  if (eof != NULL)
+    size = eof - data;
+
+  memcpy(input->header, ASCII, 10);
+  casName(input->filename, name, input->header + 10);
+  addHeader(layout);
+  addSegment(layout, input->header, FILE_HEADER_SIZE);
+
+  /* 256-byte blocks; the last one is filled up with EOF markers, which
+   * takes an extra block when the text fills the last one completely */
+  for (size_t pos = 0; ; pos += ASCII_BLOCK) {
+    size_t length = size - pos < ASCII_BLOCK ? size - pos : ASCII_BLOCK;
+    addHeader(layout);
+    addSegment(layout, data + pos, length);
+    if (length < ASCII_BLOCK) {
+      addSegment(layout, eof_padding, ASCII_BLOCK - length);
+      break;
+    }
+  }
+  return NULL;
+}
+
+/* Display usage information and command-line options */
+static void showUsage(char *progname)
+{
+  printf("usage: %s <ofile> <ifile>[:name] [<ifile>[:name] ...]\n"
+         " files starting with 0xFE are stored as BIN, 0xFF as BASIC, anything\n"
+         " else as ASCII text; the CAS name defaults to the file's base name\n"
+   ,progname);
+}
+
+int main(int argc, char* argv[])
+{
+  Layout layout = { NULL, 0, 0, 0 };
+  Input *inputs;
+  int count, fd, status;
+  const char *problem;
+
+  if (argc < 3) {
+    showUsage(argv[0]);
+    exit(1);
+  }
+
+  memset(eof_padding, EOF_MARKER, sizeof(eof_padding));
+
+  count = argc - 2;
+  if ((inputs = (Input*)calloc(count, sizeof(Input))) == NULL) {
+    fprintf(stderr,"%s: out of memory\n",argv[0]);
+    exit(1);
+  }
+
+  /* Map all inputs and lay out the image */
+  for (int i = 0; i < count; i++) {
+    char *name = strrchr(argv[i+2], ':');
+
+    /* Optional ":NAME" suffix sets the CAS filename */
+    if (name != NULL && strlen(name + 1) <= 6 && !strpbrk(name + 1, "/\\"))
+      *name++ = '\0';
+    else
+      name = NULL;
+
+    inputs[i].filename = argv[i+2];
+    if (openCasImage(inputs[i].filename, &inputs[i].image) < 0) {
+      fprintf(stderr,"%s: failed opening %s\n",argv[0],inputs[i].filename);
+      exit(1);
+    }
+    if ((problem = addFile(&layout, &inputs[i], name)) != NULL) {
+      fprintf(stderr,"%s: %s: %s\n",argv[0],inputs[i].filename,problem);
+      exit(1);
+    }
+  }
+  addSegment(&layout, zero_padding, (8 - (layout.size & 7)) & 7);
+
+  /* Assemble the output with one vectored write */
+  if ((fd = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC
+#ifdef O_BINARY
+                 | O_BINARY
+#endif
+                 , 0666)) < 0) {
+    fprintf(stderr,"%s: failed writing %s\n",argv[0],argv[1]);
+    exit(1);
+  }
+  status = writeSegments(fd, layout.iov, layout.count);
+  if (close(fd) != 0 || status < 0) {
+    fprintf(stderr,"%s: failed writing %s\n",argv[0],argv[1]);
+    exit(1);
+  }
+
+  for (int i = 0; i < count; i++)
+    closeCasImage(&inputs[i].image);
+  free(inputs);
+  free(layout.iov);
+
+  return 0;
+}
@@ -0,0 +1,683 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         castoolsd.c                                              */
+/*                                                                        */
+/* description:  Conversion daemon: serves cas2wav encodes, wav2cas       */
+/*               decodes and casdir listings over a Unix domain socket,   */
+/*               with the pulse tables and worker threads kept warm.      */
+/*                                                                        */
+/*                                                                        */
+/*  This program is free software; you can redistribute it and/or modify  */
+/*  it under the terms of the GNU General Public License as published by  */
+/*  the Free Software Foundation; either version 2, or (at your option)   */
+/*  any later version. See COPYING for more details.                      */
+/*                                                                        */
+/**************************************************************************/
+
+/* Protocol (all lengths are 32-bit little endian)
+ *
+ *   request:  op[4] options_length payload_length options payload
+ *   response: type[4] length data, repeated until DONE or FAIL
+ *
+ * op is "ENCD" (payload is a CAS image, response a WAV file), "DECD"
+ * (WAV file to CAS image) or "LIST" (CAS image to casdir text lines).
+ * options are the cas2wav or wav2cas command line options as text, e.g.
+ * "-2 -s 1.5" or "-n -t 4". Response frames are "DATA" (a piece of the
+ * output), "NOTE" (a log line) and last "DONE" (empty) or "FAIL" (error
+ * message). A connection carries any number of requests in turn. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "lib/caslib.h"
+#include "lib/wavlib.h"
+#include "lib/casindex.h"
+#include "lib/workpool.h"
+#include "lib/simd.h"
+#include "lib/stats.h"
+#include "lib/arena.h"
+
+#define MAX_OPTIONS   1024                /* Longest options text */
+#define MAX_PAYLOAD   (256 << 20)         /* Largest input file */
+#define MAX_ARGS      32                  /* Options per request */
+#define STREAM_BUFFER 65536               /* Output bytes per DATA frame */
+#define IDLE_TIMEOUT  30                  /* Default -i seconds */
+#define ARENA_LIMIT   128                 /* Default -m MB */
+
+/* Pulse tables for both baud rates, rendered once at startup */
+static WriteBuffer templates[2];
+
+/* One client connection, served by one worker */
+typedef struct {
+  int fd;
+  bool broken;             /* A send failed: drop the connection */
+} Connection;
+
+/* A stdio stream that sends what is written to it as frames of one type */
+typedef struct {
+  Connection *conn;
+  const char *type;
+} FrameStream;
+
+/* Worker state kept across connections */
+typedef struct {
+  Arena arena;             /* Buffers of the current request, reset per request */
+  unsigned char *payload;  /* Request input, from the arena */
+  WriteBuffer wb;
+} Worker;
+
+static int listen_fd;
+static int idle_timeout = IDLE_TIMEOUT;
+
+
+static void put32(unsigned char *p, uint32_t v)
+{
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Read exactly size bytes; returns 1, 0 on end of stream before the
+ * first byte, -1 on error or a short read */
+static int readAll(int fd, void *data, size_t size)
+{
+  size_t done = 0;
+
+  while (done < size) {
+    ssize_t n = read(fd, (char *)data + done, size - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return (n == 0 && done == 0) ? 0 : -1;
+    done += n;
+  }
+  return 1;
+}
+
+/* Write exactly size bytes */
+static int writeAll(int fd, const void *data, size_t size)
+{
+  size_t done = 0;
+
+  while (done < size) {
+    ssize_t n = write(fd, (const char *)data + done, size - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    done += n;
+  }
+  return 0;
+}
+
+/* Send one frame */
+static int sendFrame(Connection *conn, const char *type, const void *data, size_t size)
+{
+  unsigned char header[8];
+  struct iovec iov[2];
+  int count = 2;
+
+  if (conn->broken)
+    return -1;
+  memcpy(header, type, 4);
+  put32(header + 4, size);
+  iov[0].iov_base = header;
+  iov[0].iov_len = sizeof(header);
+  iov[1].iov_base = (void *)data;
+  iov[1].iov_len = size;
+
+  while (count > 0) {
+    ssize_t n = writev(conn->fd, iov + 2 - count, count);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      conn->broken = true;
+      return -1;
+    }
+    for (struct iovec *v = iov + 2 - count; count > 0 && (size_t)n >= v->iov_len; v++) {
+      n -= v->iov_len;
+      count--;
+    }
+    if (count > 0) {
+      iov[2 - count].iov_base = (char *)iov[2 - count].iov_base + n;
+      iov[2 - count].iov_len -= n;
+    }
+  }
+  return 0;
+}
+
+static ssize_t writeFrameStream(void *cookie, const char *data, size_t size)
+{
+  FrameStream *stream = cookie;
+
+  return sendFrame(stream->conn, stream->type, data, size) < 0 ? -1 : (ssize_t)size;
+}
+
+/* Open a stream whose writes go out as frames of the given type */
+static FILE *openFrameStream(FrameStream *stream, Connection *conn, const char *type,
+                             int mode, Arena *arena)
+{
+  cookie_io_functions_t io = { NULL, writeFrameStream, NULL, NULL };
+  char *buffer = arenaAlloc(arena, STREAM_BUFFER);
+  FILE *file;
+
+  stream->conn = conn;
+  stream->type = type;
+  if (buffer != NULL && (file = fopencookie(stream, "w", io)) != NULL) {
+    setvbuf(file, buffer, mode, STREAM_BUFFER);
+    return file;
+  }
+  return NULL;
+}
+
+/* Split the options text into words */
+static int splitOptions(char *text, char *argv[])
+{
+  char *save;
+  int argc = 0;
+
+  for (char *word = strtok_r(text, " \t", &save); word != NULL && argc < MAX_ARGS;
+       word = strtok_r(NULL, " \t", &save))
+    argv[argc++] = word;
+  return argc;
+}
+
+/* Encode a CAS image; the WAV sizes are known up front from countSamples,
+ * so the file streams out as it is encoded */
+static const char *encodeJob(Worker *worker, char *options, size_t size,
+                             FILE *output, FILE *log)
+{
+  char *argv[MAX_ARGS];
+  int argc = splitOptions(options, argv);
+  WriteBuffer *wb = &worker->wb;
+  uint32_t silence_time = LONG_SILENCE;
+  int fast = 0;
+  uint64_t samples;
+
+  for (int i = 0; i < argc; i++) {
+    if (!strcmp(argv[i], "-2"))
+      fast = 1;
+    else if (!strcmp(argv[i], "-s") && i+1 < argc)
+      silence_time = OUTPUT_FREQUENCY * atof(argv[++i]);
+    else
+      return "invalid option";
+  }
+
+  *wb = templates[fast];
+  wb->file = output;
+  samples = countSamples(worker->payload, size, NULL, wb->baudrate, wb->output_frequency,
+                         silence_time);
+  if (samples > UINT32_MAX - sizeof(WAVE_HEADER))
+    return "image too large for a WAV file";
+
+  WAVE_HEADER waveheader =
+  {
+    { "RIFF" },
+    samples + sizeof(WAVE_HEADER) - 8,
+    { "WAVE" },
+    { "fmt " },
+    16,
+    PCM_WAVE_FORMAT,
+    MONO,
+    wb->output_frequency,
+    wb->output_frequency,
+    1,
+    8,
+    { "data" },
+    samples
+  };
+
+  fwrite(&waveheader, sizeof(waveheader), 1, output);
+  encodeCas(worker->payload, size, wb, silence_time, log);
+  return NULL;
+}
+
+/* Decode a WAV file with the wav2cas options */
+static const char *decodeJob(Worker *worker, char *options, size_t size,
+                             FILE *output, FILE *log)
+{
+  char *argv[MAX_ARGS];
+  int argc = splitOptions(options, argv);
+  Decoder dec = DECODER_DEFAULTS;
+  int8_t *buffer;
+  int32_t samples;
+  int frequency;
+  FILE *input;
+
+  /* Flags combine as in wav2cas ("-np"); an option with a value takes
+   * the next word and ends its own */
+  for (int i = 0; i < argc; i++) {
+    if (argv[i][0] != '-' || argv[i][1] == '\0')
+      return "invalid option";
+    for (int j = 1; j && argv[i][j] != '\0'; j++) {
+      char option = argv[i][j];
+      if (strchr("wte", option) != NULL && i+1 >= argc)
+        return "invalid option";
+      switch (option) {
+        case 'n': dec.normalize = true; break;
+        case 'p': dec.phase = false; break;
+        case 'w': dec.window = atof(argv[++i]);    j = -1; break;
+        case 't': dec.threshold = atoi(argv[++i]); j = -1; break;
+        case 'e': dec.envelope = atoi(argv[++i]);  j = -1; break;
+        default:  return "invalid option";
+      }
+    }
+  }
+
+  if (size == 0 || (input = fmemopen(worker->payload, size, "rb")) == NULL)
+    return "Incorrect wav header!";
+  frequency = tapeReadArena(&dec, input, "request", &worker->arena, &buffer, &samples, log);
+  fclose(input);
+  if (frequency == TAPE_ERROR_MEMORY)
+    return "Not enough memory!";
+  if (frequency < 0)
+    return "Incorrect wav header!";
+
+  decodeTape(&dec, buffer, samples, frequency, output, log);
+  return NULL;
+}
+
+/* List a CAS image in the classic casdir format */
+static const char *listJob(Worker *worker, char *options, size_t size, FILE *output)
+{
+  CasIndex index;
+
+  if (options[0] != '\0')
+    return "invalid option";
+  statsEnter(STAGE_INDEX);
+  if (buildCasIndex(worker->payload, size, &index) < 0)
+    return "Not enough memory!";
+
+  for (size_t i = 0; i < index.entry_count; i++) {
+    const CasEntry *entry = &index.entries[i];
+
+    switch (entry->type) {
+      case ENTRY_ASCII:
+        fprintf(output, "%.6s  ascii\n", entry->name);
+        break;
+      case ENTRY_BASIC:
+        fprintf(output, "%.6s  basic\n", entry->name);
+        break;
+      case ENTRY_BINARY:
+        if (entry->complete)
+          fprintf(output, "%.6s  binary  %.4x,%.4x,%.4x\n", entry->name, entry->start,
+                  entry->stop, entry->exec ? entry->exec : entry->start);
+        break;
+      case ENTRY_CUSTOM:
+        fprintf(output, "------  custom  %.6x\n", (int)index.blocks[entry->block].offset);
+        break;
+    }
+  }
+  freeCasIndex(&index);
+  return NULL;
+}
+
+/* Read one request and stream its result back.
+ * Returns false when the connection is done with */
+static bool serveRequest(Worker *worker, Connection *conn)
+{
+  unsigned char header[12];
+  char options[MAX_OPTIONS + 1];
+  uint32_t options_length, size;
+  FrameStream out_stream, log_stream;
+  const char *error;
+  FILE *output, *log;
+
+  if (readAll(conn->fd, header, sizeof(header)) <= 0)
+    return false;
+  options_length = get32(header + 4);
+  size = get32(header + 8);
+  if (options_length > MAX_OPTIONS || size > MAX_PAYLOAD) {
+    sendFrame(conn, "FAIL", "request too large", 17);
+    return false;
+  }
+
+  /* Everything the request needs comes from the worker's arena, so the
+   * memory (and its page mappings) is the same from one request to the
+   * next instead of being allocated and faulted in again */
+  arenaReset(&worker->arena);
+  if ((worker->payload = arenaAlloc(&worker->arena, size)) == NULL) {
+    sendFrame(conn, "FAIL", "Not enough memory!", 18);
+    return false;
+  }
+
+  statsEnter(STAGE_READ);
+  if (readAll(conn->fd, options, options_length) < 0 ||
+      readAll(conn->fd, worker->payload, size) < 0) {
+    statsEnter(STAGE_NONE);
+    return false;
+  }
+  options[options_length] = '\0';
+  STATS_ADD(COUNT_FILES, 1);
+  STATS_ADD(COUNT_BYTES_READ, size);
+
+  output = openFrameStream(&out_stream, conn, "DATA", _IOFBF, &worker->arena);
+  log = openFrameStream(&log_stream, conn, "NOTE", _IOLBF, &worker->arena);
+  if (output == NULL || log == NULL)
+    error = "Not enough memory!";
+  else if (!memcmp(header, "ENCD", 4))
+    error = encodeJob(worker, options, size, output, log);
+  else if (!memcmp(header, "DECD", 4))
+    error = decodeJob(worker, options, size, output, log);
+  else if (!memcmp(header, "LIST", 4))
+    error = listJob(worker, options, size, output);
+  else
+    error = "unknown request";
+
+  /* Pending output goes out before the final frame */
+  statsEnter(STAGE_WRITE);
+  if (log) fclose(log);
+  if (output) fclose(output);
+  if (error)
+    sendFrame(conn, "FAIL", error, strlen(error));
+  else
+    sendFrame(conn, "DONE", NULL, 0);
+  statsEnter(STAGE_NONE);
+  return !conn->broken;
+}
+
+/* A worker serves one connection at a time: a client that sends nothing
+ * or stops reading for idle_timeout seconds gets a read or write error
+ * and is dropped, instead of holding the worker from everyone else */
+static void setIdleTimeout(int fd)
+{
+  struct timeval tv = { idle_timeout, 0 };
+
+  if (idle_timeout > 0) {
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  }
+}
+
+/* Worker thread: serve connections until the daemon stops */
+static void *serveConnections(void *arg)
+{
+  Worker *worker = arg;
+
+  for (;;) {
+    Connection conn = { accept(listen_fd, NULL, NULL), false };
+
+    if (conn.fd < 0) {
+      if (errno != EINTR && errno != ECONNABORTED)
+        sleep(1);
+      continue;
+    }
+    setIdleTimeout(conn.fd);
+    while (serveRequest(worker, &conn))
+      ;
+    close(conn.fd);
+  }
+  return NULL;
+}
+
+/* Connect to the daemon at path */
+static int connectSocket(const char *path)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* Client: send one file and write the result, notes to stderr */
+static int runClient(char *progname, const char *path, int argc, char *argv[])
+{
+  const char *op, *ifile, *ofile = NULL;
+  char options[MAX_OPTIONS + 1] = "";
+  unsigned char header[12], *data = NULL, *frame = NULL;
+  Connection conn;
+  FILE *input, *output = stdout;
+  long size;
+  int files, status = 1;
+
+  if (argc < 2) return -1;
+  if (!strcmp(argv[0], "encode")) op = "ENCD";
+  else if (!strcmp(argv[0], "decode")) op = "DECD";
+  else if (!strcmp(argv[0], "list")) op = "LIST";
+  else return -1;
+  files = strcmp(op, "LIST") ? 2 : 1;
+  if (argc < 1 + files) return -1;
+
+  /* Everything between the operation and the files is passed on */
+  for (int i = 1; i < argc - files; i++) {
+    if (strlen(options) + strlen(argv[i]) + 1 >= sizeof(options)) return -1;
+    if (i > 1) strcat(options, " ");
+    strcat(options, argv[i]);
+  }
+  ifile = argv[argc - files];
+  if (files == 2) ofile = argv[argc - 1];
+
+  if ((input = fopen(ifile, "rb")) == NULL || (size = getFileSize(input)) < 0 ||
+      size > MAX_PAYLOAD || (data = malloc(size ? size : 1)) == NULL ||
+      fread(data, 1, size, input) != (size_t)size) {
+    fprintf(stderr,"%s: failed reading %s\n",progname,ifile);
+    exit(1);
+  }
+  fclose(input);
+
+  if ((conn.fd = connectSocket(path)) < 0) {
+    fprintf(stderr,"%s: cannot connect to %s (%s)\n",progname,path,strerror(errno));
+    exit(1);
+  }
+  conn.broken = false;
+  signal(SIGPIPE, SIG_IGN);
+
+  memcpy(header, op, 4);
+  put32(header + 4, strlen(options));
+  put32(header + 8, size);
+  if (writeAll(conn.fd, header, sizeof(header)) < 0 ||
+      writeAll(conn.fd, options, strlen(options)) < 0 ||
+      writeAll(conn.fd, data, size) < 0) {
+    fprintf(stderr,"%s: failed sending to %s\n",progname,path);
+    exit(1);
+  }
+  free(data);
+
+  if (ofile != NULL && (output = fopen(ofile, "wb")) == NULL) {
+    fprintf(stderr,"%s: failed writing %s\n",progname,ofile);
+    exit(1);
+  }
+
+  /* Frames until DONE or FAIL */
+  for (;;) {
+    unsigned char frame_header[8];
+    uint32_t length;
+
+    if (readAll(conn.fd, frame_header, sizeof(frame_header)) <= 0) {
+      fprintf(stderr,"%s: connection to %s lost\n",progname,path);
+      break;
+    }
+    length = get32(frame_header + 4);
+    if ((frame = realloc(frame, length + 1)) == NULL ||
+        (length > 0 && readAll(conn.fd, frame, length) <= 0)) {
+      fprintf(stderr,"%s: connection to %s lost\n",progname,path);
+      break;
+    }
+    if (!memcmp(frame_header, "DATA", 4))
+      fwrite(frame, 1, length, output);
+    else if (!memcmp(frame_header, "NOTE", 4))
+      fwrite(frame, 1, length, stderr);
+    else if (!memcmp(frame_header, "DONE", 4)) {
+      status = 0;
+      break;
+    }
+    else {
+      frame[length] = '\0';
+      fprintf(stderr,"%s: %s: %s\n",progname,ifile,(char *)frame);
+      break;
+    }
+  }
+  free(frame);
+  close(conn.fd);
+  if (fclose(output) != 0 && status == 0) {
+    fprintf(stderr,"%s: failed writing %s\n",progname,ofile);
+    status = 1;
+  }
+  return status;
+}
+
+/* Display usage information and command-line options */
+static void showUsage(char *progname)
+{
+  printf("usage: %s [-j threads] [-i seconds] [-m MB] [--stats[=json]] <socket>\n"
+         "       %s -c <socket> encode [-2] [-s seconds] <ifile> <ofile>\n"
+         "       %s -c <socket> decode [-np] [-t threshold] [-w window] [-e envelope]\n"
+         "                   <ifile> <ofile>\n"
+         "       %s -c <socket> list <ifile>\n"
+         " -j      number of worker threads, one per open connection\n"
+         "         (default: number of CPUs)\n"
+         " -i      drop connections idle for this long (default: 30, 0: never)\n"
+         " -m      memory a worker keeps between requests, in MB; a larger\n"
+         "         request's buffers are unmapped after it (default: 128, 0: all)\n"
+         " --stats print time per stage and counters to stderr at shutdown\n"
+         " -c      client: send one encode (cas2wav), decode (wav2cas) or list\n"
+         "         (casdir) request to the daemon listening on socket\n"
+   ,progname,progname,progname,progname);
+}
+
+int main(int argc, char* argv[])
+{
+  struct sockaddr_un addr;
+  struct stat st;
+  StatsFormat stats = STATS_OFF;
+  const char *path = NULL;
+  int threads = 0;
+  double arena_limit = ARENA_LIMIT;
+  sigset_t signals;
+  int signal_number;
+
+  /* Client mode */
+  if (argc > 2 && !strcmp(argv[1], "-c")) {
+    int status = runClient(argv[0], argv[2], argc - 3, argv + 3);
+    if (status < 0) {
+      showUsage(argv[0]);
+      exit(1);
+    }
+    return status;
+  }
+
+  /* Parse command line options */
+  for (int i=1; i<argc; i++) {
+    if (argv[i][0]=='-' && argv[i][1]!='\0') {
+      if (!strcmp(argv[i], "-j")) {
+        if (i+1 >= argc) {
+          fprintf(stderr,"%s: option -j requires an argument\n",argv[0]);
+          exit(1);
+        }
+        threads = atoi(argv[++i]);
+      }
+      else if (!strcmp(argv[i], "-i")) {
+        if (i+1 >= argc) {
+          fprintf(stderr,"%s: option -i requires an argument\n",argv[0]);
+          exit(1);
+        }
+        idle_timeout = atoi(argv[++i]);
+      }
+      else if (!strcmp(argv[i], "-m")) {
+        if (i+1 >= argc) {
+          fprintf(stderr,"%s: option -m requires an argument\n",argv[0]);
+          exit(1);
+        }
+        arena_limit = atof(argv[++i]);
+      }
+      else if (statsFormat(argv[i]) != STATS_OFF)
+        stats = statsFormat(argv[i]);
+      else {
+        fprintf(stderr,"%s: invalid option '%s'\n",argv[0],argv[i]);
+        exit(1);
+      }
+      continue;
+    }
+    if (path != NULL) {
+      fprintf(stderr,"%s: too many arguments\n",argv[0]);
+      exit(1);
+    }
+    path = argv[i];
+  }
+  if (path == NULL) {
+    showUsage(argv[0]);
+    exit(1);
+  }
+  if (threads < 1)
+    threads = defaultWorkerCount();
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr,"%s: socket path too long: %s\n",argv[0],path);
+    exit(1);
+  }
+  strcpy(addr.sun_path, path);
+
+  /* A socket left by a daemon that did not shut down is replaced */
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+  if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+      bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listen_fd, 64) < 0) {
+    fprintf(stderr,"%s: cannot listen on %s (%s)\n",argv[0],path,strerror(errno));
+    exit(1);
+  }
+
+  /* Warm up: kernels selected and pulse tables rendered before the first job */
+  simdKernels();
+  initWriteBuffer(&templates[0], NULL, 1200, OUTPUT_FREQUENCY);
+  initWriteBuffer(&templates[1], NULL, 2400, OUTPUT_FREQUENCY * 2);
+  if (stats != STATS_OFF)
+    statsStart();
+
+  /* Workers inherit the blocked signals; the main thread waits for them */
+  signal(SIGPIPE, SIG_IGN);
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  for (int i = 0; i < threads; i++) {
+    Worker *worker = calloc(1, sizeof(Worker));
+    pthread_t thread;
+
+    if (worker != NULL)
+      arenaInit(&worker->arena, (size_t)(arena_limit * (1 << 20)));
+    if (worker == NULL || pthread_create(&thread, NULL, serveConnections, worker) != 0) {
+      fprintf(stderr,"%s: cannot start worker threads\n",argv[0]);
+      unlink(path);
+      exit(1);
+    }
+    pthread_detach(thread);
+  }
+
+  sigwait(&signals, &signal_number);
+  unlink(path);
+  if (stats != STATS_OFF)
+    statsReport(stderr, stats, "castoolsd");
+  return 0;
+}
@@ -0,0 +1,150 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         arena.c                                                  */
+/* description:  Per-worker arena for job buffers, on huge pages          */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "arena.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+/* Allocation alignment: a cache line, and enough for any SIMD load */
+#define ARENA_ALIGN  64
+
+/* Chunk header, rounded so allocations start aligned */
+#define HEADER_SIZE  ((sizeof(ArenaChunk) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+
+/* Map size bytes, trying explicit huge pages first */
+static void *mapChunk(size_t size, bool *huge)
+{
+#ifndef _WIN32
+  void *p;
+
+#ifdef MAP_HUGETLB
+  p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p != MAP_FAILED) {
+    *huge = true;
+    return p;
+  }
+#endif
+  *huge = false;
+  p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return NULL;
+#ifdef MADV_HUGEPAGE
+  madvise(p, size, MADV_HUGEPAGE);
+#endif
+  return p;
+#else
+  *huge = false;
+  return malloc(size);
+#endif
+}
+
+static void unmapChunk(ArenaChunk *chunk)
+{
+#ifndef _WIN32
+  munmap(chunk, chunk->size);
+#else
+  free(chunk);
+#endif
+}
+
+void arenaInit(Arena *arena, size_t limit)
+{
+  arena->chunks = NULL;
+  arena->reserve = 0;
+  arena->limit = limit;
+}
+
+void *arenaAlloc(Arena *arena, size_t size)
+{
+  ArenaChunk *chunk = arena->chunks;
+  size_t offset;
+  bool huge;
+
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (chunk == NULL || chunk->size - chunk->used < size) {
+    size_t length = HEADER_SIZE + size;
+
+    /* Grow geometrically so a job needs few chunks */
+    if (chunk != NULL && length < chunk->size * 2)
+      length = chunk->size * 2;
+    if (length < arena->reserve)
+      length = arena->reserve;
+    length = (length + ARENA_CHUNK_ALIGN - 1) & ~(size_t)(ARENA_CHUNK_ALIGN - 1);
+
+    if ((chunk = mapChunk(length, &huge)) == NULL)
+      return NULL;
+    chunk->next = arena->chunks;
+    chunk->size = length;
+    chunk->used = HEADER_SIZE;
+    chunk->huge = huge;
+    arena->chunks = chunk;
+    arena->reserve = 0;
+  }
+
+  offset = chunk->used;
+  chunk->used += size;
+  return (unsigned char *)chunk + offset;
+}
+
+void arenaReset(Arena *arena)
+{
+  ArenaChunk *chunk = arena->chunks;
+  size_t total = 0;
+
+  if (chunk == NULL)
+    return;
+  for (ArenaChunk *c = chunk; c != NULL; c = c->next)
+    total += c->size;
+
+  /* Over the high-water limit: keep the first (oldest) chunk if it fits
+   * the limit, unmap everything else */
+  if (arena->limit > 0 && total > arena->limit) {
+    arena->chunks = NULL;
+    arena->reserve = 0;
+    while (chunk != NULL) {
+      ArenaChunk *next = chunk->next;
+      if (next == NULL && chunk->size <= arena->limit) {
+        chunk->used = HEADER_SIZE;
+        arena->chunks = chunk;
+      }
+      else
+        unmapChunk(chunk);
+      chunk = next;
+    }
+    return;
+  }
+
+  if (chunk->next == NULL) {
+    chunk->used = HEADER_SIZE;
+    return;
+  }
+
+  /* Several chunks: map one of the combined size on the next allocation */
+  arena->reserve = 0;
+  while (chunk != NULL) {
+    ArenaChunk *next = chunk->next;
+    arena->reserve += chunk->size;
+    unmapChunk(chunk);
+    chunk = next;
+  }
+  arena->chunks = NULL;
+}
+
+void arenaFree(Arena *arena)
+{
+  while (arena->chunks != NULL) {
+    ArenaChunk *next = arena->chunks->next;
+    unmapChunk(arena->chunks);
+    arena->chunks = next;
+  }
+  arena->reserve = 0;
+}
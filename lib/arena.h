@@ -0,0 +1,64 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Chunks are mapped in multiples of this (the usual huge page size) */
+#define ARENA_CHUNK_ALIGN  (2 << 20)
+
+/* One mapping; allocations are carved from it */
+typedef struct ArenaChunk {
+  struct ArenaChunk *next;
+  size_t size;               /* Mapped bytes, header included */
+  size_t used;
+  bool huge;                 /* Backed by explicit huge pages */
+} ArenaChunk;
+
+/* Bump allocator for the buffers of one job, reset between jobs so the
+ * same memory (pages already faulted in) serves every job of a worker */
+typedef struct Arena {
+  ArenaChunk *chunks;        /* Newest first */
+  size_t reserve;            /* Size for the next chunk after a reset */
+  size_t limit;              /* Memory a reset may keep, 0 for no limit */
+} Arena;
+
+/**
+ * Initialize an empty arena; nothing is mapped until the first allocation.
+ *
+ * @param arena Arena to initialize
+ * @param limit Most memory kept from one job to the next in bytes
+ *              (see arenaReset), 0 to keep everything
+ */
+void arenaInit(Arena *arena, size_t limit);
+
+/**
+ * Allocate from the arena, 64-byte aligned. Memory is not zeroed and stays
+ * valid until arenaReset or arenaFree. New chunks use explicit huge pages
+ * where the system has them reserved, else transparent huge pages.
+ *
+ * @param arena Arena to allocate from
+ * @param size  Bytes needed
+ * @return Pointer to the memory, NULL if out of memory
+ */
+void *arenaAlloc(Arena *arena, size_t size);
+
+/**
+ * Release every allocation of the job, keeping the memory for the next.
+ * If the job needed several chunks they are replaced by one as large as
+ * all of them, so from then on each job fits in a single mapping. A job
+ * that took more than the limit does not raise the memory held by the
+ * arena: only the first chunk is kept, if it fits, and the rest unmapped.
+ *
+ * @param arena Arena to reset
+ */
+void arenaReset(Arena *arena);
+
+/**
+ * Return all memory of the arena to the system.
+ *
+ * @param arena Arena to free
+ */
+void arenaFree(Arena *arena);
+
+#endif /* ARENA_H */
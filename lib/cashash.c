@@ -0,0 +1,169 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         cashash.c                                                */
+/* description:  64-bit non-cryptographic content hash (XXH64)            */
+/*                                                                        */
+/**************************************************************************/
+
+#include <string.h>
+#include "cashash.h"
+
+#define PRIME64_1  0x9E3779B185EBCA87ULL
+#define PRIME64_2  0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3  0x165667B19E3779F9ULL
+#define PRIME64_4  0x85EBCA77C2B2AE63ULL
+#define PRIME64_5  0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+/* Little-endian loads, independent of host byte order and alignment */
+static inline uint64_t read64(const unsigned char *p)
+{
+  return (uint64_t)p[0]       | (uint64_t)p[1] << 8  |
+         (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+         (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+         (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+         (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Mix one 8-byte input word into an accumulator */
+static inline uint64_t round64(uint64_t acc, uint64_t input)
+{
+  acc += input * PRIME64_2;
+  acc  = rotl64(acc, 31);
+  return acc * PRIME64_1;
+}
+
+static inline uint64_t mergeRound(uint64_t acc, uint64_t value)
+{
+  acc ^= round64(0, value);
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+/* Consume full 32-byte stripes, returning the bytes used */
+static size_t consumeStripes(uint64_t *lanes, const unsigned char *p, size_t size)
+{
+  const unsigned char *start = p;
+
+  while (size >= 32) {
+    lanes[0] = round64(lanes[0], read64(p));
+    lanes[1] = round64(lanes[1], read64(p + 8));
+    lanes[2] = round64(lanes[2], read64(p + 16));
+    lanes[3] = round64(lanes[3], read64(p + 24));
+    p += 32;
+    size -= 32;
+  }
+  return p - start;
+}
+
+/* Fold accumulators and trailing bytes into the final value */
+static uint64_t finalize(const uint64_t *lanes, uint64_t seed, uint64_t total,
+                         const unsigned char *p, size_t size)
+{
+  uint64_t h;
+
+  if (total >= 32) {
+    h = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) +
+        rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+    for (int i = 0; i < 4; i++)
+      h = mergeRound(h, lanes[i]);
+  }
+  else
+    h = seed + PRIME64_5;
+
+  h += total;
+
+  for (; size >= 8; p += 8, size -= 8) {
+    h ^= round64(0, read64(p));
+    h  = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+  }
+  if (size >= 4) {
+    h ^= (uint64_t)read32(p) * PRIME64_1;
+    h  = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+    size -= 4;
+  }
+  for (; size > 0; p++, size--) {
+    h ^= *p * PRIME64_5;
+    h  = rotl64(h, 11) * PRIME64_1;
+  }
+
+  /* Avalanche */
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+static void initLanes(uint64_t *lanes, uint64_t seed)
+{
+  lanes[0] = seed + PRIME64_1 + PRIME64_2;
+  lanes[1] = seed + PRIME64_2;
+  lanes[2] = seed;
+  lanes[3] = seed - PRIME64_1;
+}
+
+/* One-shot hash of a buffer */
+uint64_t hash64(const void *data, size_t size, uint64_t seed)
+{
+  const unsigned char *p = (const unsigned char*)data;
+  uint64_t lanes[4];
+  size_t used;
+
+  initLanes(lanes, seed);
+  used = consumeStripes(lanes, p, size);
+  return finalize(lanes, seed, size, p + used, size - used);
+}
+
+/* Start a streaming hash */
+void hashInit(HashState *state, uint64_t seed)
+{
+  state->total = 0;
+  state->tail_size = 0;
+  state->seed = seed;
+  initLanes(state->lanes, seed);
+}
+
+/* Add bytes to a streaming hash */
+void hashUpdate(HashState *state, const void *data, size_t size)
+{
+  const unsigned char *p = (const unsigned char*)data;
+
+  state->total += size;
+
+  /* Complete a pending partial stripe first */
+  if (state->tail_size > 0) {
+    size_t fill = sizeof(state->tail) - state->tail_size;
+    if (fill > size)
+      fill = size;
+    memcpy(state->tail + state->tail_size, p, fill);
+    state->tail_size += fill;
+    p += fill;
+    size -= fill;
+    if (state->tail_size < sizeof(state->tail))
+      return;
+    consumeStripes(state->lanes, state->tail, sizeof(state->tail));
+    state->tail_size = 0;
+  }
+
+  size_t used = consumeStripes(state->lanes, p, size);
+  memcpy(state->tail, p + used, size - used);
+  state->tail_size = size - used;
+}
+
+/* Hash of everything added so far */
+uint64_t hashFinal(const HashState *state)
+{
+  return finalize(state->lanes, state->seed, state->total,
+                  state->tail, state->tail_size);
+}
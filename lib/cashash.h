@@ -0,0 +1,53 @@
+#ifndef CASHASH_H
+#define CASHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Streaming state of the 64-bit content hash (XXH64 algorithm) */
+typedef struct {
+  uint64_t total;          /* Bytes hashed so far */
+  uint64_t lanes[4];       /* Accumulators for 32-byte stripes */
+  unsigned char tail[32];  /* Bytes not yet forming a full stripe */
+  size_t tail_size;
+  uint64_t seed;
+} HashState;
+
+/**
+ * Hash a contiguous buffer.
+ * Fast non-cryptographic 64-bit hash, equal to XXH64 for the same seed.
+ *
+ * @param data Bytes to hash
+ * @param size Number of bytes
+ * @param seed Hash seed (0 for content hashes)
+ * @return 64-bit hash value
+ */
+uint64_t hash64(const void *data, size_t size, uint64_t seed);
+
+/**
+ * Start a streaming hash, for content spread over several buffers.
+ * Feeding the same bytes in any split gives the same value as hash64.
+ *
+ * @param state Hash state to initialize
+ * @param seed  Hash seed
+ */
+void hashInit(HashState *state, uint64_t seed);
+
+/**
+ * Add bytes to a streaming hash.
+ *
+ * @param state Hash state
+ * @param data  Bytes to add
+ * @param size  Number of bytes
+ */
+void hashUpdate(HashState *state, const void *data, size_t size);
+
+/**
+ * Return the hash of all bytes added so far (the state is left unchanged).
+ *
+ * @param state Hash state
+ * @return 64-bit hash value
+ */
+uint64_t hashFinal(const HashState *state);
+
+#endif /* CASHASH_H */
@@ -0,0 +1,444 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         casindex.c                                               */
+/* description:  Memory mapped CAS images and the shared block index      */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "casindex.h"
+#include "cashash.h"
+#include "msxbasic.h"
+#include "stats.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Open a CAS image: mmap it, or read it into memory where mmap is unavailable */
+int openCasImage(const char *filename, CasImage *image)
+{
+  image->data = NULL;
+  image->size = 0;
+  image->mapped = false;
+
+#ifndef _WIN32
+  struct stat st;
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  if (st.st_size > 0) {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd);
+      return -1;
+    }
+    /* Images are parsed front to back exactly once */
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    image->data = map;
+    image->size = st.st_size;
+    image->mapped = true;
+  }
+  close(fd);
+  return 0;
+#else
+  FILE *file;
+  long size;
+  unsigned char *data;
+
+  if ((file = fopen(filename, "rb")) == NULL)
+    return -1;
+
+  size = getFileSize(file);
+  if (size < 0) {
+    fclose(file);
+    return -1;
+  }
+
+  if (size > 0) {
+    data = (unsigned char*)malloc(size);
+    if (data == NULL || fread(data, 1, size, file) != (size_t)size) {
+      free(data);
+      fclose(file);
+      errno = EIO;
+      return -1;
+    }
+    image->data = data;
+    image->size = size;
+  }
+  fclose(file);
+  return 0;
+#endif
+}
+
+/* Unmap or free the image contents */
+void closeCasImage(CasImage *image)
+{
+#ifndef _WIN32
+  if (image->mapped)
+    munmap((void*)image->data, image->size);
+  else
+#endif
+    free((void*)image->data);
+
+  image->data = NULL;
+  image->size = 0;
+  image->mapped = false;
+}
+
+/* Load 8 bytes as a 64-bit word (compiles to a single unaligned load) */
+static inline uint64_t load64(const unsigned char *p)
+{
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+/* Read a little-endian 16-bit value */
+static inline uint16_t load16le(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+/* Type named by the 10-byte marker at the start of a block; ENTRY_CUSTOM
+ * if there is none */
+static CasEntryType markerType(const unsigned char *data, size_t length)
+{
+  if (length < 10)
+    return ENTRY_CUSTOM;
+  if (!memcmp(data, ASCII, 10))
+    return ENTRY_ASCII;
+  if (!memcmp(data, BIN, 10))
+    return ENTRY_BINARY;
+  if (!memcmp(data, BASIC, 10))
+    return ENTRY_BASIC;
+  return ENTRY_CUSTOM;
+}
+
+/* Type of a file header block: a marker and the 6-character filename */
+static CasEntryType headerType(const unsigned char *data, size_t length)
+{
+  return length >= FILE_HEADER_SIZE ? markerType(data, length) : ENTRY_CUSTOM;
+}
+
+/* Append a block to the index, growing the table as needed */
+static int addBlock(CasIndex *index, size_t *capacity, size_t header)
+{
+  if (index->block_count == *capacity) {
+    size_t grown = *capacity ? *capacity * 2 : 64;
+    CasBlock *blocks = (CasBlock*)realloc(index->blocks, grown * sizeof(CasBlock));
+    if (blocks == NULL)
+      return -1;
+    index->blocks = blocks;
+    *capacity = grown;
+  }
+  index->blocks[index->block_count].header = header;
+  index->blocks[index->block_count].offset = header + sizeof(HEADER);
+  index->blocks[index->block_count].length = 0;
+  index->block_count++;
+  return 0;
+}
+
+/* Group blocks into files: a typed file header block and the data blocks
+ * that belong to it, or a single custom block */
+static void groupEntries(const unsigned char *cas, CasIndex *index)
+{
+  size_t i = 0;
+
+  while (i < index->block_count) {
+    const CasBlock *block = &index->blocks[i];
+    const unsigned char *data = cas + block->offset;
+    CasEntry *entry = &index->entries[index->entry_count++];
+
+    memset(entry, 0, sizeof(*entry));
+    entry->block = i;
+    entry->blocks = 1;
+    entry->type = headerType(data, block->length);
+
+    if (entry->type == ENTRY_CUSTOM) {
+      entry->payload = block->length;
+      i++;
+      continue;
+    }
+
+    memcpy(entry->name, data + 10, 6);
+    entry->name[6] = '\0';
+
+    if (entry->type == ENTRY_ASCII) {
+      /* Data blocks continue until one contains the EOF marker;
+       * the payload is the text before it */
+      for (i++; i < index->block_count; i++) {
+        const unsigned char *eof;
+        block = &index->blocks[i];
+        data = cas + block->offset;
+        entry->blocks++;
+        if ((eof = memchr(data, EOF_MARKER, block->length)) != NULL) {
+          entry->payload += eof - data;
+          entry->complete = true;
+          i++;
+          break;
+        }
+        entry->payload += block->length;
+      }
+      continue;
+    }
+
+    /* BIN and BASIC: exactly one data block, starting with the addresses;
+     * the payload is END - LOAD, limited to the data actually present.
+     * A file header right after is the next file, not the data block */
+    i++;
+    if (i < index->block_count &&
+        headerType(cas + index->blocks[i].offset, index->blocks[i].length) == ENTRY_CUSTOM) {
+      block = &index->blocks[i];
+      entry->blocks++;
+      entry->complete = true;
+      if (block->length >= DATA_HEADER_SIZE) {
+        data = cas + block->offset;
+        entry->start = load16le(data);
+        entry->stop  = load16le(data + 2);
+        entry->exec  = load16le(data + 4);
+        if (entry->stop > entry->start)
+          entry->payload = entry->stop - entry->start;
+        if (entry->payload > block->length - DATA_HEADER_SIZE)
+          entry->payload = block->length - DATA_HEADER_SIZE;
+      }
+      i++;
+    }
+  }
+}
+
+/* Build block table and file list of a CAS image */
+int buildCasIndex(const unsigned char *cas, size_t size, CasIndex *index)
+{
+  size_t capacity = 0;
+  uint64_t marker = load64((const unsigned char*)HEADER);
+  size_t pos;
+
+  index->blocks = NULL;
+  index->block_count = 0;
+  index->entries = NULL;
+  index->entry_count = 0;
+
+  /* HEADERs only occur at 8-byte aligned offsets */
+  for (pos = 0; pos + sizeof(HEADER) <= size; pos += sizeof(HEADER)) {
+    if (load64(cas + pos) == marker && addBlock(index, &capacity, pos) < 0) {
+      freeCasIndex(index);
+      return -1;
+    }
+  }
+
+  STATS_ADD(COUNT_BLOCKS, index->block_count);
+
+  /* Each block extends up to the next HEADER or the end of the image */
+  for (size_t i = 0; i < index->block_count; i++) {
+    size_t end = i + 1 < index->block_count ? index->blocks[i+1].header : size;
+    index->blocks[i].length = end - index->blocks[i].offset;
+  }
+
+  if (index->block_count == 0)
+    return 0;
+
+  /* Every entry owns at least one block */
+  index->entries = (CasEntry*)malloc(index->block_count * sizeof(CasEntry));
+  if (index->entries == NULL) {
+    freeCasIndex(index);
+    return -1;
+  }
+  groupEntries(cas, index);
+
+  return 0;
+}
+
+/* Release index tables */
+void freeCasIndex(CasIndex *index)
+{
+  free(index->blocks);
+  free(index->entries);
+  index->blocks = NULL;
+  index->block_count = 0;
+  index->entries = NULL;
+  index->entry_count = 0;
+}
+
+/* Hash each entry's program, leaving out names and padding */
+void hashEntries(const unsigned char *cas, CasIndex *index)
+{
+  for (size_t i = 0; i < index->entry_count; i++) {
+    CasEntry *entry = &index->entries[i];
+    const CasBlock *block = &index->blocks[entry->block];
+    HashState state;
+
+    /* The type is the seed, so equal bytes of different types differ */
+    hashInit(&state, entry->type);
+
+    switch (entry->type) {
+
+      case ENTRY_ASCII: {
+        size_t left = entry->payload;
+        for (size_t b = 1; b < entry->blocks && left > 0; b++) {
+          size_t length = block[b].length < left ? block[b].length : left;
+          hashUpdate(&state, cas + block[b].offset, length);
+          left -= length;
+        }
+        break;
+      }
+
+      case ENTRY_BINARY:
+      case ENTRY_BASIC:
+        if (entry->complete && block[1].length >= DATA_HEADER_SIZE)
+          hashUpdate(&state, cas + block[1].offset, DATA_HEADER_SIZE + entry->payload);
+        break;
+
+      default:
+        hashUpdate(&state, cas + block->offset, block->length);
+        break;
+    }
+
+    entry->hash = hashFinal(&state);
+  }
+}
+
+/* Record a violation unless an earlier one is known */
+static void violate(CasViolation *violation, size_t offset, const char *problem)
+{
+  if (violation->problem == NULL || offset < violation->offset) {
+    violation->offset = offset;
+    violation->problem = problem;
+  }
+}
+
+/* Check the blocks of one entry */
+static void verifyEntry(const unsigned char *cas, const CasIndex *index,
+                        const CasEntry *entry, CasViolation *violation)
+{
+  const CasBlock *block = &index->blocks[entry->block];
+  const CasBlock *last = &block[entry->blocks - 1];
+
+  /* Custom blocks are free-form, but not empty, and a type marker at
+   * their start is a file header cut short */
+  if (entry->type == ENTRY_CUSTOM) {
+    if (block->length == 0)
+      violate(violation, block->offset, "empty block");
+    else if (markerType(cas + block->offset, block->length) != ENTRY_CUSTOM)
+      violate(violation, block->offset + block->length, "file header shorter than 16 bytes");
+    return;
+  }
+
+  if (block->length > FILE_HEADER_SIZE) {
+    violate(violation, block->offset + FILE_HEADER_SIZE, "data after the file header");
+    return;
+  }
+  if (entry->type != ENTRY_ASCII && !entry->complete) {
+    violate(violation, block->offset + block->length, "missing data block");
+    return;
+  }
+  if (entry->blocks < 2) {
+    violate(violation, block->offset + block->length, "file header without data block");
+    return;
+  }
+
+  if (entry->type == ENTRY_ASCII) {
+    if (!entry->complete)
+      violate(violation, last->offset + last->length, "ASCII file without 0x1A end marker");
+    return;
+  }
+
+  /* BIN/BASIC: addresses, END - LOAD program bytes, zero padding */
+  block++;
+
+  /* BASIC programs saved with CSAVE carry no addresses: the tokenised
+   * lines start right away and end with the zero end-of-program link */
+  if (entry->type == ENTRY_BASIC && findBasicProgram(cas + block->offset, block->length) == 0)
+    return;
+
+  if (block->length < DATA_HEADER_SIZE) {
+    violate(violation, block->offset + block->length, "data block shorter than its address header");
+    return;
+  }
+  if (entry->stop < entry->start) {
+    violate(violation, block->offset + 2, "END address below LOAD address");
+    return;
+  }
+
+  size_t used = DATA_HEADER_SIZE + (size_t)(entry->stop - entry->start);
+  if (block->length < used) {
+    violate(violation, block->offset + block->length, "data block shorter than END - LOAD");
+    return;
+  }
+  for (size_t pos = used; pos < block->length; pos++) {
+    if (cas[block->offset + pos] != 0 || pos - used >= 7) {
+      violate(violation, block->offset + pos, "data after the program");
+      return;
+    }
+  }
+}
+
+/* Check an image against the structure its index describes */
+int verifyCasImage(const unsigned char *cas, size_t size, const CasIndex *index,
+                   CasViolation *violation)
+{
+  const unsigned char *p = cas, *end = cas + size;
+
+  violation->offset = 0;
+  violation->problem = NULL;
+
+  if (index->block_count == 0) {
+    violate(violation, 0, "no HEADER found");
+    return -1;
+  }
+  for (size_t i = 0; i < index->block_count; i++) {
+    if (index->blocks[i].offset + index->blocks[i].length > size) {
+      violate(violation, 0, "index does not match the image");
+      return -1;
+    }
+  }
+  if (index->blocks[0].header != 0)
+    violate(violation, 0, "data before the first HEADER");
+
+  /* HEADERs off the 8-byte grid are not seen by the index but are by
+   * cas2wav, which splits the block there */
+  while ((p = memchr(p, HEADER[0], end - p)) != NULL) {
+    if ((size_t)(end - p) < sizeof(HEADER))
+      break;
+    if (((p - cas) & 7) != 0 && !memcmp(p, HEADER, sizeof(HEADER))) {
+      violate(violation, p - cas, "HEADER not 8-byte aligned");
+      break;
+    }
+    p++;
+  }
+
+  /* Entries are in image order: the first violating one is the earliest */
+  for (size_t i = 0; i < index->entry_count; i++) {
+    CasViolation found = { 0, NULL };
+    verifyEntry(cas, index, &index->entries[i], &found);
+    if (found.problem != NULL) {
+      violate(violation, found.offset, found.problem);
+      break;
+    }
+  }
+
+  return violation->problem != NULL ? -1 : 0;
+}
+
+/* Printable entry type name */
+const char *entryTypeName(CasEntryType type)
+{
+  switch (type) {
+    case ENTRY_ASCII:  return "ascii";
+    case ENTRY_BINARY: return "binary";
+    case ENTRY_BASIC:  return "basic";
+    default:           return "custom";
+  }
+}
@@ -0,0 +1,146 @@
+#ifndef CASINDEX_H
+#define CASINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "caslib.h"
+
+/* Size of a CAS file header block: 10-byte type marker + 6-byte filename */
+#define FILE_HEADER_SIZE  16
+/* Size of a BIN/BASIC data header: load, end and exec address */
+#define DATA_HEADER_SIZE  6
+/* ASCII files are stored in data blocks of this size */
+#define ASCII_BLOCK       256
+/* MSX tape EOF marker (Ctrl-Z), ends ASCII files */
+#define EOF_MARKER        0x1A
+/* Disk file ID bytes of BIN and BASIC files (see docs/CASFILE.md) */
+#define DISK_ID_BINARY    0xFE
+#define DISK_ID_BASIC     0xFF
+
+/* Read-only view of a CAS image, memory mapped where the platform allows */
+typedef struct {
+  const unsigned char *data;  /* Image contents */
+  size_t size;                /* Image size in bytes */
+  bool mapped;                /* data is a mapping (true) or heap copy (false) */
+} CasImage;
+
+/* A single block: the data between a HEADER and the next one (or EOF) */
+typedef struct {
+  size_t header;   /* Offset of the HEADER marker */
+  size_t offset;   /* Offset of the first data byte (header + 8) */
+  size_t length;   /* Data bytes up to the next HEADER or end of image */
+} CasBlock;
+
+/* Logical entry types, as listed by casdir */
+typedef enum {
+  ENTRY_ASCII,     /* ASCII text file: header block + data blocks up to 0x1A */
+  ENTRY_BINARY,    /* Binary file: header block + address/data block */
+  ENTRY_BASIC,     /* Tokenized BASIC: header block + address/data block */
+  ENTRY_CUSTOM     /* Block without a known type marker */
+} CasEntryType;
+
+/* A file stored in the image, grouped from one or more consecutive blocks */
+typedef struct {
+  CasEntryType type;
+  char name[7];          /* 6-character filename, NUL terminated */
+  size_t block;          /* Index of the first block (the file header block) */
+  size_t blocks;         /* Number of blocks, file header block included */
+  bool complete;         /* Data block present (BIN/BASIC) or 0x1A found (ASCII) */
+  size_t payload;        /* Program bytes, without markers, addresses or padding */
+  uint64_t hash;         /* Program content hash (set by hashEntries) */
+  uint16_t start;        /* BIN/BASIC load address */
+  uint16_t stop;         /* BIN/BASIC end address */
+  uint16_t exec;         /* BIN/BASIC exec address (as stored, may be 0) */
+} CasEntry;
+
+/* Block table and file list of a CAS image */
+typedef struct CasIndex {
+  CasBlock *blocks;
+  size_t block_count;
+  CasEntry *entries;
+  size_t entry_count;
+} CasIndex;
+
+/* First structural problem found in an image */
+typedef struct {
+  size_t offset;         /* Image offset of the offending byte */
+  const char *problem;   /* Static description */
+} CasViolation;
+
+/**
+ * Open a CAS image for reading.
+ * Maps the file into memory (falls back to reading it into a heap buffer
+ * on platforms without mmap). Empty files give a valid, empty image.
+ *
+ * @param filename Path of the CAS file
+ * @param image    Image to initialize
+ * @return 0 on success, -1 on error (errno is set)
+ */
+int openCasImage(const char *filename, CasImage *image);
+
+/**
+ * Release an image opened with openCasImage.
+ *
+ * @param image Image to close
+ */
+void closeCasImage(CasImage *image);
+
+/**
+ * Build the block index of an in-memory CAS image.
+ * HEADER markers are searched at 8-byte aligned offsets only, as required
+ * by the format, using one 64-bit compare per position. Blocks are then
+ * grouped into files following the same rules as casdir.
+ *
+ * @param cas   CAS image data
+ * @param size  Image size in bytes
+ * @param index Index to fill (release with freeCasIndex)
+ * @return 0 on success, -1 on allocation failure
+ */
+int buildCasIndex(const unsigned char *cas, size_t size, CasIndex *index);
+
+/**
+ * Release the memory held by an index.
+ *
+ * @param index Index to release
+ */
+void freeCasIndex(CasIndex *index);
+
+/**
+ * Compute the content hash of every entry.
+ * Only the program is hashed: the entry type, the address header and the
+ * payload of BIN/BASIC files, the text before 0x1A of ASCII files, or the
+ * whole block of custom entries. Names, alignment padding and the position
+ * in the image are left out, so the same program gives the same hash in
+ * any CAS image.
+ *
+ * @param cas   CAS image data the index was built from
+ * @param index Block index whose entries get their hash field set
+ */
+void hashEntries(const unsigned char *cas, CasIndex *index);
+
+/**
+ * Check the structure of an image: HEADERs at 8-byte aligned offsets only,
+ * no data before the first HEADER, file header blocks of exactly 16 bytes,
+ * BIN/BASIC data blocks holding END - LOAD program bytes followed by at
+ * most 7 zero padding bytes (or, for BASIC, a tokenised program without
+ * addresses as CSAVE writes it), and ASCII files ending with 0x1A.
+ * Custom blocks (custom loaders) are accepted as they are.
+ *
+ * @param cas       CAS image data
+ * @param size      Image size in bytes
+ * @param index     Block index built from the same data
+ * @param violation Set to the violation with the lowest offset
+ * @return 0 if the image is well formed, -1 otherwise
+ */
+int verifyCasImage(const unsigned char *cas, size_t size, const CasIndex *index,
+                   CasViolation *violation);
+
+/**
+ * Return a printable name for an entry type ("ascii", "binary", ...).
+ *
+ * @param type Entry type
+ * @return Static string
+ */
+const char *entryTypeName(CasEntryType type);
+
+#endif /* CASINDEX_H */
@@ -7,6 +7,9 @@
 /**************************************************************************/
 
 #include "caslib.h"
+#include "casindex.h"
+#include "stats.h"
+#include "trace.h"
 #include <math.h>
 #include <string.h>
 
@@ -20,8 +23,7 @@ const char ASCII[10]  = { 0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA,0xEA };
 const char BIN[10]    = { 0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0,0xD0 };  /* Binary file type marker */
 const char BASIC[10]  = { 0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3,0xD3 };  /* BASIC file type marker */
 
-/* MSX tape EOF marker (Ctrl-Z) */
-#define EOF_MARKER 0x1A
+static uint32_t renderPulse(const WriteBuffer *wb, uint32_t freq, unsigned char *out);
 
 /* Initialize write buffer context */
 void initWriteBuffer(WriteBuffer *wb, FILE *file, int baudrate, int output_frequency)
@@ -30,14 +32,20 @@ void initWriteBuffer(WriteBuffer *wb, FILE *file, int baudrate, int output_frequ
   wb->pos = 0;
   wb->baudrate = baudrate;
   wb->output_frequency = output_frequency;
+  wb->pulse_length[0] = renderPulse(wb, LONG_PULSE, wb->pulse[0]);
+  wb->pulse_length[1] = renderPulse(wb, SHORT_PULSE, wb->pulse[1]);
 }
 
 /* Flush buffered data to file */
 void flushWriteBuffer(WriteBuffer *wb)
 {
   if (wb->pos > 0) {
+    Stage stage = statsEnter(STAGE_WRITE);
     fwrite(wb->buffer, 1, wb->pos, wb->file);
+    STATS_ADD(COUNT_WRITES, 1);
+    STATS_ADD(COUNT_SAMPLES, wb->pos);
     wb->pos = 0;
+    statsEnter(stage);
   }
 }
 
@@ -54,8 +62,16 @@ void putByte(WriteBuffer *wb, unsigned char byte)
  * At 43200 Hz: 1 sample = 1/43200 second = ~23 microseconds */
 void writeSilence(WriteBuffer *wb, uint32_t sample_count)
 {
-  for (uint32_t n = 0; n < sample_count; n++)
-    putByte(wb, 128);
+  while (sample_count > 0) {
+    size_t n = WRITE_BUFFER_SIZE - wb->pos;
+    if (n > sample_count)
+      n = sample_count;
+    memset(wb->buffer + wb->pos, 128, n);
+    wb->pos += n;
+    sample_count -= n;
+    if (wb->pos >= WRITE_BUFFER_SIZE)
+      flushWriteBuffer(wb);
+  }
 }
 
 /* 360-entry sine lookup table (1 cycle @ 1-degree resolution) */
@@ -77,8 +93,10 @@ static void init_sine_table(void)
   sine_table_initialized = 1;
 }
 
-/* Generate a single FSK pulse at specified frequency (one complete sine wave cycle) */
-void writePulse(WriteBuffer *wb, uint32_t freq)
+/* Render one FSK pulse (one complete sine wave cycle) at the specified
+ * frequency into out, if it fits in MAX_PULSE_LENGTH samples.
+ * Returns the pulse length in samples, 0 if it does not fit */
+static uint32_t renderPulse(const WriteBuffer *wb, uint32_t freq, unsigned char *out)
 {
   uint32_t n;
 
@@ -92,13 +110,51 @@ void writePulse(WriteBuffer *wb, uint32_t freq)
   /* Table step: 360/length. For 1200Hz step=10, for 2400Hz step=20 */
   double table_step = 360.0 / length;
 
-  /* Generate and output each sample of the sine wave using lookup table */
+  if ((uint32_t)length > MAX_PULSE_LENGTH)
+    return 0;
+
+  /* Sample the sine wave from the lookup table */
   for (n = 0; n < (uint32_t)length; n++) {
     /* Math guarantees table_index < 360, no modulo needed */
     unsigned int table_index = (unsigned int)(n * table_step);
-    unsigned char pcm_sample = sine_table[table_index];
-    putByte(wb, pcm_sample);
+    out[n] = sine_table[table_index];
+  }
+  return n;
+}
+
+/* Generate a single FSK pulse at specified frequency (one complete sine wave cycle) */
+void writePulse(WriteBuffer *wb, uint32_t freq)
+{
+  unsigned char pulse[MAX_PULSE_LENGTH];
+  const unsigned char *samples;
+  uint32_t length;
+
+  /* The two FSK tones are rendered once per WriteBuffer */
+  if (freq == LONG_PULSE && wb->pulse_length[0] > 0) {
+    samples = wb->pulse[0];
+    length = wb->pulse_length[0];
   }
+  else if (freq == SHORT_PULSE && wb->pulse_length[1] > 0) {
+    samples = wb->pulse[1];
+    length = wb->pulse_length[1];
+  }
+  else if ((length = renderPulse(wb, freq, pulse)) > 0)
+    samples = pulse;
+  else {
+    /* Longer than MAX_PULSE_LENGTH: sample by sample */
+    double step = wb->output_frequency / (wb->baudrate * (freq / 1200.0));
+    for (uint32_t n = 0; n < (uint32_t)step; n++)
+      putByte(wb, sine_table[(unsigned int)(n * (360.0 / step))]);
+    return;
+  }
+
+  /* Pulses are 18 to 36 samples: an inlined memcpy, not a kernel call */
+  if (wb->pos + length > WRITE_BUFFER_SIZE)
+    flushWriteBuffer(wb);
+  memcpy(wb->buffer + wb->pos, samples, length);
+  wb->pos += length;
+  if (wb->pos >= WRITE_BUFFER_SIZE)
+    flushWriteBuffer(wb);
 }
 
 /* Write a 0-bit: one 1200 Hz pulse */
@@ -129,6 +185,7 @@ void writeSync(WriteBuffer *wb, uint32_t bits)
 /* Serial encoding: START(0) + 8 bits LSB-first + STOP(1,1) */
 void writeByte(WriteBuffer *wb, int byte)
 {
+  STATS_ADD(COUNT_BYTES_ENCODED, 1);
   write0(wb);  /* START bit */
 
   /* DATA: 8 bits, LSB first */
@@ -150,12 +207,15 @@ void writeByte(WriteBuffer *wb, int byte)
  * Works with in-memory CAS data for simple and efficient processing. */
 size_t writeData(const unsigned char *cas, size_t cas_size, WriteBuffer *wb, size_t pos, bool *eof)
 {
+  uint64_t start = traceStart();
+
   *eof = false;
   
   /* Transmit bytes until we find a HEADER or reach end of data */
   while ((pos + sizeof(HEADER)) <= cas_size) {
     /* Check if current position starts a HEADER */
     if (!memcmp(cas+pos, HEADER, sizeof(HEADER))) {
+      traceSpan("block", "encode", NULL, start);
       return pos;  /* Stop before HEADER */
     }
     
@@ -174,10 +234,291 @@ size_t writeData(const unsigned char *cas, size_t cas_size, WriteBuffer *wb, siz
     writeByte(wb, cas[pos]);
     pos++;
   }
-  
+
+  traceSpan("block", "encode", NULL, start);
   return pos;
 }
 
+/* Encode a whole CAS image: scan for HEADER markers and transmit every file
+ * with the silence and sync layout of its type */
+void encodeCas(const unsigned char *cas, size_t cas_size, WriteBuffer *wb,
+               uint32_t silence_time, FILE *log)
+{
+  size_t pos = 0;
+  bool eof;
+  Stage stage = statsEnter(STAGE_ENCODE);
+
+  while (pos + sizeof(HEADER) <= cas_size) {
+    if (!memcmp(cas+pos, HEADER, sizeof(HEADER))) {
+      /* Header found - read the 10-byte file type identifier */
+      pos += sizeof(HEADER);
+      if (pos + 10 <= cas_size) {
+        switch (identifyFileType(cas+pos)) {
+          case FILE_TYPE_ASCII:
+            /* ASCII file type: multiple data blocks with headers between them */
+            writeSilence(wb, silence_time);
+            writeSync(wb, SYNC_INITIAL);
+            pos = writeData(cas, cas_size, wb, pos, &eof);
+
+            /* Process subsequent data blocks until EOF or no more data */
+            while (!eof && pos + sizeof(HEADER) <= cas_size) {
+              writeSilence(wb, SHORT_SILENCE);
+              writeSync(wb, SYNC_BLOCK);
+              pos = writeData(cas, cas_size, wb, pos+sizeof(HEADER), &eof);
+            }
+            break;
+
+          case FILE_TYPE_BINARY:
+            /* Binary/BASIC file type: two-block structure (header block + data block) */
+            writeSilence(wb, silence_time);
+            writeSync(wb, SYNC_INITIAL);
+            pos = writeData(cas, cas_size, wb, pos, &eof);
+            writeSilence(wb, SHORT_SILENCE);
+            writeSync(wb, SYNC_BLOCK);
+            pos = writeData(cas, cas_size, wb, pos + sizeof(HEADER), &eof);
+            break;
+
+          case FILE_TYPE_UNKNOWN:
+            /* Unknown file type - use single block with initial sync */
+            if (log) fprintf(log, "unknown file type: using long header\n");
+            writeSilence(wb, LONG_SILENCE);
+            writeSync(wb, SYNC_INITIAL);
+            pos = writeData(cas, cas_size, wb, pos, &eof);
+            break;
+        }
+      }
+      else {
+        /* File type identifier read failed; treat as unknown type */
+        if (log) fprintf(log, "unknown file type: using initial sync\n");
+        writeSilence(wb, silence_time);
+        writeSync(wb, SYNC_INITIAL);
+        pos = writeData(cas, cas_size, wb, pos, &eof);
+      }
+
+    } else {
+      /* Non-header data found - skip byte and continue (handles corrupted files) */
+      if (log) fprintf(log, "skipping unhandled data\n");
+      pos++;
+    }
+  }
+
+  flushWriteBuffer(wb);
+  statsEnter(stage);
+}
+
+/* Samples of one pulse, computed exactly as writePulse does */
+static uint64_t pulseSamples(int baudrate, int output_frequency, uint32_t freq)
+{
+  return (uint32_t)(output_frequency / (baudrate * (freq / 1200.0)));
+}
+
+/* Number of 1-bits in a run of bytes, eight bytes at a time */
+static uint64_t countOnes(const unsigned char *p, size_t size)
+{
+  uint64_t ones = 0;
+
+  for (; size >= 8; p += 8, size -= 8) {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    ones += (x * 0x0101010101010101ULL) >> 56;
+  }
+  for (; size > 0; p++, size--)
+    for (unsigned byte = *p; byte; byte >>= 1)
+      ones += byte & 1;
+  return ones;
+}
+
+/* Whether a HEADER starts at one of the size bytes from cas + pos */
+static bool findHeader(const unsigned char *cas, size_t cas_size, size_t pos, size_t size)
+{
+  const unsigned char *next = cas + pos, *end = cas + pos + size;
+
+  if (pos + sizeof(HEADER) > cas_size)
+    return false;
+  if (end > cas + cas_size - sizeof(HEADER) + 1)
+    end = cas + cas_size - sizeof(HEADER) + 1;
+  while (next < end && (next = memchr(next, HEADER[0], end - next)) != NULL) {
+    if (!memcmp(next, HEADER, sizeof(HEADER)))
+      return true;
+    next++;
+  }
+  return false;
+}
+
+/* Pulse lengths and counters of a sample count estimate */
+typedef struct {
+  uint64_t zero;      /* Samples of a 0-bit: one 1200 Hz pulse */
+  uint64_t one;       /* Samples of a 1-bit: two 2400 Hz pulses */
+  int baudrate;
+  uint64_t samples;
+  const CasBlock *block;  /* Walking an index: next block not passed yet */
+  const CasBlock *last;   /* Walking an index: end of its blocks, else NULL */
+  bool rescan;            /* The index misses HEADERs cas2wav would find */
+} SampleCount;
+
+/* Offset of the next indexed HEADER at or after pos, cas_size if none */
+static size_t nextBlock(SampleCount *count, size_t pos, size_t cas_size)
+{
+  while (count->block < count->last && count->block->header < pos)
+    count->block++;
+  return count->block < count->last ? count->block->header : cas_size;
+}
+
+/* Add the samples of a data range from the 0- and 1-bits of its bytes */
+static void countBytes(SampleCount *count, uint64_t bytes, uint64_t ones)
+{
+  /* START 0-bit, 8 data bits, two STOP 1-bits per byte */
+  count->samples += bytes * (count->zero + 2 * count->one) +
+                    (8 * bytes - ones) * count->zero + ones * count->one;
+}
+
+/* countData following the block index: the data ends at the next indexed
+ * HEADER; a HEADER off the 8-byte grid in the data (which buildCasIndex
+ * does not index but writeData stops at) sets rescan */
+static size_t countBlock(const unsigned char *cas, size_t cas_size, SampleCount *count,
+                         size_t pos, bool *eof)
+{
+  size_t end, scanned, bytes;
+
+  if (nextBlock(count, pos, cas_size) < cas_size) {
+    end = scanned = count->block->header;
+    if (memcmp(cas + end, HEADER, sizeof(HEADER)))
+      count->rescan = true;   /* Index of another version of the image */
+  }
+  else {
+    end = cas_size > pos ? cas_size : pos;
+    scanned = pos + sizeof(HEADER) <= cas_size ? cas_size - sizeof(HEADER) + 1 : pos;
+  }
+
+  bytes = end - pos;
+  if (findHeader(cas, cas_size, pos, bytes))
+    count->rescan = true;
+
+  /* Only bytes checked for a HEADER can raise EOF */
+  *eof = scanned > pos && memchr(cas + pos, EOF_MARKER, scanned - pos) != NULL;
+  countBytes(count, bytes, countOnes(cas + pos, bytes));
+  return end;
+}
+
+/* Count the samples writeData would produce, without encoding */
+static size_t countData(const unsigned char *cas, size_t cas_size, SampleCount *count,
+                        size_t pos, bool *eof)
+{
+  size_t end = pos, scanned;
+
+  if (count->last != NULL)
+    return countBlock(cas, cas_size, count, pos, eof);
+  *eof = false;
+
+  /* Same stop rule as writeData: the next HEADER at any offset */
+  while (end + sizeof(HEADER) <= cas_size) {
+    const unsigned char *next = memchr(cas + end, HEADER[0], cas_size - sizeof(HEADER) + 1 - end);
+    if (next == NULL) {
+      end = cas_size - sizeof(HEADER) + 1;
+      break;
+    }
+    end = next - cas;
+    if (!memcmp(next, HEADER, sizeof(HEADER)))
+      break;
+    end++;
+  }
+
+  /* Only bytes checked for a HEADER can raise EOF */
+  scanned = end;
+  if (end + sizeof(HEADER) > cas_size || memcmp(cas + end, HEADER, sizeof(HEADER)))
+    end = cas_size > pos ? cas_size : pos;
+  if (scanned > pos && memchr(cas + pos, EOF_MARKER, scanned - pos) != NULL)
+    *eof = true;
+
+  countBytes(count, end - pos, countOnes(cas + pos, end - pos));
+  return end;
+}
+
+/* Samples of a sync header, as writeSync scales it */
+static void countSync(SampleCount *count, uint32_t bits)
+{
+  count->samples += (uint64_t)(int)(bits * (count->baudrate / 1200.0)) * count->one;
+}
+
+/* Count the samples cas2wav produces for an image, following its scan */
+uint64_t countSamples(const unsigned char *cas, size_t cas_size, const CasIndex *index,
+                      int baudrate, int output_frequency, uint32_t silence_time)
+{
+  SampleCount count;
+  size_t pos = 0;
+  bool eof;
+
+  count.zero = pulseSamples(baudrate, output_frequency, LONG_PULSE);
+  count.one = 2 * pulseSamples(baudrate, output_frequency, SHORT_PULSE);
+  count.baudrate = baudrate;
+  count.samples = 0;
+  /* An index whose blocks do not fit is not of this image */
+  if (index != NULL && index->block_count > 0 &&
+      index->blocks[index->block_count - 1].header + sizeof(HEADER) > cas_size)
+    index = NULL;
+  count.block = index != NULL ? index->blocks : NULL;
+  count.last = index != NULL ? index->blocks + index->block_count : NULL;
+  count.rescan = false;
+
+  while (pos + sizeof(HEADER) <= cas_size && !count.rescan) {
+    if (!memcmp(cas+pos, HEADER, sizeof(HEADER))) {
+      pos += sizeof(HEADER);
+      if (pos + 10 <= cas_size) {
+        switch (identifyFileType(cas+pos)) {
+          case FILE_TYPE_ASCII:
+            count.samples += silence_time;
+            countSync(&count, SYNC_INITIAL);
+            pos = countData(cas, cas_size, &count, pos, &eof);
+            while (!eof && pos + sizeof(HEADER) <= cas_size) {
+              count.samples += SHORT_SILENCE;
+              countSync(&count, SYNC_BLOCK);
+              pos = countData(cas, cas_size, &count, pos + sizeof(HEADER), &eof);
+            }
+            break;
+
+          case FILE_TYPE_BINARY:
+            count.samples += silence_time;
+            countSync(&count, SYNC_INITIAL);
+            pos = countData(cas, cas_size, &count, pos, &eof);
+            count.samples += SHORT_SILENCE;
+            countSync(&count, SYNC_BLOCK);
+            pos = countData(cas, cas_size, &count, pos + sizeof(HEADER), &eof);
+            break;
+
+          case FILE_TYPE_UNKNOWN:
+            count.samples += LONG_SILENCE;
+            countSync(&count, SYNC_INITIAL);
+            pos = countData(cas, cas_size, &count, pos, &eof);
+            break;
+        }
+      }
+      else {
+        count.samples += silence_time;
+        countSync(&count, SYNC_INITIAL);
+        pos = countData(cas, cas_size, &count, pos, &eof);
+      }
+    }
+    else if (count.last != NULL) {
+      /* Stray bytes, skipped up to the next indexed HEADER; none there
+       * means the index is not of this image */
+      size_t next = nextBlock(&count, pos, cas_size);
+      if (next == pos || findHeader(cas, cas_size, pos, next - pos))
+        count.rescan = true;
+      pos = next;
+    }
+    else
+      pos++;   /* Stray byte, skipped */
+  }
+
+  /* The index lacks a HEADER cas2wav stops at: count by scanning */
+  if (count.rescan)
+    return countSamples(cas, cas_size, NULL, baudrate, output_frequency, silence_time);
+  return count.samples;
+}
+
 /* Get the size of an open file */
 long getFileSize(FILE *file)
 {
@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+struct CasIndex;
+
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
@@ -55,6 +57,9 @@ typedef enum {
 /* Buffered I/O configuration */
 #define WRITE_BUFFER_SIZE 16384  /* 16KB buffer for optimal performance */
 
+/* Longest pulse kept as a ready-made waveform (samples) */
+#define MAX_PULSE_LENGTH  256
+
 /* Write buffer context for batched output */
 typedef struct {
   FILE *file;
@@ -62,11 +67,14 @@ typedef struct {
   size_t pos;
   int baudrate;
   int output_frequency;
+  unsigned char pulse[2][MAX_PULSE_LENGTH];  /* LONG_PULSE, SHORT_PULSE waveforms */
+  uint32_t pulse_length[2];                  /* 0 if too long to keep */
 } WriteBuffer;
 
 /**
  * Initialize a write buffer for buffered output.
- * Sets up the buffer context with file handle and encoding parameters.
+ * Sets up the buffer context with file handle and encoding parameters,
+ * and renders the 1200/2400 Hz pulse waveforms for these parameters.
  *
  * @param wb               Write buffer to initialize
  * @param file             Output file handle
@@ -182,6 +190,42 @@ void writeByte(WriteBuffer *wb, int byte);
  */
 size_t writeData(const unsigned char *cas, size_t cas_size, WriteBuffer *wb, size_t pos, bool *eof);
 
+/**
+ * Encode a whole in-memory CAS image as cas2wav does: every file gets its
+ * silence, sync headers and data blocks according to its type. Data before
+ * the first HEADER is skipped. The write buffer is flushed on return; the
+ * WAV header is left to the caller.
+ *
+ * @param cas          Pointer to CAS file data in memory
+ * @param cas_size     Total size of CAS file in bytes
+ * @param wb           Write buffer context for output (see initWriteBuffer)
+ * @param silence_time Silence before each file, in samples
+ * @param log          Stream for notes on unknown types and skipped data, or NULL
+ */
+void encodeCas(const unsigned char *cas, size_t cas_size, WriteBuffer *wb,
+               uint32_t silence_time, FILE *log);
+
+/**
+ * Count the audio samples cas2wav writes for a CAS image, without encoding.
+ * Follows the same scan as cas2wav (silences, sync headers and every byte
+ * at 11 bits), counting the 0- and 1-bits of the data so the result is
+ * exact for any baud rate and sample rate. The WAV file size is this count
+ * plus sizeof(WAVE_HEADER); the duration is count / output_frequency.
+ * Given the block index of the image, the blocks are taken from it instead
+ * of searching for HEADERs; images with HEADERs the index lacks (not
+ * 8-byte aligned) are still scanned, so the count stays exact.
+ *
+ * @param cas              Pointer to CAS file data in memory
+ * @param cas_size         Total size of CAS file in bytes
+ * @param index            Block index of the image (buildCasIndex), or NULL
+ * @param baudrate         Baud rate (1200 or 2400)
+ * @param output_frequency Sample rate in Hz
+ * @param silence_time     Silence before each file, in samples
+ * @return Number of 8-bit samples
+ */
+uint64_t countSamples(const unsigned char *cas, size_t cas_size, const struct CasIndex *index,
+                      int baudrate, int output_frequency, uint32_t silence_time);
+
 /**
  * Get the size of an open file.
  * Uses fseek/ftell and restores the original file position.
@@ -0,0 +1,21 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         castools.c                                               */
+/* description:  Version information of the libcastools library           */
+/*                                                                        */
+/**************************************************************************/
+
+#include "castools.h"
+
+#define STRING(x)   #x
+#define VERSION(major,minor,patch)  STRING(major) "." STRING(minor) "." STRING(patch)
+
+int castoolsVersion(void)
+{
+  return CASTOOLS_VERSION;
+}
+
+const char *castoolsVersionString(void)
+{
+  return VERSION(CASTOOLS_VERSION_MAJOR,CASTOOLS_VERSION_MINOR,CASTOOLS_VERSION_PATCH);
+}
@@ -0,0 +1,43 @@
+#ifndef CASTOOLS_H
+#define CASTOOLS_H
+
+/* Public interface of libcastools: the CAS to WAV encoder (caslib.h), the
+ * WAV to CAS decoder (wavlib.h), the CAS block index (casindex.h) and the
+ * helpers they use. Programs linking the library include this header only.
+ *
+ * The major version changes whenever a function or structure of these
+ * headers changes incompatibly; it is also the soname of the shared library
+ * (libcastools.so.2). Additions raise the minor version. */
+
+#define CASTOOLS_VERSION_MAJOR  2
+#define CASTOOLS_VERSION_MINOR  0
+#define CASTOOLS_VERSION_PATCH  0
+
+/* Version as one comparable number: 0xMMmmpp */
+#define CASTOOLS_VERSION  ((CASTOOLS_VERSION_MAJOR << 16) | \
+                           (CASTOOLS_VERSION_MINOR << 8)  | \
+                            CASTOOLS_VERSION_PATCH)
+
+#include "caslib.h"
+#include "wavlib.h"
+#include "casindex.h"
+#include "cashash.h"
+#include "msxbasic.h"
+#include "simd.h"
+
+/**
+ * Return the version of the library linked at run time, to compare with
+ * the CASTOOLS_VERSION the program was built against.
+ *
+ * @return Version as CASTOOLS_VERSION (0xMMmmpp)
+ */
+int castoolsVersion(void);
+
+/**
+ * Return the version of the library linked at run time as text.
+ *
+ * @return Static string "major.minor.patch"
+ */
+const char *castoolsVersionString(void);
+
+#endif /* CASTOOLS_H */
@@ -0,0 +1,343 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         catindex.c                                               */
+/* description:  Persistent catalog index of CAS block tables             */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "catindex.h"
+
+/*
+ * File layout (all integers little-endian):
+ *
+ *   "CASINDEX"  u32 version  u32 record count
+ *   per record:
+ *     u16 path length, path bytes, u64 size, i64 mtime, u32 mtime nsec,
+ *     u64 hash, u32 block count, u32 entry count
+ *     per block: u64 header offset, u64 length
+ *     per entry: u8 type, u8 complete, 6 name bytes, u32 first block,
+ *                u32 block count, u16 start, u16 stop, u16 exec, u64 payload,
+ *                u64 content hash
+ */
+
+/* Read cursor over the loaded index file */
+typedef struct {
+  const unsigned char *p;
+  const unsigned char *end;
+  bool error;
+} Reader;
+
+static const unsigned char *take(Reader *r, size_t size)
+{
+  const unsigned char *p = r->p;
+  if (r->error || (size_t)(r->end - r->p) < size) {
+    r->error = true;
+    return NULL;
+  }
+  r->p += size;
+  return p;
+}
+
+static uint64_t getLE(Reader *r, int bytes)
+{
+  const unsigned char *p = take(r, bytes);
+  uint64_t value = 0;
+  if (p == NULL)
+    return 0;
+  for (int i = bytes - 1; i >= 0; i--)
+    value = (value << 8) | p[i];
+  return value;
+}
+
+static void putLE(FILE *file, uint64_t value, int bytes)
+{
+  for (int i = 0; i < bytes; i++) {
+    putc(value & 0xff, file);
+    value >>= 8;
+  }
+}
+
+/* Deep copy a block index */
+int copyCasIndex(CasIndex *dst, const CasIndex *src)
+{
+  dst->block_count = src->block_count;
+  dst->entry_count = src->entry_count;
+  dst->blocks = NULL;
+  dst->entries = NULL;
+  if (src->block_count == 0)
+    return 0;
+
+  dst->blocks = (CasBlock*)malloc(src->block_count * sizeof(CasBlock));
+  dst->entries = (CasEntry*)malloc(src->block_count * sizeof(CasEntry));
+  if (dst->blocks == NULL || dst->entries == NULL) {
+    freeCasIndex(dst);
+    return -1;
+  }
+  memcpy(dst->blocks, src->blocks, src->block_count * sizeof(CasBlock));
+  memcpy(dst->entries, src->entries, src->entry_count * sizeof(CasEntry));
+  return 0;
+}
+
+/* Append a record, taking ownership of its contents */
+int addCatRecord(CatIndex *catalog, CatRecord *record)
+{
+  if (catalog->count == catalog->capacity) {
+    size_t grown = catalog->capacity ? catalog->capacity * 2 : 256;
+    CatRecord *records = (CatRecord*)realloc(catalog->records, grown * sizeof(CatRecord));
+    if (records == NULL)
+      return -1;
+    catalog->records = records;
+    catalog->capacity = grown;
+  }
+  catalog->records[catalog->count++] = *record;
+  return 0;
+}
+
+/* Parse one record */
+static int readRecord(Reader *r, CatRecord *record)
+{
+  CasIndex *index = &record->index;
+  size_t length = getLE(r, 2);
+  const unsigned char *path = take(r, length);
+
+  memset(record, 0, sizeof(*record));
+  if (path == NULL || (record->path = (char*)malloc(length + 1)) == NULL)
+    return -1;
+  memcpy(record->path, path, length);
+  record->path[length] = '\0';
+
+  record->size       = getLE(r, 8);
+  record->mtime      = (int64_t)getLE(r, 8);
+  record->mtime_nsec = getLE(r, 4);
+  record->hash       = getLE(r, 8);
+  index->block_count = getLE(r, 4);
+  index->entry_count = getLE(r, 4);
+
+  /* Every block takes 16 bytes in the file: reject counts the file can't hold */
+  if (r->error || index->entry_count > index->block_count ||
+      index->block_count > (size_t)(r->end - r->p) / 16)
+    return -1;
+  if (index->block_count == 0)
+    return 0;
+
+  index->blocks = (CasBlock*)malloc(index->block_count * sizeof(CasBlock));
+  index->entries = (CasEntry*)calloc(index->block_count, sizeof(CasEntry));
+  if (index->blocks == NULL || index->entries == NULL)
+    return -1;
+
+  for (size_t i = 0; i < index->block_count; i++) {
+    CasBlock *block = &index->blocks[i];
+    block->header = getLE(r, 8);
+    block->offset = block->header + sizeof(HEADER);
+    block->length = getLE(r, 8);
+  }
+
+  for (size_t i = 0; i < index->entry_count; i++) {
+    CasEntry *entry = &index->entries[i];
+    const unsigned char *name;
+
+    entry->type = (CasEntryType)getLE(r, 1);
+    entry->complete = getLE(r, 1) != 0;
+    if ((name = take(r, 6)) != NULL)
+      memcpy(entry->name, name, 6);
+    entry->name[6] = '\0';
+    entry->block   = getLE(r, 4);
+    entry->blocks  = getLE(r, 4);
+    entry->start   = getLE(r, 2);
+    entry->stop    = getLE(r, 2);
+    entry->exec    = getLE(r, 2);
+    entry->payload = getLE(r, 8);
+    entry->hash    = getLE(r, 8);
+
+    if (entry->type > ENTRY_CUSTOM || entry->blocks == 0 ||
+        entry->block >= index->block_count ||
+        entry->blocks > index->block_count - entry->block)
+      return -1;
+  }
+
+  return r->error ? -1 : 0;
+}
+
+static int comparePaths(const void *a, const void *b)
+{
+  return strcmp((*(CatRecord* const*)a)->path, (*(CatRecord* const*)b)->path);
+}
+
+/* Load an index file (missing file: empty catalog) */
+int loadCatIndex(const char *filename, CatIndex *catalog)
+{
+  FILE *file;
+  unsigned char *data;
+  long size;
+  Reader r;
+  size_t count;
+
+  memset(catalog, 0, sizeof(*catalog));
+
+  if ((file = fopen(filename, "rb")) == NULL)
+    return errno == ENOENT ? 0 : -1;
+
+  size = getFileSize(file);
+  data = size > 0 ? (unsigned char*)malloc(size) : NULL;
+  if (data == NULL || fread(data, 1, size, file) != (size_t)size) {
+    free(data);
+    fclose(file);
+    return -1;
+  }
+  fclose(file);
+
+  r.p = data;
+  r.end = data + size;
+  r.error = false;
+
+  /* Check identification and version before parsing */
+  const unsigned char *magic = take(&r, 8);
+  if (magic == NULL || memcmp(magic, CATINDEX_MAGIC, 8)) {
+    free(data);
+    return -1;
+  }
+
+  /* An index of another version is stale: start over with an empty one */
+  if (getLE(&r, 4) != CATINDEX_VERSION) {
+    free(data);
+    return 0;
+  }
+
+  count = getLE(&r, 4);
+  for (size_t i = 0; i < count && !r.error; i++) {
+    CatRecord record;
+    if (readRecord(&r, &record) < 0 || addCatRecord(catalog, &record) < 0) {
+      free(record.path);
+      freeCasIndex(&record.index);
+      free(data);
+      freeCatIndex(catalog);
+      return -1;
+    }
+  }
+  free(data);
+
+  /* Lookups by path go through a sorted view */
+  if (catalog->count > 0) {
+    catalog->sorted = (CatRecord**)malloc(catalog->count * sizeof(CatRecord*));
+    if (catalog->sorted == NULL) {
+      freeCatIndex(catalog);
+      return -1;
+    }
+    for (size_t i = 0; i < catalog->count; i++)
+      catalog->sorted[i] = &catalog->records[i];
+    qsort(catalog->sorted, catalog->count, sizeof(CatRecord*), comparePaths);
+  }
+
+  return 0;
+}
+
+/* Write a record */
+static void writeRecord(FILE *file, const CatRecord *record)
+{
+  const CasIndex *index = &record->index;
+  size_t length = strlen(record->path);
+
+  putLE(file, length, 2);
+  fwrite(record->path, 1, length, file);
+  putLE(file, record->size, 8);
+  putLE(file, (uint64_t)record->mtime, 8);
+  putLE(file, record->mtime_nsec, 4);
+  putLE(file, record->hash, 8);
+  putLE(file, index->block_count, 4);
+  putLE(file, index->entry_count, 4);
+
+  for (size_t i = 0; i < index->block_count; i++) {
+    putLE(file, index->blocks[i].header, 8);
+    putLE(file, index->blocks[i].length, 8);
+  }
+
+  for (size_t i = 0; i < index->entry_count; i++) {
+    const CasEntry *entry = &index->entries[i];
+    putLE(file, entry->type, 1);
+    putLE(file, entry->complete, 1);
+    fwrite(entry->name, 1, 6, file);
+    putLE(file, entry->block, 4);
+    putLE(file, entry->blocks, 4);
+    putLE(file, entry->start, 2);
+    putLE(file, entry->stop, 2);
+    putLE(file, entry->exec, 2);
+    putLE(file, entry->payload, 8);
+    putLE(file, entry->hash, 8);
+  }
+}
+
+/* Write an index file atomically */
+int saveCatIndex(const char *filename, const CatIndex *catalog)
+{
+  size_t length = strlen(filename) + 5;
+  char *temp = (char*)malloc(length);
+  FILE *file;
+  int status = 0;
+
+  if (temp == NULL)
+    return -1;
+  snprintf(temp, length, "%s.tmp", filename);
+
+  if ((file = fopen(temp, "wb")) == NULL) {
+    free(temp);
+    return -1;
+  }
+
+  fwrite(CATINDEX_MAGIC, 1, 8, file);
+  putLE(file, CATINDEX_VERSION, 4);
+  putLE(file, catalog->count, 4);
+  for (size_t i = 0; i < catalog->count; i++)
+    writeRecord(file, &catalog->records[i]);
+
+  if (ferror(file))
+    status = -1;
+  if (fclose(file) != 0)
+    status = -1;
+
+#ifdef _WIN32
+  /* rename() does not replace existing files on Windows */
+  if (status == 0)
+    remove(filename);
+#endif
+  if (status == 0 && rename(temp, filename) != 0)
+    status = -1;
+  if (status != 0)
+    remove(temp);
+
+  free(temp);
+  return status;
+}
+
+/* Binary search the sorted view */
+const CatRecord *findCatRecord(const CatIndex *catalog, const char *path)
+{
+  size_t low = 0, high = catalog->sorted ? catalog->count : 0;
+
+  while (low < high) {
+    size_t mid = (low + high) / 2;
+    int cmp = strcmp(path, catalog->sorted[mid]->path);
+    if (cmp == 0)
+      return catalog->sorted[mid];
+    if (cmp < 0)
+      high = mid;
+    else
+      low = mid + 1;
+  }
+  return NULL;
+}
+
+/* Release all records */
+void freeCatIndex(CatIndex *catalog)
+{
+  for (size_t i = 0; i < catalog->count; i++) {
+    free(catalog->records[i].path);
+    freeCasIndex(&catalog->records[i].index);
+  }
+  free(catalog->records);
+  free(catalog->sorted);
+  memset(catalog, 0, sizeof(*catalog));
+}
@@ -0,0 +1,87 @@
+#ifndef CATINDEX_H
+#define CATINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "casindex.h"
+
+/* Catalog index file identification and format version */
+#define CATINDEX_MAGIC    "CASINDEX"
+#define CATINDEX_VERSION  3
+
+/* Indexed state of one CAS image */
+typedef struct {
+  char *path;           /* Image path as given when scanning */
+  uint64_t size;        /* File size in bytes */
+  int64_t mtime;        /* Modification time, seconds */
+  uint32_t mtime_nsec;  /* Modification time, nanoseconds */
+  uint64_t hash;        /* hash64 of the whole image */
+  CasIndex index;       /* Block table and entries */
+} CatRecord;
+
+/* All records of a catalog index file */
+typedef struct {
+  CatRecord *records;
+  size_t count;
+  size_t capacity;
+  CatRecord **sorted;   /* Records ordered by path, for lookups */
+} CatIndex;
+
+/**
+ * Load a catalog index file.
+ * A missing file, or one written by another format version, gives an
+ * empty index so the next run rebuilds it.
+ *
+ * @param filename Index file path
+ * @param catalog  Catalog to fill (release with freeCatIndex)
+ * @return 0 on success, -1 on I/O error or malformed file
+ */
+int loadCatIndex(const char *filename, CatIndex *catalog);
+
+/**
+ * Write a catalog index file.
+ * The file is written under a temporary name and renamed into place, so
+ * an interrupted run leaves the previous index intact.
+ *
+ * @param filename Index file path
+ * @param catalog  Catalog to store
+ * @return 0 on success, -1 on error
+ */
+int saveCatIndex(const char *filename, const CatIndex *catalog);
+
+/**
+ * Find the record of a path in a loaded catalog.
+ *
+ * @param catalog Catalog loaded with loadCatIndex
+ * @param path    Image path
+ * @return Record, or NULL if the path is not indexed
+ */
+const CatRecord *findCatRecord(const CatIndex *catalog, const char *path);
+
+/**
+ * Append a record, taking ownership of its path and block index.
+ * Records added this way are not visible to findCatRecord.
+ *
+ * @param catalog Catalog to extend
+ * @param record  Record to move into the catalog
+ * @return 0 on success, -1 on allocation failure
+ */
+int addCatRecord(CatIndex *catalog, CatRecord *record);
+
+/**
+ * Deep copy a block index.
+ *
+ * @param dst Index to fill (release with freeCasIndex)
+ * @param src Index to copy
+ * @return 0 on success, -1 on allocation failure
+ */
+int copyCasIndex(CasIndex *dst, const CasIndex *src);
+
+/**
+ * Release all records of a catalog.
+ *
+ * @param catalog Catalog to release
+ */
+void freeCatIndex(CatIndex *catalog);
+
+#endif /* CATINDEX_H */
@@ -7,7 +7,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "clilib.h"
+#include "trace.h"
 
 /* Baudrate constants */
 #define BAUDRATE_STD   1200
@@ -16,10 +18,20 @@
 /* Display usage information and command-line options */
 void showUsage(char *progname)
 {
-  printf("usage: %s [-2] [-s seconds] <ifile> <ofile>\n"
+  printf("usage: %s [-2] [-s seconds] [--cache dir [--cache-size MB]] [--stats[=json]]\n"
+         "       [--perf-counters] [--trace file] <ifile> <ofile>\n"
          " -2   use 2400 baud as output baudrate\n"
          " -s   define gap time (in seconds) between blocks (default 2)\n"
-   ,progname);
+         " --cache  reuse the output of earlier runs with the same input and\n"
+         "          options, kept in dir (served by reflink or copy);\n"
+         "          also --cache=dir and --cache-size=MB\n"
+         " --cache-size  evict least recently used outputs above this size\n"
+         "          (default %llu)\n"
+         " --stats  print time per stage and counters to stderr (text or json)\n"
+         " --perf-counters  add cycles, instructions, cache and branch misses\n"
+         "          per stage to the --stats report (Linux perf_event_open)\n"
+         " --trace  write a Chrome trace-event file of the conversion\n"
+   ,progname,WAVCACHE_DEFAULT_LIMIT >> 20);
 }
 
 /* Parse command line arguments into ProgramArgs structure */
@@ -31,6 +43,11 @@ void parseArguments(int argc, char* argv[], ProgramArgs *args)
   args->baudrate = BAUDRATE_STD;
   args->output_frequency = OUTPUT_FREQUENCY;  /* Will be updated if baudrate changes */
   args->silence_time = LONG_SILENCE;
+  args->stats = STATS_OFF;
+  args->perf_counters = false;
+  args->trace_file = NULL;
+  args->cache_dir = NULL;
+  args->cache_limit = WAVCACHE_DEFAULT_LIMIT;
 
   /* Parse command line options */
   for (int i=1; i<argc; i++) {
@@ -49,6 +66,31 @@ void parseArguments(int argc, char* argv[], ProgramArgs *args)
         }
         args->silence_time = OUTPUT_FREQUENCY * atof(argv[++i]);
       }
+      else if (statsFormat(argv[i]) != STATS_OFF)
+        args->stats = statsFormat(argv[i]);
+      else if (!strcmp(argv[i], "--perf-counters"))
+        args->perf_counters = true;
+      else if (!strncmp(argv[i], "--cache=", 8))
+        args->cache_dir = argv[i] + 8;
+      else if (!strncmp(argv[i], "--cache-size=", 13))
+        args->cache_limit = (uint64_t)(atof(argv[i] + 13) * (1 << 20));
+      else if (!strcmp(argv[i], "--cache") || !strcmp(argv[i], "--cache-size")) {
+        if (i+1 >= argc) {
+          fprintf(stderr,"%s: option %s requires an argument\n",argv[0],argv[i]);
+          exit(1);
+        }
+        if (!strcmp(argv[i], "--cache"))
+          args->cache_dir = argv[++i];
+        else
+          args->cache_limit = (uint64_t)(atof(argv[++i]) * (1 << 20));
+      }
+      else if (!strcmp(argv[i], "--trace")) {
+        if (i+1 >= argc) {
+          fprintf(stderr,"%s: option --trace requires an argument\n",argv[0]);
+          exit(1);
+        }
+        args->trace_file = argv[++i];
+      }
       else {
         fprintf(stderr,"%s: invalid option '%s'\n",argv[0],argv[i]);
         exit(1);
@@ -70,14 +112,23 @@ void parseArguments(int argc, char* argv[], ProgramArgs *args)
     showUsage(argv[0]);
     exit(1);
   }
+
+  /* --perf-counters reports through --stats */
+  if (args->perf_counters && args->stats == STATS_OFF)
+    args->stats = STATS_TEXT;
+
+  if (args->trace_file != NULL && traceOpen(args->trace_file) < 0) {
+    fprintf(stderr,"%s: failed writing %s\n",argv[0],args->trace_file);
+    exit(1);
+  }
 }
 
-/* Load CAS file into memory and prepare output file with write buffer */
-void loadAndPrepareFiles(const char *progname, ProgramArgs *args, 
-                         unsigned char **cas, size_t *cas_size,
-                         FILE **output, WriteBuffer *wb)
+/* Load CAS file into memory */
+void loadCasFile(const char *progname, ProgramArgs *args,
+                 unsigned char **cas, size_t *cas_size)
 {
   FILE *input;
+  Stage stage = statsEnter(STAGE_READ);
 
   /* Open input file */
   if ((input=fopen(args->input_file,"rb"))==NULL) {
@@ -99,12 +150,19 @@ void loadAndPrepareFiles(const char *progname, ProgramArgs *args,
     exit(1);
   }
   fclose(input);
+  STATS_ADD(COUNT_FILES, 1);
+  STATS_ADD(COUNT_BYTES_READ, *cas_size);
+  statsEnter(stage);
+}
+
+/* Open the output file */
+FILE *openOutputFile(const char *progname, ProgramArgs *args)
+{
+  FILE *output;
 
-  if ((*output=fopen(args->output_file,"wb"))==NULL) {
+  if ((output=fopen(args->output_file,"wb"))==NULL) {
     fprintf(stderr,"%s: failed writing %s\n",progname,args->output_file);
     exit(1);
   }
-
-  /* Initialize write buffer for efficient I/O */
-  initWriteBuffer(wb, *output, args->baudrate, args->output_frequency);
+  return output;
 }
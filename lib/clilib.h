@@ -4,6 +4,8 @@
 #include <stdio.h>
 #include <stddef.h>
 #include "caslib.h"
+#include "stats.h"
+#include "wavcache.h"
 
 /* Program arguments structure */
 typedef struct {
@@ -12,6 +14,11 @@ typedef struct {
   int baudrate;         /* Baud rate: 1200 or 2400 */
   int output_frequency; /* Sample rate (doubled at 2400 baud) */
   int silence_time;     /* Silence duration in samples (default: LONG_SILENCE) */
+  StatsFormat stats;    /* --stats report format (default: STATS_OFF) */
+  bool perf_counters;   /* --perf-counters: hardware events per stage */
+  char *trace_file;     /* --trace output file, or NULL */
+  char *cache_dir;      /* --cache directory, or NULL */
+  uint64_t cache_limit; /* --cache-size in bytes */
 } ProgramArgs;
 
 /**
@@ -32,18 +39,25 @@ void showUsage(char *progname);
 void parseArguments(int argc, char* argv[], ProgramArgs *args);
 
 /**
- * Load CAS file into memory and prepare output file with write buffer.
- * Opens input file, reads it into memory, opens output file, and initializes write buffer.
+ * Load CAS file into memory.
+ * Exits with error message if the file cannot be read.
  *
  * @param progname Program name for error messages
- * @param args Program arguments containing file names and baudrate
+ * @param args Program arguments containing the input file name
  * @param cas Output pointer to allocated CAS data buffer
  * @param cas_size Output size of CAS data
- * @param output Output file handle for WAV output
- * @param wb Write buffer to initialize
  */
-void loadAndPrepareFiles(const char *progname, ProgramArgs *args, 
-                         unsigned char **cas, size_t *cas_size,
-                         FILE **output, WriteBuffer *wb);
+void loadCasFile(const char *progname, ProgramArgs *args,
+                 unsigned char **cas, size_t *cas_size);
+
+/**
+ * Open the output file for writing.
+ * Exits with error message if it cannot be created.
+ *
+ * @param progname Program name for error messages
+ * @param args Program arguments containing the output file name
+ * @return Output file handle for WAV output
+ */
+FILE *openOutputFile(const char *progname, ProgramArgs *args);
 
 #endif /* CLILIB_H */
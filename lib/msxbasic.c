@@ -0,0 +1,364 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         msxbasic.c                                               */
+/* description:  Tokenised MSX BASIC lister                               */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "msxbasic.h"
+
+/* Offset of the program behind a BIN/BASIC address header */
+#define ADDRESS_HEADER_SIZE  6
+
+/* Program lines live in RAM pages 2 and 3 */
+#define PROGRAM_AREA         0x8000
+
+/* Highest line number accepted by the interpreter */
+#define MAX_LINE_NUMBER      65529
+
+/* Lines checked when locating a program */
+#define CHECK_LINES          8
+
+/* Token prefixes */
+#define TOKEN_OCTAL    0x0B  /* &O constant, 16-bit */
+#define TOKEN_HEX      0x0C  /* &H constant, 16-bit */
+#define TOKEN_POINTER  0x0D  /* Line pointer (after RUN), 16-bit */
+#define TOKEN_LINE     0x0E  /* Line number, 16-bit */
+#define TOKEN_BYTE     0x0F  /* Integer 10-255, 8-bit */
+#define TOKEN_DIGIT    0x11  /* Integers 0-9: 0x11-0x1A */
+#define TOKEN_INTEGER  0x1C  /* Integer 256-32767, 16-bit */
+#define TOKEN_SINGLE   0x1D  /* Single precision BCD, 4 bytes */
+#define TOKEN_DOUBLE   0x1F  /* Double precision BCD, 8 bytes */
+#define TOKEN_DATA     0x84
+#define TOKEN_REM      0x8F
+#define TOKEN_ELSE     0xA1
+#define TOKEN_QUOTE    0xE6  /* ' comment */
+#define TOKEN_FUNCTION 0xFF  /* Prefix of function tokens */
+
+/* Statement and operator tokens 0x80-0xFF, indexed by token - 0x80 */
+static const char *const statements[128] = {
+  NULL,      "END",     "FOR",     "NEXT",    "DATA",    "INPUT",   "DIM",     "READ",
+  "LET",     "GOTO",    "RUN",     "IF",      "RESTORE", "GOSUB",   "RETURN",  "REM",
+  "STOP",    "PRINT",   "CLEAR",   "LIST",    "NEW",     "ON",      "WAIT",    "DEF",
+  "POKE",    "CONT",    "CSAVE",   "CLOAD",   "OUT",     "LPRINT",  "LLIST",   "CLS",
+  "WIDTH",   "ELSE",    "TRON",    "TROFF",   "SWAP",    "ERASE",   "ERROR",   "RESUME",
+  "DELETE",  "AUTO",    "RENUM",   "DEFSTR",  "DEFINT",  "DEFSNG",  "DEFDBL",  "LINE",
+  "OPEN",    "FIELD",   "GET",     "PUT",     "CLOSE",   "LOAD",    "MERGE",   "FILES",
+  "LSET",    "RSET",    "SAVE",    "LFILES",  "CIRCLE",  "COLOR",   "DRAW",    "PAINT",
+  "BEEP",    "PLAY",    "PSET",    "PRESET",  "SOUND",   "SCREEN",  "VPOKE",   "SPRITE",
+  "VDP",     "BASE",    "CALL",    "TIME",    "KEY",     "MAX",     "MOTOR",   "BLOAD",
+  "BSAVE",   "DSKO$",   "SET",     "NAME",    "KILL",    "IPL",     "COPY",    "CMD",
+  "LOCATE",  "TO",      "THEN",    "TAB(",    "STEP",    "USR",     "FN",      "SPC(",
+  "NOT",     "ERL",     "ERR",     "STRING$", "USING",   "INSTR",   "'",       "VARPTR",
+  "CSRLIN",  "ATTR$",   "DSKI$",   "OFF",     "INKEY$",  "POINT",   ">",       "=",
+  "<",       "+",       "-",       "*",       "/",       "^",       "AND",     "OR",
+  "XOR",     "EQV",     "IMP",     "MOD",     "\\",      NULL,      NULL,      NULL
+};
+
+/* Function tokens following the 0xFF prefix, indexed by token - 0x80 */
+static const char *const functions[128] = {
+  NULL,      "LEFT$",   "RIGHT$",  "MID$",    "SGN",     "INT",     "ABS",     "SQR",
+  "RND",     "SIN",     "LOG",     "EXP",     "COS",     "TAN",     "ATN",     "FRE",
+  "INP",     "POS",     "LEN",     "STR$",    "VAL",     "ASC",     "CHR$",    "PEEK",
+  "VPEEK",   "SPACE$",  "OCT$",    "HEX$",    "LPOS",    "BIN$",    "CINT",    "CSNG",
+  "CDBL",    "FIX",     "STICK",   "STRIG",   "PDL",     "PAD",     "DSKF",    "FPOS",
+  "CVI",     "CVS",     "CVD",     "EOF",     "LOC",     "LOF",     "MKI$",    "MKS$",
+  "MKD$"
+};
+
+/* What the rest of a statement holds */
+typedef enum {
+  TEXT_CODE,     /* Tokens */
+  TEXT_DATA,     /* DATA items, literal up to the next ':' */
+  TEXT_REMARK    /* Comment, literal up to the end of the line */
+} TextMode;
+
+/* Line assembly buffer, flushed to the output stream when full */
+typedef struct {
+  FILE *out;     /* NULL to only measure lines */
+  size_t length;
+  char text[512];
+} Writer;
+
+static void flush(Writer *w)
+{
+  fwrite(w->text, 1, w->length, w->out);
+  w->length = 0;
+}
+
+static void put(Writer *w, const char *s, size_t length)
+{
+  if (w == NULL)
+    return;
+  if (w->length + length > sizeof(w->text))
+    flush(w);
+  memcpy(w->text + w->length, s, length);
+  w->length += length;
+}
+
+static void putString(Writer *w, const char *s)
+{
+  put(w, s, strlen(s));
+}
+
+static inline unsigned get16(const unsigned char *p)
+{
+  return p[0] | p[1] << 8;
+}
+
+/* Format a BCD floating point constant the way LIST shows it: exponent
+ * byte (sign bit, excess-64 power of ten), then two digits per byte */
+static void putFloat(Writer *w, const unsigned char *p, size_t bytes, bool dbl)
+{
+  char digits[16], text[40];
+  int count = 0, exponent = (p[0] & 0x7F) - 0x40, length = 0;
+  int limit = dbl ? 14 : 6;
+
+  for (size_t i = 1; i < bytes; i++) {
+    digits[count++] = '0' + (p[i] >> 4);
+    digits[count++] = '0' + (p[i] & 0x0F);
+  }
+  while (count > 0 && digits[count-1] == '0')
+    count--;
+
+  if ((p[0] & 0x7F) == 0 || count == 0) {
+    /* Zero */
+    text[length++] = '0';
+    text[length++] = dbl ? '#' : '!';
+  }
+  else {
+    if (p[0] & 0x80)
+      text[length++] = '-';
+
+    if (exponent < -1 || exponent > limit) {
+      /* Scientific notation, d.dddE+xx (D for double precision) */
+      text[length++] = digits[0];
+      if (count > 1) {
+        text[length++] = '.';
+        memcpy(text + length, digits + 1, count - 1);
+        length += count - 1;
+      }
+      length += snprintf(text + length, sizeof(text) - length, "%c%c%02d",
+                         dbl ? 'D' : 'E', exponent > 0 ? '+' : '-',
+                         exponent > 0 ? exponent - 1 : 1 - exponent);
+    }
+    else if (exponent <= 0) {
+      /* .00ddd */
+      text[length++] = '.';
+      for (int i = exponent; i < 0; i++)
+        text[length++] = '0';
+      memcpy(text + length, digits, count);
+      length += count;
+    }
+    else {
+      /* ddd.ddd or ddd00 */
+      for (int i = 0; i < exponent || i < count; i++) {
+        if (i == exponent)
+          text[length++] = '.';
+        text[length++] = i < count ? digits[i] : '0';
+      }
+      if (!dbl && exponent >= count)
+        text[length++] = '!';
+    }
+
+    /* Double precision constants that would fit a single carry a '#' */
+    if (dbl && count <= 6 && exponent >= -1 && exponent <= limit)
+      text[length++] = '#';
+  }
+  put(w, text, length);
+}
+
+/* Decode the statements of one line up to its terminating 0 byte.
+ * Returns the position after the terminator, NULL if the data ends first. */
+static const unsigned char *decodeLine(const unsigned char *p, const unsigned char *end,
+                                       Writer *w)
+{
+  TextMode mode = TEXT_CODE;
+  bool quoted = false;
+  char number[16];
+
+  while (p < end) {
+    unsigned c = *p++;
+
+    if (c == 0)
+      return p;
+
+    /* Strings, DATA items and comments are stored as typed */
+    if (quoted || mode == TEXT_REMARK) {
+      if (c == '"')
+        quoted = false;
+      put(w, (const char*)p - 1, 1);
+      continue;
+    }
+    if (mode == TEXT_DATA && c == ':')
+      mode = TEXT_CODE;
+    if (c == '"')
+      quoted = true;
+    if (mode == TEXT_DATA) {
+      put(w, (const char*)p - 1, 1);
+      continue;
+    }
+
+    switch (c) {
+
+      case ':':
+        /* ELSE and ' are stored behind an implicit statement separator */
+        if (p < end && *p == TOKEN_ELSE)
+          break;
+        if (end - p >= 2 && p[0] == TOKEN_REM && p[1] == TOKEN_QUOTE) {
+          p += 2;
+          putString(w, "'");
+          mode = TEXT_REMARK;
+          break;
+        }
+        put(w, ":", 1);
+        break;
+
+      case TOKEN_OCTAL:
+      case TOKEN_HEX:
+      case TOKEN_POINTER:
+      case TOKEN_LINE:
+      case TOKEN_INTEGER:
+        if (end - p < 2)
+          return NULL;
+        snprintf(number, sizeof(number),
+                 c == TOKEN_OCTAL ? "&O%o" : c == TOKEN_HEX ? "&H%X" :
+                 c == TOKEN_INTEGER ? "%d" : "%u",
+                 c == TOKEN_INTEGER ? (int)(int16_t)get16(p) : get16(p));
+        putString(w, number);
+        p += 2;
+        break;
+
+      case TOKEN_BYTE:
+        if (p >= end)
+          return NULL;
+        snprintf(number, sizeof(number), "%u", *p++);
+        putString(w, number);
+        break;
+
+      case TOKEN_SINGLE:
+      case TOKEN_DOUBLE:
+        if ((size_t)(end - p) < (c == TOKEN_SINGLE ? 4u : 8u))
+          return NULL;
+        if (w != NULL)
+          putFloat(w, p, c == TOKEN_SINGLE ? 4 : 8, c == TOKEN_DOUBLE);
+        p += c == TOKEN_SINGLE ? 4 : 8;
+        break;
+
+      case TOKEN_FUNCTION:
+        if (p >= end)
+          return NULL;
+        c = *p++;
+        if (c >= 0x80 && functions[c - 0x80] != NULL)
+          putString(w, functions[c - 0x80]);
+        else
+          put(w, (const char*)p - 1, 1);
+        break;
+
+      default:
+        if (c >= TOKEN_DIGIT && c < TOKEN_DIGIT + 10) {
+          number[0] = '0' + c - TOKEN_DIGIT;
+          put(w, number, 1);
+        }
+        else if (c >= 0x80 && statements[c - 0x80] != NULL) {
+          putString(w, statements[c - 0x80]);
+          if (c == TOKEN_REM || c == TOKEN_QUOTE)
+            mode = TEXT_REMARK;
+          else if (c == TOKEN_DATA)
+            mode = TEXT_DATA;
+        }
+        else
+          put(w, (const char*)p - 1, 1);
+        break;
+    }
+  }
+  return NULL;
+}
+
+/* Check that the first lines from data form a consistent line chain:
+ * each link is the address of the next line, so consecutive links differ
+ * by the length of the line in between */
+static bool checkProgram(const unsigned char *data, size_t size)
+{
+  const unsigned char *p = data, *end = data + size;
+  unsigned previous_link = 0, previous_number = 0;
+
+  for (int lines = 0; lines < CHECK_LINES; lines++) {
+    const unsigned char *next;
+    unsigned link, number;
+
+    if (end - p < 2)
+      return false;
+    if ((link = get16(p)) == 0)
+      return lines > 0;
+    if (end - p < 4 || link < PROGRAM_AREA)
+      return false;
+    number = get16(p + 2);
+    if ((next = decodeLine(p + 4, end, NULL)) == NULL || number > MAX_LINE_NUMBER)
+      return false;
+    if (lines > 0 && (number <= previous_number ||
+                      link - previous_link != (unsigned)(next - p)))
+      return false;
+
+    previous_link = link;
+    previous_number = number;
+    p = next;
+  }
+  return true;
+}
+
+/* Locate the first program line: right at the start, or behind the
+ * address header */
+long findBasicProgram(const unsigned char *data, size_t size)
+{
+  if (checkProgram(data, size))
+    return 0;
+  if (size > ADDRESS_HEADER_SIZE &&
+      checkProgram(data + ADDRESS_HEADER_SIZE, size - ADDRESS_HEADER_SIZE))
+    return ADDRESS_HEADER_SIZE;
+  return -1;
+}
+
+/* Measure the program through its zero end-of-program link */
+size_t basicProgramSize(const unsigned char *data, size_t size)
+{
+  const unsigned char *p = data, *end = data + size;
+
+  while (end - p >= 4 && get16(p) != 0) {
+    if ((p = decodeLine(p + 4, end, NULL)) == NULL)
+      return size;
+  }
+  if (end - p >= 2 && get16(p) == 0)
+    return p + 2 - data;
+  return size;
+}
+
+/* List all lines up to the end-of-program link */
+size_t listBasic(FILE *out, const unsigned char *data, size_t size)
+{
+  const unsigned char *p = data, *end = data + size;
+  Writer w;
+  size_t lines = 0;
+
+  w.out = out;
+  w.length = 0;
+
+  while (end - p >= 4 && get16(p) != 0) {
+    char number[8];
+    const unsigned char *next;
+
+    snprintf(number, sizeof(number), "%u ", get16(p + 2));
+    putString(&w, number);
+    next = decodeLine(p + 4, end, &w);
+    put(&w, "\n", 1);
+    lines++;
+    if (next == NULL)
+      break;
+    p = next;
+  }
+  flush(&w);
+  return lines;
+}
@@ -0,0 +1,41 @@
+#ifndef MSXBASIC_H
+#define MSXBASIC_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/**
+ * Locate a tokenised BASIC program in a CAS data block.
+ * Images in the wild store the program either directly or behind the
+ * 6-byte address header; the line chain (next-line links, ascending line
+ * numbers) tells which.
+ *
+ * @param data Data block contents
+ * @param size Data block length
+ * @return Offset of the first program line, or -1 if no program is found
+ */
+long findBasicProgram(const unsigned char *data, size_t size);
+
+/**
+ * Measure a tokenised BASIC program, up to and including the zero
+ * end-of-program link; the tape padding after it is not counted.
+ *
+ * @param data First program line (see findBasicProgram)
+ * @param size Bytes available from data
+ * @return Program length, or size if the program does not end within it
+ */
+size_t basicProgramSize(const unsigned char *data, size_t size);
+
+/**
+ * List a tokenised BASIC program as text, one "NUMBER STATEMENTS" line per
+ * program line, the way LIST shows it on the MSX.
+ * Stops at the end-of-program link or at the end of the data.
+ *
+ * @param out  Stream to write the listing to
+ * @param data First program line (see findBasicProgram)
+ * @param size Bytes available from data
+ * @return Number of lines listed
+ */
+size_t listBasic(FILE *out, const unsigned char *data, size_t size);
+
+#endif /* MSXBASIC_H */
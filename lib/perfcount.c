@@ -0,0 +1,148 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         perfcount.c                                              */
+/* description:  Hardware performance counters through perf_event_open    */
+/*                                                                        */
+/**************************************************************************/
+
+#include "perfcount.h"
+#include <string.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+static const char *event_names[PERF_EVENT_COUNT] = {
+  "cycles", "instructions", "cache_misses", "branch_misses", "page_faults"
+};
+
+/* Events found countable by perfProbe */
+static bool available[PERF_EVENT_COUNT];
+
+const char *perfEventName(PerfEvent event)
+{
+  return event_names[event];
+}
+
+bool perfAvailable(PerfEvent event)
+{
+  return available[event];
+}
+
+#ifdef __linux__
+
+/* Counter group of one thread: the first available event leads */
+typedef struct {
+  bool opened;
+  int fd[PERF_EVENT_COUNT];   /* -1 if not counted */
+  int count;                  /* Events in the group */
+} PerfGroup;
+
+static __thread PerfGroup group;
+
+/* Open one event for the calling thread, in the group of leader (or -1) */
+static int openEvent(PerfEvent event, int leader)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  switch (event) {
+    case PERF_CYCLES:
+      attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+    case PERF_INSTRUCTIONS:
+      attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+    case PERF_CACHE_MISSES:
+      attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+    case PERF_BRANCH_MISSES:
+      attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+    default:
+      attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_PAGE_FAULTS; break;
+  }
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.disabled = leader < 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+/* Open the counters of the calling thread */
+static void openGroup(PerfGroup *g, bool probe)
+{
+  int leader = -1;
+
+  g->opened = true;
+  g->count = 0;
+  for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+    g->fd[i] = -1;
+    if (!probe && !available[i])
+      continue;
+    if ((g->fd[i] = openEvent((PerfEvent)i, leader)) >= 0) {
+      if (leader < 0)
+        leader = g->fd[i];
+      g->count++;
+    }
+  }
+  if (leader >= 0) {
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+}
+
+int perfProbe(void)
+{
+  int count = 0;
+
+  /* errno is left by the last event that failed to open */
+  openGroup(&group, true);
+  for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+    available[i] = group.fd[i] >= 0;
+    count += available[i];
+  }
+  return count;
+}
+
+void perfRead(uint64_t values[PERF_EVENT_COUNT])
+{
+  /* nr, time enabled, time running, one value per event in the group */
+  uint64_t data[3 + PERF_EVENT_COUNT];
+  int leader = -1, n = 0;
+
+  memset(values, 0, PERF_EVENT_COUNT * sizeof(uint64_t));
+  if (!group.opened)
+    openGroup(&group, false);
+  for (int i = 0; i < PERF_EVENT_COUNT && leader < 0; i++)
+    leader = group.fd[i];
+  if (leader < 0 || read(leader, data, sizeof(data)) < (ssize_t)(3 * sizeof(uint64_t)))
+    return;
+
+  /* Values come in the order the events joined the group */
+  for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+    if (group.fd[i] < 0 || n >= (int)data[0])
+      continue;
+    values[i] = data[3 + n++];
+    if (data[2] > 0 && data[2] < data[1])
+      values[i] = (uint64_t)((double)values[i] * data[1] / data[2]);
+  }
+}
+
+#else
+
+int perfProbe(void)
+{
+  errno = ENOSYS;
+  return 0;
+}
+
+void perfRead(uint64_t values[PERF_EVENT_COUNT])
+{
+  memset(values, 0, PERF_EVENT_COUNT * sizeof(uint64_t));
+}
+
+#endif
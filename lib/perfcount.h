@@ -0,0 +1,51 @@
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Events counted by --perf-counters (user space only) */
+typedef enum {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_CACHE_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_PAGE_FAULTS,
+  PERF_EVENT_COUNT
+} PerfEvent;
+
+/**
+ * Check which events this machine can count, using Linux perf_event_open
+ * on the calling thread. Virtual machines often lack the hardware events;
+ * the software ones (page faults) are counted regardless.
+ *
+ * @return Number of events available, 0 if none (errno is set)
+ */
+int perfProbe(void);
+
+/**
+ * Check if an event can be counted (after perfProbe).
+ *
+ * @param event Event
+ * @return true if counted
+ */
+bool perfAvailable(PerfEvent event);
+
+/**
+ * Read the event counts of the calling thread, opening its counters on
+ * first use. Counts are scaled when the kernel multiplexed the counters.
+ *
+ * @param values Set to the counts since the thread's first read;
+ *               0 for unavailable events
+ */
+void perfRead(uint64_t values[PERF_EVENT_COUNT]);
+
+/**
+ * Return the name of an event ("cycles", "instructions"...).
+ *
+ * @param event Event
+ * @return Static string
+ */
+const char *perfEventName(PerfEvent event);
+
+#endif /* PERFCOUNT_H */
@@ -0,0 +1,130 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         ring.c                                                   */
+/* description:  Lock-free single-producer single-consumer stage queues   */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include "ring.h"
+#include "stats.h"
+#include "trace.h"
+
+/* Waiting: spin while the other stage is about to deliver, then yield,
+ * then sleep so a stage blocked on a slow one does not burn a CPU */
+#define SPIN_ROUNDS   256
+#define YIELD_ROUNDS  64
+#define SLEEP_NS      20000
+
+/* A wait that did not succeed at once; its time goes to no stage */
+typedef struct {
+  Stage stage;
+  uint64_t start;
+  unsigned round;
+} Wait;
+
+static void waitBegin(Wait *wait)
+{
+  wait->stage = statsEnter(STAGE_NONE);
+  wait->start = traceStart();
+  wait->round = 0;
+}
+
+static void waitPause(Wait *wait)
+{
+  if (wait->round < SPIN_ROUNDS) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  } else if (wait->round < SPIN_ROUNDS + YIELD_ROUNDS) {
+    sched_yield();
+  } else {
+    struct timespec ts = { 0, SLEEP_NS };
+    nanosleep(&ts, NULL);
+  }
+  wait->round++;
+}
+
+static void waitEnd(Wait *wait, const char *what)
+{
+  traceSpan("wait", what, NULL, wait->start);
+  statsEnter(wait->stage);
+}
+
+int ringInit(Ring *ring, uint32_t count, size_t slot_size)
+{
+  ring->slots = malloc((size_t)count * slot_size);
+  ring->slot_size = slot_size;
+  ring->count = count;
+  ring->head = 0;
+  ring->tail = 0;
+  return ring->slots != NULL ? 0 : -1;
+}
+
+void ringFree(Ring *ring)
+{
+  free(ring->slots);
+  ring->slots = NULL;
+}
+
+void *ringProduce(Ring *ring)
+{
+  uint32_t head = ring->head;
+
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->count) {
+    Wait wait;
+
+    waitBegin(&wait);
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->count)
+      waitPause(&wait);
+    waitEnd(&wait, "ring full");
+  }
+  return ring->slots + (size_t)(head % ring->count) * ring->slot_size;
+}
+
+void ringPublish(Ring *ring)
+{
+  __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void *ringConsume(Ring *ring)
+{
+  uint32_t tail = ring->tail;
+
+  if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+    Wait wait;
+
+    waitBegin(&wait);
+    while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+      waitPause(&wait);
+    waitEnd(&wait, "ring empty");
+  }
+  return ring->slots + (size_t)(tail % ring->count) * ring->slot_size;
+}
+
+void ringRelease(Ring *ring)
+{
+  __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+void markPublish(Mark *mark, int32_t value)
+{
+  __atomic_store_n(&mark->value, value, __ATOMIC_RELEASE);
+}
+
+int32_t markWait(const Mark *mark, int32_t want)
+{
+  int32_t value = __atomic_load_n(&mark->value, __ATOMIC_ACQUIRE);
+
+  if (value < want) {
+    Wait wait;
+
+    waitBegin(&wait);
+    while ((value = __atomic_load_n(&mark->value, __ATOMIC_ACQUIRE)) < want)
+      waitPause(&wait);
+    waitEnd(&wait, "samples");
+  }
+  return value;
+}
@@ -0,0 +1,93 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Cache line: fields written by different threads go on separate lines */
+#define RING_LINE  64
+
+/* Lock-free queue of fixed-size slots between one producer thread and one
+ * consumer thread. The producer fills the slot ringProduce returns and
+ * passes it on with ringPublish; the consumer reads the slot ringConsume
+ * returns and gives it back with ringRelease. */
+typedef struct {
+  unsigned char *slots;
+  size_t slot_size;
+  uint32_t count;                                /* Number of slots */
+  uint32_t head __attribute__((aligned(RING_LINE)));  /* Slots published */
+  uint32_t tail __attribute__((aligned(RING_LINE)));  /* Slots released */
+} Ring;
+
+/* Number of items a producer has finished, in order, in a buffer both
+ * threads share (samples converted so far...): a queue whose slots are
+ * the buffer itself. One producer, any readers. */
+typedef struct {
+  int32_t value __attribute__((aligned(RING_LINE)));
+} Mark;
+
+/**
+ * Allocate the slots of a ring.
+ *
+ * @param ring      Ring to initialize
+ * @param count     Number of slots
+ * @param slot_size Bytes per slot
+ * @return 0 on success, -1 if out of memory
+ */
+int ringInit(Ring *ring, uint32_t count, size_t slot_size);
+
+/**
+ * Free the slots of a ring.
+ *
+ * @param ring Ring to free
+ */
+void ringFree(Ring *ring);
+
+/**
+ * Producer: wait for a free slot.
+ *
+ * @param ring Ring
+ * @return Slot to fill
+ */
+void *ringProduce(Ring *ring);
+
+/**
+ * Producer: hand the slot from ringProduce to the consumer.
+ *
+ * @param ring Ring
+ */
+void ringPublish(Ring *ring);
+
+/**
+ * Consumer: wait for a published slot, oldest first.
+ *
+ * @param ring Ring
+ * @return Slot to read
+ */
+void *ringConsume(Ring *ring);
+
+/**
+ * Consumer: give the slot from ringConsume back to the producer.
+ *
+ * @param ring Ring
+ */
+void ringRelease(Ring *ring);
+
+/**
+ * Producer: publish a new count; everything before it must be written.
+ *
+ * @param mark  Mark
+ * @param value Items finished, never less than before
+ */
+void markPublish(Mark *mark, int32_t value);
+
+/**
+ * Wait until a mark reaches a count.
+ *
+ * @param mark Mark
+ * @param want Items needed
+ * @return Items finished, at least want
+ */
+int32_t markWait(const Mark *mark, int32_t want);
+
+#endif /* RING_H */
@@ -0,0 +1,51 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         segwrite.c                                               */
+/* description:  Gathered writes of segment lists (casextract, caspack)   */
+/*                                                                        */
+/**************************************************************************/
+
+#include <errno.h>
+#include <unistd.h>
+#include "segwrite.h"
+
+/* Segments passed to a single writev call (at most IOV_MAX) */
+#define WRITE_SEGMENTS  1024
+
+/* Write all segments with as few system calls as possible */
+int writeSegments(int fd, struct iovec *iov, int count)
+{
+#ifndef _WIN32
+  while (count > 0) {
+    ssize_t written = writev(fd, iov, count < WRITE_SEGMENTS ? count : WRITE_SEGMENTS);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    /* Skip fully written segments, advance into a partial one */
+    while (count > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (char*)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+#else
+  for (int i = 0; i < count; i++) {
+    const char *p = (const char*)iov[i].iov_base;
+    size_t left = iov[i].iov_len;
+    while (left > 0) {
+      int written = write(fd, p, left);
+      if (written < 0)
+        return -1;
+      p += written;
+      left -= written;
+    }
+  }
+#endif
+  return 0;
+}
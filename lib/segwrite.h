@@ -0,0 +1,30 @@
+#ifndef SEGWRITE_H
+#define SEGWRITE_H
+
+#include <stddef.h>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#else
+/* Minimal stand-in: Windows has no writev */
+struct iovec {
+  void *iov_base;
+  size_t iov_len;
+};
+#endif
+
+/**
+ * Write a list of segments to a file descriptor with as few system calls
+ * as possible (writev, a bounded number of segments per call).
+ * Segments may point into a mapped image, so the data goes from the page
+ * cache of the input to the output without a user-space copy. Partial
+ * writes and EINTR are retried; iov is consumed in the process.
+ *
+ * @param fd    Output file descriptor
+ * @param iov   Segments to write, in order
+ * @param count Number of segments
+ * @return 0 on success, -1 on a write error (errno set)
+ */
+int writeSegments(int fd, struct iovec *iov, int count);
+
+#endif /* SEGWRITE_H */
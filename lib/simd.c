@@ -0,0 +1,496 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         simd.c                                                   */
+/* description:  Runtime-dispatched sample kernels: scalar reference and  */
+/*               SSE2/AVX2/AVX-512 (x86) or NEON (AArch64) versions       */
+/*                                                                        */
+/**************************************************************************/
+
+#include "simd.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+/* Scalar reference: the original wav2cas/cas2wav loops */
+
+static void convertScalar(const unsigned char *raw, int32_t count, int frame_size, int bits,
+                          bool phase, int8_t *out)
+{
+  /* The last byte of a frame: 8-bit last channel, or its 16-bit MSB */
+  const unsigned char *p = raw + frame_size - 1;
+  int8_t flip = bits==8 ? (int8_t)0x80 : 0;
+
+  for (int32_t i = 0; i < count; i++, p += frame_size) {
+    int8_t data = (int8_t)(*p ^ flip);
+    out[i] = phase ? -data : data;
+  }
+}
+
+static void envelopeScalar(int8_t *buffer, int32_t size)
+{
+  for (int32_t i = 1; i < size-1; i++)
+    buffer[i] = ( 0.5*buffer[i-1] +
+                  1.0*buffer[i]   +
+                  2.0*buffer[i+1] ) / 3.5;
+}
+
+static int peakScalar(const int8_t *buffer, int32_t size)
+{
+  int maximum = 0;
+  for (int32_t i = 0; i < size; i++)
+    if (abs(buffer[i]) > maximum) maximum = abs(buffer[i]);
+  return maximum;
+}
+
+static void scaleScalar(int8_t *buffer, int32_t size, float factor)
+{
+  for (int32_t i = 0; i < size; i++)
+    buffer[i] *= factor;
+}
+
+static int32_t findScalar(const int8_t *buffer, int32_t index, int32_t end, int lo, int hi)
+{
+  for (; index < end; index++)
+    if (buffer[index] < lo || buffer[index] > hi)
+      return index;
+  return index;
+}
+
+const SimdKernels simd_scalar = {
+  "scalar", convertScalar, envelopeScalar, peakScalar, scaleScalar, findScalar
+};
+
+/* The envelope filter feeds each output into the next, so it does not
+ * vectorise. In integers it is (a + 2b + 4c) / 7: the double version
+ * computes the same quotient (exact numerator, correctly rounded
+ * division that cannot cross an integer) and truncates the same way. */
+static void envelopeInteger(int8_t *buffer, int32_t size)
+{
+  int prev = size > 0 ? buffer[0] : 0;
+
+  for (int32_t i = 1; i < size-1; i++) {
+    prev = (prev + 2*buffer[i] + 4*buffer[i+1]) / 7;
+    buffer[i] = prev;
+  }
+}
+
+/* Silence search with a byte range test needs lo..hi clamped to int8;
+ * the cases where that changes the answer are left to the reference */
+static bool findInRange(int *lo, int *hi)
+{
+  if (*lo > *hi || *lo > 127 || *hi < -128 || (*lo <= -128 && *hi >= 127))
+    return false;
+  if (*lo < -128) *lo = -128;
+  if (*hi > 127)  *hi = 127;
+  return true;
+}
+
+#ifdef SIMD_X86
+
+/* SSE2 */
+
+__attribute__((target("sse2"), always_inline))
+static inline void convertSse2(const unsigned char *raw, int32_t count, int frame_size, int bits,
+                        bool phase, int8_t *out)
+{
+  const __m128i flip = _mm_set1_epi8(bits==8 ? (char)0x80 : 0);
+  const __m128i zero = _mm_setzero_si128();
+  int32_t i = 0;
+
+  if (frame_size == 1 || frame_size == 2 || frame_size == 4) {
+    for (; i + 16 <= count; i += 16) {
+      const __m128i *p = (const __m128i*)(raw + (size_t)i * frame_size);
+      __m128i v;
+
+      if (frame_size == 1)
+        v = _mm_loadu_si128(p);
+      else if (frame_size == 2)
+        v = _mm_packus_epi16(_mm_srli_epi16(_mm_loadu_si128(p), 8),
+                             _mm_srli_epi16(_mm_loadu_si128(p + 1), 8));
+      else
+        v = _mm_packus_epi16(_mm_packs_epi32(_mm_srli_epi32(_mm_loadu_si128(p), 24),
+                                             _mm_srli_epi32(_mm_loadu_si128(p + 1), 24)),
+                             _mm_packs_epi32(_mm_srli_epi32(_mm_loadu_si128(p + 2), 24),
+                                             _mm_srli_epi32(_mm_loadu_si128(p + 3), 24)));
+      v = _mm_xor_si128(v, flip);
+      if (phase)
+        v = _mm_sub_epi8(zero, v);
+      _mm_storeu_si128((__m128i*)(out + i), v);
+    }
+  }
+  convertScalar(raw + (size_t)i * frame_size, count - i, frame_size, bits, phase, out + i);
+}
+
+__attribute__((target("sse2"), always_inline))
+static inline int peakSse2(const int8_t *buffer, int32_t size)
+{
+  __m128i top = _mm_setzero_si128();
+  unsigned char lanes[16];
+  int maximum = 0, rest;
+  int32_t i = 0;
+
+  /* |x| as unsigned bytes: (x ^ sign) - sign, 128 for -128 */
+  for (; i + 16 <= size; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(buffer + i));
+    __m128i sign = _mm_cmpgt_epi8(_mm_setzero_si128(), x);
+    top = _mm_max_epu8(top, _mm_sub_epi8(_mm_xor_si128(x, sign), sign));
+  }
+  _mm_storeu_si128((__m128i*)lanes, top);
+  for (int n = 0; n < 16; n++)
+    if (lanes[n] > maximum) maximum = lanes[n];
+
+  rest = peakScalar(buffer + i, size - i);
+  return rest > maximum ? rest : maximum;
+}
+
+__attribute__((target("sse2")))
+static void scaleSse2(int8_t *buffer, int32_t size, float factor)
+{
+  const __m128 f = _mm_set1_ps(factor);
+  int32_t i = 0;
+
+  for (; i + 16 <= size; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(buffer + i));
+    __m128i sign = _mm_cmpgt_epi8(_mm_setzero_si128(), x);
+    __m128i lo = _mm_unpacklo_epi8(x, sign), hi = _mm_unpackhi_epi8(x, sign);
+    __m128i w[4];
+
+    w[0] = _mm_unpacklo_epi16(lo, _mm_srai_epi16(lo, 15));
+    w[1] = _mm_unpackhi_epi16(lo, _mm_srai_epi16(lo, 15));
+    w[2] = _mm_unpacklo_epi16(hi, _mm_srai_epi16(hi, 15));
+    w[3] = _mm_unpackhi_epi16(hi, _mm_srai_epi16(hi, 15));
+    for (int n = 0; n < 4; n++)
+      w[n] = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(w[n]), f));
+    _mm_storeu_si128((__m128i*)(buffer + i),
+                     _mm_packs_epi16(_mm_packs_epi32(w[0], w[1]), _mm_packs_epi32(w[2], w[3])));
+  }
+  scaleScalar(buffer + i, size - i, factor);
+}
+
+/* Range already clamped by findInRange */
+__attribute__((target("sse2"), always_inline))
+static inline int32_t findRangeSse2(const int8_t *buffer, int32_t index, int32_t end, int lo, int hi)
+{
+  const __m128i vlo = _mm_set1_epi8((char)lo), vhi = _mm_set1_epi8((char)hi);
+
+  for (; index + 16 <= end; index += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(buffer + index));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi8(x, vhi), _mm_cmpgt_epi8(vlo, x)));
+    if (mask)
+      return index + __builtin_ctz(mask);
+  }
+  return findScalar(buffer, index, end, lo, hi);
+}
+
+__attribute__((target("sse2")))
+static int32_t findSse2(const int8_t *buffer, int32_t index, int32_t end, int lo, int hi)
+{
+  if (!findInRange(&lo, &hi))
+    return findScalar(buffer, index, end, lo, hi);
+  return findRangeSse2(buffer, index, end, lo, hi);
+}
+
+static const SimdKernels simd_sse2 = {
+  "sse2", convertSse2, envelopeInteger, peakSse2, scaleSse2, findSse2
+};
+
+/* AVX2 */
+
+__attribute__((target("avx2")))
+static void convertAvx2(const unsigned char *raw, int32_t count, int frame_size, int bits,
+                        bool phase, int8_t *out)
+{
+  const __m256i flip = _mm256_set1_epi8(bits==8 ? (char)0x80 : 0);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  int32_t i = 0;
+
+  if (frame_size == 1 || frame_size == 2 || frame_size == 4) {
+    for (; i + 32 <= count; i += 32) {
+      const __m256i *p = (const __m256i*)(raw + (size_t)i * frame_size);
+      __m256i v;
+
+      /* Packs work per 128-bit lane: reorder the 64/32-bit groups after */
+      if (frame_size == 1)
+        v = _mm256_loadu_si256(p);
+      else if (frame_size == 2)
+        v = _mm256_permute4x64_epi64(
+              _mm256_packus_epi16(_mm256_srli_epi16(_mm256_loadu_si256(p), 8),
+                                  _mm256_srli_epi16(_mm256_loadu_si256(p + 1), 8)), 0xD8);
+      else
+        v = _mm256_permutevar8x32_epi32(
+              _mm256_packus_epi16(
+                _mm256_packs_epi32(_mm256_srli_epi32(_mm256_loadu_si256(p), 24),
+                                   _mm256_srli_epi32(_mm256_loadu_si256(p + 1), 24)),
+                _mm256_packs_epi32(_mm256_srli_epi32(_mm256_loadu_si256(p + 2), 24),
+                                   _mm256_srli_epi32(_mm256_loadu_si256(p + 3), 24))), order);
+      v = _mm256_xor_si256(v, flip);
+      if (phase)
+        v = _mm256_sub_epi8(zero, v);
+      _mm256_storeu_si256((__m256i*)(out + i), v);
+    }
+  }
+  convertSse2(raw + (size_t)i * frame_size, count - i, frame_size, bits, phase, out + i);
+}
+
+__attribute__((target("avx2")))
+static int peakAvx2(const int8_t *buffer, int32_t size)
+{
+  __m256i top = _mm256_setzero_si256();
+  unsigned char lanes[32];
+  int maximum = 0, rest;
+  int32_t i = 0;
+
+  /* abs(-128) is 0x80, which is 128 as an unsigned byte */
+  for (; i + 32 <= size; i += 32)
+    top = _mm256_max_epu8(top, _mm256_abs_epi8(_mm256_loadu_si256((const __m256i*)(buffer + i))));
+  _mm256_storeu_si256((__m256i*)lanes, top);
+  for (int n = 0; n < 32; n++)
+    if (lanes[n] > maximum) maximum = lanes[n];
+
+  rest = peakSse2(buffer + i, size - i);
+  return rest > maximum ? rest : maximum;
+}
+
+__attribute__((target("avx2")))
+static void scaleAvx2(int8_t *buffer, int32_t size, float factor)
+{
+  const __m256 f = _mm256_set1_ps(factor);
+  int32_t i = 0;
+
+  for (; i + 8 <= size; i += 8) {
+    __m256i x = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(buffer + i)));
+    __m256i w = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(x), f));
+    __m128i v = _mm_packs_epi32(_mm256_castsi256_si128(w), _mm256_extracti128_si256(w, 1));
+    _mm_storel_epi64((__m128i*)(buffer + i), _mm_packs_epi16(v, v));
+  }
+  scaleScalar(buffer + i, size - i, factor);
+}
+
+__attribute__((target("avx2")))
+static int32_t findAvx2(const int8_t *buffer, int32_t index, int32_t end, int lo, int hi)
+{
+  __m256i vlo, vhi;
+
+  if (!findInRange(&lo, &hi))
+    return findScalar(buffer, index, end, lo, hi);
+  vlo = _mm256_set1_epi8((char)lo);
+  vhi = _mm256_set1_epi8((char)hi);
+  for (; index + 32 <= end; index += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(buffer + index));
+    unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpgt_epi8(x, vhi),
+                                                         _mm256_cmpgt_epi8(vlo, x)));
+    if (mask)
+      return index + __builtin_ctz(mask);
+  }
+  return findRangeSse2(buffer, index, end, lo, hi);
+}
+
+static const SimdKernels simd_avx2 = {
+  "avx2", convertAvx2, envelopeInteger, peakAvx2, scaleAvx2, findAvx2
+};
+
+/* AVX-512 (BW): byte kernels on 64-byte vectors, the rest as AVX2 */
+
+__attribute__((target("avx512f,avx512bw")))
+static void convertAvx512(const unsigned char *raw, int32_t count, int frame_size, int bits,
+                          bool phase, int8_t *out)
+{
+  const __m512i flip = _mm512_set1_epi8(bits==8 ? (char)0x80 : 0);
+  const __m512i zero = _mm512_setzero_si512();
+  int32_t i = 0;
+
+  if (frame_size == 1) {
+    for (; i + 64 <= count; i += 64) {
+      __m512i v = _mm512_xor_si512(_mm512_loadu_si512(raw + i), flip);
+      if (phase)
+        v = _mm512_sub_epi8(zero, v);
+      _mm512_storeu_si512(out + i, v);
+    }
+  }
+  convertAvx2(raw + (size_t)i * frame_size, count - i, frame_size, bits, phase, out + i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int32_t findAvx512(const int8_t *buffer, int32_t index, int32_t end, int lo, int hi)
+{
+  __m512i vlo, vhi;
+
+  if (!findInRange(&lo, &hi))
+    return findScalar(buffer, index, end, lo, hi);
+  if (index >= end)
+    return index;
+  vlo = _mm512_set1_epi8((char)lo);
+  vhi = _mm512_set1_epi8((char)hi);
+  /* Masked loads cover the tail: masked-out bytes are not read */
+  for (; index < end; index += 64) {
+    __mmask64 valid = end - index >= 64 ? ~0ULL : (1ULL << (end - index)) - 1;
+    __m512i x = _mm512_maskz_loadu_epi8(valid, buffer + index);
+    __mmask64 mask = (_mm512_cmpgt_epi8_mask(x, vhi) | _mm512_cmpgt_epi8_mask(vlo, x)) & valid;
+    if (mask)
+      return index + __builtin_ctzll(mask);
+  }
+  return end;
+}
+
+static const SimdKernels simd_avx512 = {
+  "avx512", convertAvx512, envelopeInteger, peakAvx2, scaleAvx2, findAvx512
+};
+
+#endif /* SIMD_X86 */
+
+#ifdef SIMD_NEON
+
+static void convertNeon(const unsigned char *raw, int32_t count, int frame_size, int bits,
+                        bool phase, int8_t *out)
+{
+  const uint8x16_t flip = vdupq_n_u8(bits==8 ? 0x80 : 0);
+  int32_t i = 0;
+
+  if (frame_size == 1 || frame_size == 2 || frame_size == 4) {
+    for (; i + 16 <= count; i += 16) {
+      const unsigned char *p = raw + (size_t)i * frame_size;
+      uint8x16_t u;
+      int8x16_t v;
+
+      /* Structure loads split the frames; keep the last byte */
+      if (frame_size == 1)
+        u = vld1q_u8(p);
+      else if (frame_size == 2)
+        u = vld2q_u8(p).val[1];
+      else
+        u = vld4q_u8(p).val[3];
+      v = vreinterpretq_s8_u8(veorq_u8(u, flip));
+      if (phase)
+        v = vnegq_s8(v);
+      vst1q_s8(out + i, v);
+    }
+  }
+  convertScalar(raw + (size_t)i * frame_size, count - i, frame_size, bits, phase, out + i);
+}
+
+static int peakNeon(const int8_t *buffer, int32_t size)
+{
+  uint8x16_t top = vdupq_n_u8(0);
+  int maximum, rest;
+  int32_t i = 0;
+
+  /* vabs wraps -128 to 0x80, which is 128 as an unsigned byte */
+  for (; i + 16 <= size; i += 16)
+    top = vmaxq_u8(top, vreinterpretq_u8_s8(vabsq_s8(vld1q_s8(buffer + i))));
+  maximum = vmaxvq_u8(top);
+
+  rest = peakScalar(buffer + i, size - i);
+  return rest > maximum ? rest : maximum;
+}
+
+static void scaleNeon(int8_t *buffer, int32_t size, float factor)
+{
+  int32_t i = 0;
+
+  for (; i + 8 <= size; i += 8) {
+    int16x8_t x = vmovl_s8(vld1_s8(buffer + i));
+    int32x4_t lo = vcvtq_s32_f32(vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), factor));
+    int32x4_t hi = vcvtq_s32_f32(vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), factor));
+    vst1_s8(buffer + i, vqmovn_s16(vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi))));
+  }
+  scaleScalar(buffer + i, size - i, factor);
+}
+
+static int32_t findNeon(const int8_t *buffer, int32_t index, int32_t end, int lo, int hi)
+{
+  int8x16_t vlo, vhi;
+
+  if (!findInRange(&lo, &hi))
+    return findScalar(buffer, index, end, lo, hi);
+  vlo = vdupq_n_s8((int8_t)lo);
+  vhi = vdupq_n_s8((int8_t)hi);
+  for (; index + 16 <= end; index += 16) {
+    int8x16_t x = vld1q_s8(buffer + index);
+    if (vmaxvq_u8(vorrq_u8(vcgtq_s8(x, vhi), vcltq_s8(x, vlo))))
+      return findScalar(buffer, index, index + 16, lo, hi);
+  }
+  return findScalar(buffer, index, end, lo, hi);
+}
+
+static const SimdKernels simd_neon = {
+  "neon", convertNeon, envelopeInteger, peakNeon, scaleNeon, findNeon
+};
+
+#endif /* SIMD_NEON */
+
+/* Dispatch */
+
+static const char *const names[] = { "scalar", "sse2", "avx2", "avx512", "neon" };
+
+/* Set on first use or by simdSelect; threads may ask for the kernels at
+ * any time, so it is only read and written atomically */
+static const SimdKernels *selected = NULL;
+
+const SimdKernels *simdKernelsByName(const char *name)
+{
+  if (!strcmp(name, "scalar"))
+    return &simd_scalar;
+#ifdef SIMD_X86
+  __builtin_cpu_init();
+  if (!strcmp(name, "sse2") && __builtin_cpu_supports("sse2"))
+    return &simd_sse2;
+  if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2"))
+    return &simd_avx2;
+  if (!strcmp(name, "avx512") && __builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512bw"))
+    return &simd_avx512;
+#endif
+#ifdef SIMD_NEON
+  if (!strcmp(name, "neon"))
+    return &simd_neon;
+#endif
+  return NULL;
+}
+
+const SimdKernels *simdKernels(void)
+{
+  const SimdKernels *kernels = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+
+  if (kernels == NULL) {
+    const char *forced = getenv("CASTOOLS_SIMD");
+    const SimdKernels *best = NULL;
+
+    if (forced != NULL)
+      best = simdKernelsByName(forced);
+    /* Widest first */
+    for (int i = sizeof(names) / sizeof(names[0]) - 1; best == NULL && i >= 0; i--)
+      best = simdKernelsByName(names[i]);
+
+    /* Threads racing here pick the same table; a simdSelect meanwhile wins */
+    if (__atomic_compare_exchange_n(&selected, &kernels, best, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      kernels = best;
+  }
+  return kernels;
+}
+
+int simdSelect(const char *name)
+{
+  const SimdKernels *kernels = simdKernelsByName(name);
+
+  if (kernels == NULL)
+    return -1;
+  __atomic_store_n(&selected, kernels, __ATOMIC_RELEASE);
+  return 0;
+}
+
+const char *const *simdNames(int *count)
+{
+  *count = sizeof(names) / sizeof(names[0]);
+  return names;
+}
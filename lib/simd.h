@@ -0,0 +1,67 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Sample kernels of the encoder and decoder, one table per instruction set.
+ * Every table gives bit-identical results to the scalar reference. */
+typedef struct {
+  const char *name;     /* "scalar", "sse2", "avx2", "avx512", "neon" */
+
+  /* PCM frames to 8-bit signed mono (see convertSamples in wavlib.h) */
+  void (*convert)(const unsigned char *raw, int32_t count, int frame_size, int bits,
+                  bool phase, int8_t *out);
+
+  /* Weighted moving average (0.5, 1.0, 2.0) / 3.5, in place */
+  void (*envelope)(int8_t *buffer, int32_t size);
+
+  /* Largest absolute sample value */
+  int (*peak)(const int8_t *buffer, int32_t size);
+
+  /* buffer[i] *= factor, truncated; factor must be finite */
+  void (*scale)(int8_t *buffer, int32_t size, float factor);
+
+  /* First index from index below end with a sample outside lo..hi,
+   * or index itself once it reaches end */
+  int32_t (*find)(const int8_t *buffer, int32_t index, int32_t end, int lo, int hi);
+} SimdKernels;
+
+/* Scalar reference implementation */
+extern const SimdKernels simd_scalar;
+
+/**
+ * Return the kernels for this CPU, selected on first use: the widest
+ * supported of AVX-512, AVX2 and SSE2 on x86, NEON on AArch64, scalar
+ * otherwise. The CASTOOLS_SIMD environment variable forces a table by name.
+ *
+ * @return Selected kernel table
+ */
+const SimdKernels *simdKernels(void);
+
+/**
+ * Look up a kernel table by name.
+ *
+ * @param name Table name
+ * @return The table, or NULL if unknown or not supported by this CPU
+ */
+const SimdKernels *simdKernelsByName(const char *name);
+
+/**
+ * Force the table returned by simdKernels.
+ *
+ * @param name Table name
+ * @return 0 on success, -1 if unknown or not supported by this CPU
+ */
+int simdSelect(const char *name);
+
+/**
+ * List the names of all tables built in, supported or not.
+ *
+ * @param count Set to the number of names
+ * @return Array of names, the scalar reference first
+ */
+const char *const *simdNames(int *count);
+
+#endif /* SIMD_H */
@@ -0,0 +1,203 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         stats.c                                                  */
+/* description:  Per-stage timing and event counters (--stats)            */
+/*                                                                        */
+/**************************************************************************/
+
+#include "stats.h"
+#include "trace.h"
+#include "perfcount.h"
+#include <string.h>
+#include <time.h>
+
+bool stats_enabled = false;
+uint64_t stats_counters[COUNTER_COUNT];
+__thread uint64_t *stats_held;
+
+/* Stage totals of all threads, in nanoseconds */
+static uint64_t stage_wall[STAGE_COUNT];
+static uint64_t stage_cpu[STAGE_COUNT];
+static uint64_t stage_calls[STAGE_COUNT];
+static uint64_t stage_perf[STAGE_COUNT][PERF_EVENT_COUNT];
+static bool perf_enabled = false;
+
+/* Process clocks at statsStart */
+static uint64_t start_wall, start_cpu;
+
+/* Stage and clocks of the calling thread at its last switch */
+static __thread Stage current = STAGE_NONE;
+static __thread uint64_t last_wall, last_cpu;
+static __thread uint64_t last_perf[PERF_EVENT_COUNT];
+
+static const char *stage_names[STAGE_COUNT] = {
+  "none", "read", "convert", "header", "decode", "encode", "index", "write", "filter"
+};
+
+static const char *counter_names[COUNTER_COUNT] = {
+  "samples", "pulses", "backtrack_steps", "silence_checks", "headers",
+  "bytes_read", "bytes_decoded", "bytes_encoded", "write_calls", "files", "blocks",
+  "cache_hits", "cache_misses"
+};
+
+static uint64_t readClock(clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+StatsFormat statsFormat(const char *arg)
+{
+  if (!strcmp(arg, "--stats"))
+    return STATS_TEXT;
+  if (!strcmp(arg, "--stats=json"))
+    return STATS_JSON;
+  return STATS_OFF;
+}
+
+void statsStart(void)
+{
+  start_wall = readClock(CLOCK_MONOTONIC);
+  start_cpu = readClock(CLOCK_PROCESS_CPUTIME_ID);
+  stats_enabled = true;
+}
+
+int statsPerfCounters(void)
+{
+  int count = perfProbe();
+
+  perf_enabled = count > 0;
+  return count;
+}
+
+void statsHold(uint64_t held[COUNTER_COUNT])
+{
+  memset(held, 0, COUNTER_COUNT * sizeof(uint64_t));
+  stats_held = held;
+}
+
+void statsRelease(bool keep)
+{
+  uint64_t *held = stats_held;
+
+  stats_held = NULL;
+  if (keep)
+    for (int i = 0; i < COUNTER_COUNT; i++)
+      if (held[i])
+        __atomic_fetch_add(&stats_counters[i], held[i], __ATOMIC_RELAXED);
+}
+
+uint64_t statsCounter(Counter counter)
+{
+  return __atomic_load_n(&stats_counters[counter], __ATOMIC_RELAXED);
+}
+
+Stage statsEnter(Stage stage)
+{
+  Stage left = current;
+  uint64_t wall, cpu;
+
+  if ((!stats_enabled && !trace_enabled) || stage == current)
+    return left;
+
+  /* Stages also make up the stage track of a trace */
+  wall = readClock(CLOCK_MONOTONIC);
+  if (trace_enabled && current != STAGE_NONE)
+    traceStage(stage_names[current], last_wall, wall);
+
+  if (stats_enabled) {
+    cpu = readClock(CLOCK_THREAD_CPUTIME_ID);
+    if (current != STAGE_NONE) {
+      __atomic_fetch_add(&stage_wall[current], wall - last_wall, __ATOMIC_RELAXED);
+      __atomic_fetch_add(&stage_cpu[current], cpu - last_cpu, __ATOMIC_RELAXED);
+    }
+    if (stage != STAGE_NONE)
+      __atomic_fetch_add(&stage_calls[stage], 1, __ATOMIC_RELAXED);
+    last_cpu = cpu;
+  }
+
+  if (stats_enabled && perf_enabled) {
+    uint64_t perf[PERF_EVENT_COUNT];
+
+    perfRead(perf);
+    for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+      if (current != STAGE_NONE)
+        __atomic_fetch_add(&stage_perf[current][i], perf[i] - last_perf[i], __ATOMIC_RELAXED);
+      last_perf[i] = perf[i];
+    }
+  }
+
+  current = stage;
+  last_wall = wall;
+  return left;
+}
+
+void statsReport(FILE *out, StatsFormat format, const char *tool)
+{
+  double wall = (readClock(CLOCK_MONOTONIC) - start_wall) / 1e6;
+  double cpu = (readClock(CLOCK_PROCESS_CPUTIME_ID) - start_cpu) / 1e6;
+  int i;
+
+  if (format == STATS_JSON) {
+    fprintf(out, "{\"tool\":\"%s\",\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"stages\":{",
+            tool, wall, cpu);
+    for (i = STAGE_NONE + 1; i < STAGE_COUNT; i++) {
+      fprintf(out, "%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"calls\":%llu",
+              i > STAGE_NONE + 1 ? "," : "", stage_names[i],
+              stage_wall[i] / 1e6, stage_cpu[i] / 1e6, (unsigned long long)stage_calls[i]);
+      if (perf_enabled) {
+        /* Events the kernel could not count are null */
+        fprintf(out, ",\"perf\":{");
+        for (int e = 0; e < PERF_EVENT_COUNT; e++)
+          if (perfAvailable(e))
+            fprintf(out, "%s\"%s\":%llu", e ? "," : "", perfEventName(e),
+                    (unsigned long long)stage_perf[i][e]);
+          else
+            fprintf(out, "%s\"%s\":null", e ? "," : "", perfEventName(e));
+        fprintf(out, "}");
+      }
+      fprintf(out, "}");
+    }
+    fprintf(out, "},\"counters\":{");
+    for (i = 0; i < COUNTER_COUNT; i++)
+      fprintf(out, "%s\"%s\":%llu", i ? "," : "", counter_names[i],
+              (unsigned long long)stats_counters[i]);
+    fprintf(out, "}}\n");
+    return;
+  }
+
+  /* Text: stages and counters that saw any activity */
+  fprintf(out, "%s stats: %.3f ms wall, %.3f ms cpu\n", tool, wall, cpu);
+  fprintf(out, "  %-16s %12s %12s %10s\n", "stage", "wall ms", "cpu ms", "calls");
+  for (i = STAGE_NONE + 1; i < STAGE_COUNT; i++)
+    if (stage_calls[i])
+      fprintf(out, "  %-16s %12.3f %12.3f %10llu\n", stage_names[i],
+              stage_wall[i] / 1e6, stage_cpu[i] / 1e6, (unsigned long long)stage_calls[i]);
+  for (i = 0; i < COUNTER_COUNT; i++)
+    if (stats_counters[i])
+      fprintf(out, "  %-16s %12llu\n", counter_names[i], (unsigned long long)stats_counters[i]);
+  if (!perf_enabled)
+    return;
+
+  /* Hardware events per stage, n/a where the kernel could not count them */
+  fprintf(out, "  %-16s", "stage");
+  for (int e = 0; e < PERF_EVENT_COUNT; e++)
+    fprintf(out, " %14s", perfEventName(e));
+  fprintf(out, " %6s\n", "ipc");
+  for (i = STAGE_NONE + 1; i < STAGE_COUNT; i++) {
+    if (!stage_calls[i])
+      continue;
+    fprintf(out, "  %-16s", stage_names[i]);
+    for (int e = 0; e < PERF_EVENT_COUNT; e++)
+      if (perfAvailable(e))
+        fprintf(out, " %14llu", (unsigned long long)stage_perf[i][e]);
+      else
+        fprintf(out, " %14s", "n/a");
+    if (perfAvailable(PERF_CYCLES) && perfAvailable(PERF_INSTRUCTIONS) && stage_perf[i][PERF_CYCLES])
+      fprintf(out, " %6.2f\n", (double)stage_perf[i][PERF_INSTRUCTIONS] / stage_perf[i][PERF_CYCLES]);
+    else
+      fprintf(out, " %6s\n", "n/a");
+  }
+}
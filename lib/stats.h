@@ -0,0 +1,135 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Pipeline stages timed by --stats; a thread is in one stage at a time.
+ * New stages are appended to keep the values of the 1.1 library API. */
+typedef enum {
+  STAGE_NONE,         /* Not timed */
+  STAGE_READ,         /* Reading input files */
+  STAGE_CONVERT,      /* PCM sample conversion */
+  STAGE_HEADER,       /* Silence and sync header detection (pulse extraction) */
+  STAGE_DECODE,       /* Byte decoding (pulse extraction) */
+  STAGE_ENCODE,       /* Waveform emission */
+  STAGE_INDEX,        /* Block index, hashes and structure checks */
+  STAGE_WRITE,        /* Writing output */
+  STAGE_FILTER,       /* Normalize and envelope correction */
+  STAGE_COUNT
+} Stage;
+
+/* Event counters */
+typedef enum {
+  COUNT_SAMPLES,        /* Samples read (decoder) or written (encoder) */
+  COUNT_PULSES,         /* getPulseWidth calls */
+  COUNT_BACKTRACK,      /* getPulseWidth steps back to the mid-level crossing */
+  COUNT_SILENCE,        /* isSilence calls */
+  COUNT_HEADERS,        /* Sync headers detected */
+  COUNT_BYTES_READ,     /* Input file bytes */
+  COUNT_BYTES_DECODED,  /* CAS bytes decoded */
+  COUNT_BYTES_ENCODED,  /* CAS bytes encoded */
+  COUNT_WRITES,         /* Output write calls */
+  COUNT_FILES,          /* Input files */
+  COUNT_BLOCKS,         /* CAS blocks indexed */
+  COUNT_CACHE_HITS,     /* Outputs served from the cas2wav --cache */
+  COUNT_CACHE_MISSES,   /* Outputs encoded into the cache */
+  COUNTER_COUNT
+} Counter;
+
+/* --stats output */
+typedef enum {
+  STATS_OFF,
+  STATS_TEXT,
+  STATS_JSON
+} StatsFormat;
+
+/* Set by statsStart; everything below is a no-op while false */
+extern bool stats_enabled;
+
+/* Counter totals, for STATS_ADD only: the shared library does not export
+ * the array, whose size grows with Counter (read it with statsCounter) */
+extern uint64_t stats_counters[COUNTER_COUNT];
+
+/* Counts of the calling thread held back by statsHold, NULL if none */
+extern __thread uint64_t *stats_held;
+
+/* Add n to a counter (thread safe) */
+#define STATS_ADD(counter,n) \
+  do { \
+    if (__builtin_expect(stats_enabled, 0)) { \
+      if (stats_held) stats_held[counter] += (n); \
+      else __atomic_fetch_add(&stats_counters[counter], (uint64_t)(n), __ATOMIC_RELAXED); \
+    } \
+  } while (0)
+
+/**
+ * Parse a --stats option.
+ *
+ * @param arg Command-line argument
+ * @return STATS_TEXT for "--stats", STATS_JSON for "--stats=json",
+ *         STATS_OFF if arg is not a --stats option
+ */
+StatsFormat statsFormat(const char *arg);
+
+/**
+ * Enable counting and timing, and start the total wall and CPU clocks.
+ */
+void statsStart(void);
+
+/**
+ * Also count hardware events per stage (--perf-counters); call after
+ * statsStart. Every thread opens its own counters on its first switch.
+ *
+ * @return Number of events available (see perfProbe), 0 if none
+ *         (errno is set)
+ */
+int statsPerfCounters(void);
+
+/**
+ * Hold back the counts of the calling thread until statsRelease, for work
+ * that may be thrown away and done again.
+ *
+ * @param held Array for the counts, cleared here
+ */
+void statsHold(uint64_t held[COUNTER_COUNT]);
+
+/**
+ * End statsHold: add the counts held back to the totals, or drop them.
+ *
+ * @param keep Add the counts
+ */
+void statsRelease(bool keep);
+
+/**
+ * Read a counter total.
+ *
+ * @param counter Counter
+ * @return Events counted so far by all threads (held counts excluded)
+ */
+uint64_t statsCounter(Counter counter);
+
+/**
+ * Switch the calling thread to a stage: the wall and CPU time since its
+ * previous switch is charged to the stage it leaves, and the stage left
+ * is recorded on the thread's stage track when tracing. Return to the
+ * previous stage by passing the returned value back.
+ *
+ * @param stage Stage entered
+ * @return Stage left
+ */
+Stage statsEnter(Stage stage);
+
+/**
+ * Print the time per stage, the counters and the hardware events per
+ * stage if counted.
+ * Threads still in a stage are charged up to their last switch only.
+ *
+ * @param out    Output stream
+ * @param format STATS_TEXT (table) or STATS_JSON (one line)
+ * @param tool   Program name for the report
+ */
+void statsReport(FILE *out, StatsFormat format, const char *tool);
+
+#endif /* STATS_H */
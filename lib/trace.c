@@ -0,0 +1,220 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         trace.c                                                  */
+/* description:  Chrome trace-event recording with per-thread buffers     */
+/*                                                                        */
+/**************************************************************************/
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Events per buffer chunk */
+#define TRACE_CHUNK  4096
+
+typedef struct {
+  const char *cat;
+  const char *name;
+  const char *detail;
+  uint64_t start;
+  uint64_t end;
+} TraceEvent;
+
+/* Buffer of one thread; a thread links a new chunk when one fills up */
+typedef struct TraceChunk {
+  struct TraceChunk *next;     /* All chunks of all threads */
+  int track;                   /* Span track of the owning thread */
+  size_t count;
+  TraceEvent events[TRACE_CHUNK];
+} TraceChunk;
+
+/* Thread names, for the track metadata */
+typedef struct TraceName {
+  struct TraceName *next;
+  int track;
+  char *name;
+} TraceName;
+
+bool trace_enabled = false;
+
+static FILE *trace_file;
+static uint64_t trace_origin;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceChunk *chunks;
+static TraceName *names;
+static int tracks;
+
+/* Buffer and track of the calling thread; the stage track is track + 1 */
+static __thread TraceChunk *chunk;
+static __thread int track = -1;
+
+static uint64_t now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* Track of the calling thread, assigned on first use */
+static int threadTrack(void)
+{
+  if (track < 0)
+    track = __atomic_fetch_add(&tracks, 2, __ATOMIC_RELAXED);
+  return track;
+}
+
+/* Append an event to the calling thread's buffer */
+static void record(const char *cat, const char *name, const char *detail,
+                   uint64_t start, uint64_t end)
+{
+  TraceEvent *event;
+
+  if (chunk == NULL || chunk->count == TRACE_CHUNK) {
+    TraceChunk *fresh = (TraceChunk*)malloc(sizeof(TraceChunk));
+
+    /* Out of memory: drop events rather than disturb the run */
+    if (fresh == NULL)
+      return;
+    fresh->track = threadTrack();
+    fresh->count = 0;
+    pthread_mutex_lock(&trace_lock);
+    fresh->next = chunks;
+    chunks = fresh;
+    pthread_mutex_unlock(&trace_lock);
+    chunk = fresh;
+  }
+
+  event = &chunk->events[chunk->count++];
+  event->cat = cat;
+  event->name = name;
+  event->detail = detail;
+  event->start = start;
+  event->end = end;
+}
+
+int traceOpen(const char *filename)
+{
+  if ((trace_file = fopen(filename, "w")) == NULL)
+    return -1;
+  trace_origin = now();
+  trace_enabled = true;
+  traceThread("main");
+  return 0;
+}
+
+void traceThread(const char *name)
+{
+  TraceName *entry;
+
+  if (!trace_enabled || (entry = (TraceName*)malloc(sizeof(TraceName))) == NULL)
+    return;
+  entry->track = threadTrack();
+  entry->name = strdup(name);
+  pthread_mutex_lock(&trace_lock);
+  entry->next = names;
+  names = entry;
+  pthread_mutex_unlock(&trace_lock);
+}
+
+uint64_t traceStart(void)
+{
+  return trace_enabled ? now() : 0;
+}
+
+void traceSpan(const char *cat, const char *name, const char *detail, uint64_t start)
+{
+  if (trace_enabled)
+    record(cat, name, detail, start, now());
+}
+
+void traceStage(const char *name, uint64_t start, uint64_t end)
+{
+  if (trace_enabled)
+    record(NULL, name, NULL, start, end);
+}
+
+/* Print a string as a JSON string literal, with an optional suffix */
+static void printString(const char *s, const char *suffix)
+{
+  fputc('"', trace_file);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(trace_file, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      fprintf(trace_file, "\\u%04x", *s);
+    else
+      fputc(*s, trace_file);
+  }
+  fprintf(trace_file, "%s\"", suffix);
+}
+
+/* Microseconds since traceOpen */
+static double micros(uint64_t ns)
+{
+  return ns > trace_origin ? (ns - trace_origin) / 1e3 : 0;
+}
+
+int traceClose(void)
+{
+  bool first = true;
+  int failed;
+
+  if (!trace_enabled)
+    return 0;
+  trace_enabled = false;
+
+  fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+  /* Track names: spans on the thread's track, stages just below it */
+  while (names != NULL) {
+    TraceName *entry = names;
+
+    for (int stages = 0; stages < 2; stages++) {
+      fprintf(trace_file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,"
+              "\"args\":{\"name\":", first ? "" : ",\n", entry->track + stages);
+      printString(entry->name ? entry->name : "thread", stages ? " stages" : "");
+      fprintf(trace_file, "}},\n{\"ph\":\"M\",\"name\":\"thread_sort_index\",\"pid\":1,"
+              "\"tid\":%d,\"args\":{\"sort_index\":%d}}",
+              entry->track + stages, entry->track + stages);
+      first = false;
+    }
+    names = entry->next;
+    free(entry->name);
+    free(entry);
+  }
+
+  while (chunks != NULL) {
+    TraceChunk *done = chunks;
+
+    for (size_t i = 0; i < done->count; i++) {
+      const TraceEvent *event = &done->events[i];
+
+      fprintf(trace_file, "%s{\"ph\":\"X\",\"cat\":\"%s\",\"name\":",
+              first ? "" : ",\n", event->cat ? event->cat : "stage");
+      printString(event->name, "");
+      fprintf(trace_file, ",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+              done->track + (event->cat == NULL), micros(event->start),
+              (event->end - event->start) / 1e3);
+      if (event->detail != NULL) {
+        fprintf(trace_file, ",\"args\":{\"detail\":");
+        printString(event->detail, "");
+        fputc('}', trace_file);
+      }
+      fputc('}', trace_file);
+      first = false;
+    }
+    chunks = done->next;
+    free(done);
+  }
+  chunk = NULL;
+
+  fprintf(trace_file, "\n]}\n");
+  failed = ferror(trace_file);
+  failed |= fclose(trace_file);
+  trace_file = NULL;
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Set by traceOpen; every call below is a no-op while false */
+extern bool trace_enabled;
+
+/**
+ * Start recording spans for a Chrome trace-event file (loadable in
+ * chrome://tracing or Perfetto). Events are kept in per-thread buffers
+ * and written by traceClose.
+ *
+ * @param filename Trace file to create
+ * @return 0 on success, -1 if the file cannot be created
+ */
+int traceOpen(const char *filename);
+
+/**
+ * Write all recorded events to the trace file and stop recording.
+ * Call after every traced thread has finished.
+ *
+ * @return 0 on success, -1 on a write error
+ */
+int traceClose(void);
+
+/**
+ * Name the tracks of the calling thread ("main", "worker"...).
+ * Each thread gets a span track and a stage track below it.
+ *
+ * @param name Thread name (copied)
+ */
+void traceThread(const char *name);
+
+/**
+ * Return the current time, to pass to traceSpan when the span ends.
+ *
+ * @return Timestamp in nanoseconds, 0 while not recording
+ */
+uint64_t traceStart(void);
+
+/**
+ * Record a span of the calling thread, from start to now.
+ * Spans of one thread must nest (a span ending after an enclosing one
+ * started inside it is drawn incorrectly).
+ *
+ * @param cat    Category ("file", "block", "wait"...), static string
+ * @param name   Span name, static or valid until traceClose
+ * @param detail Shown with the span (a file name...), valid until
+ *               traceClose, or NULL
+ * @param start  Value returned by traceStart
+ */
+void traceSpan(const char *cat, const char *name, const char *detail, uint64_t start);
+
+/**
+ * Record a pipeline stage of the calling thread on its stage track
+ * (called by statsEnter on every stage switch).
+ *
+ * @param name  Stage name, static string
+ * @param start Start time in nanoseconds
+ * @param end   End time in nanoseconds
+ */
+void traceStage(const char *name, uint64_t start, uint64_t end);
+
+#endif /* TRACE_H */
@@ -0,0 +1,287 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         wavcache.c                                               */
+/* description:  Content-addressed cache of cas2wav output files          */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "wavcache.h"
+#include "cashash.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <dirent.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#endif
+
+/* Temporary files older than this were left by a crashed encode */
+#define STALE_SECONDS  86400
+
+/* One entry seen while evicting */
+typedef struct {
+  char name[WAVCACHE_KEY_SIZE + 4];
+  uint64_t size;
+  struct timespec used;
+} CacheEntry;
+
+static const char *method_names[] = { "reflink", "copy" };
+
+
+void cacheKey(const unsigned char *data, size_t size, const uint32_t *params, int count,
+              char key[WAVCACHE_KEY_SIZE])
+{
+  unsigned char tail[4 * 16 + 4];
+  uint64_t half[2];
+  size_t length = 0;
+
+  /* Parameters and version as little-endian words after the data */
+  for (int i = 0; i < count && i < 16; i++)
+    for (int b = 0; b < 4; b++)
+      tail[length++] = params[i] >> (8 * b);
+  for (int b = 0; b < 4; b++)
+    tail[length++] = (uint32_t)WAVCACHE_VERSION >> (8 * b);
+
+  /* Two seeds give 128 bits: no collisions in practice */
+  for (int h = 0; h < 2; h++) {
+    HashState state;
+
+    hashInit(&state, h ? 0x9e3779b97f4a7c15ULL : 0);
+    hashUpdate(&state, data, size);
+    hashUpdate(&state, tail, length);
+    half[h] = hashFinal(&state);
+  }
+  snprintf(key, WAVCACHE_KEY_SIZE, "%016llx%016llx",
+           (unsigned long long)half[0], (unsigned long long)half[1]);
+}
+
+const char *cacheMethodName(int method)
+{
+  return method >= CACHE_REFLINK && method <= CACHE_COPY ? method_names[method] : "none";
+}
+
+#ifndef _WIN32
+
+/* Copy from one descriptor to another */
+static int copyData(int in, int out)
+{
+  char buffer[65536];
+  ssize_t n;
+
+  while ((n = read(in, buffer, sizeof(buffer))) != 0) {
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    for (ssize_t done = 0; done < n; ) {
+      ssize_t w = write(out, buffer + done, n - done);
+      if (w < 0 && errno != EINTR)
+        return -1;
+      if (w > 0)
+        done += w;
+    }
+  }
+  return 0;
+}
+
+/* Make output a copy of file: reflink, else copy. The output never shares
+ * the entry's inode, so touching or evicting the entry does not change it.
+ * It is opened the way an uncached encode opens it (fopen "wb"): a
+ * symlink is written through, a read-only file is refused, and a pipe or
+ * a device gets a copy */
+static int linkOutput(const char *file, const char *output)
+{
+  int in, out, saved;
+
+  if ((in = open(file, O_RDONLY)) < 0)
+    return -1;
+  if ((out = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+    goto failed;
+#ifdef FICLONE
+  if (ioctl(out, FICLONE, in) == 0) {
+    close(in);
+    return close(out) < 0 ? -1 : CACHE_REFLINK;
+  }
+#endif
+  if (copyData(in, out) < 0) {
+    saved = errno;
+    close(out);
+    errno = saved;
+    goto failed;
+  }
+  close(in);
+  return close(out) < 0 ? -1 : CACHE_COPY;
+
+failed:
+  saved = errno;
+  close(in);
+  errno = saved;
+  return -1;
+}
+
+static bool isEntryName(const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < WAVCACHE_KEY_SIZE - 1; i++)
+    if (!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f')))
+      return false;
+  return !strcmp(name + i, ".wav");
+}
+
+static int compareUse(const void *a, const void *b)
+{
+  const struct timespec *x = &((const CacheEntry *)a)->used;
+  const struct timespec *y = &((const CacheEntry *)b)->used;
+
+  if (x->tv_sec != y->tv_sec)
+    return x->tv_sec < y->tv_sec ? -1 : 1;
+  return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/* Remove least recently used entries (oldest mtime: hits touch it) until
+ * the cache fits the limit; the entry just stored is kept */
+static void evict(const char *dir, const char *keep, uint64_t limit)
+{
+  CacheEntry *entries = NULL;
+  size_t count = 0, capacity = 0;
+  uint64_t total = 0;
+  struct dirent *de;
+  DIR *d;
+
+  if ((d = opendir(dir)) == NULL)
+    return;
+  while ((de = readdir(d)) != NULL) {
+    struct stat st;
+
+    if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 || !S_ISREG(st.st_mode))
+      continue;
+    if (!strncmp(de->d_name, ".tmp-", 5)) {
+      if (st.st_mtime < time(NULL) - STALE_SECONDS)
+        unlinkat(dirfd(d), de->d_name, 0);
+      continue;
+    }
+    if (!isEntryName(de->d_name))
+      continue;
+
+    total += st.st_size;
+    if (!strncmp(de->d_name, keep, WAVCACHE_KEY_SIZE - 1))
+      continue;
+    if (count == capacity) {
+      CacheEntry *grown = realloc(entries, (capacity = capacity ? capacity * 2 : 256) *
+                                  sizeof(CacheEntry));
+      if (grown == NULL)
+        break;
+      entries = grown;
+    }
+    strcpy(entries[count].name, de->d_name);
+    entries[count].size = st.st_size;
+#if defined(__APPLE__)
+    entries[count].used = st.st_mtimespec;
+#else
+    entries[count].used = st.st_mtim;
+#endif
+    count++;
+  }
+
+  qsort(entries, count, sizeof(CacheEntry), compareUse);
+  for (size_t i = 0; i < count && total > limit; i++)
+    if (unlinkat(dirfd(d), entries[i].name, 0) == 0 || errno == ENOENT)
+      total -= entries[i].size;
+  closedir(d);
+  free(entries);
+}
+
+int cacheFetch(const char *dir, const char *key, uint64_t expected, const char *output)
+{
+  char path[WAVCACHE_PATH_SIZE];
+  struct stat st;
+  int method;
+
+  snprintf(path, sizeof(path), "%s/%s.wav", dir, key);
+  if (stat(path, &st) < 0)
+    return -1;
+  if ((uint64_t)st.st_size != expected) {
+    unlink(path);
+    errno = ENOENT;
+    return -1;
+  }
+
+  if ((method = linkOutput(path, output)) >= 0)
+    utimensat(AT_FDCWD, path, NULL, 0);
+  return method;
+}
+
+FILE *cacheCreate(const char *dir, char path[WAVCACHE_PATH_SIZE])
+{
+  FILE *file;
+  int fd;
+
+  if (mkdir(dir, 0777) < 0 && errno != EEXIST)
+    return NULL;
+  snprintf(path, WAVCACHE_PATH_SIZE, "%s/.tmp-XXXXXX", dir);
+  if ((fd = mkstemp(path)) < 0)
+    return NULL;
+
+  /* Entries are never written once published */
+  fchmod(fd, 0444);
+  if ((file = fdopen(fd, "wb")) == NULL) {
+    close(fd);
+    unlink(path);
+  }
+  return file;
+}
+
+int cacheCommit(const char *dir, const char *key, const char *path, const char *output,
+                uint64_t limit)
+{
+  char entry[WAVCACHE_PATH_SIZE];
+  int method;
+
+  if ((method = linkOutput(path, output)) < 0) {
+    int saved = errno;
+    unlink(path);
+    errno = saved;
+    return -1;
+  }
+
+  /* Publishing is atomic; losing it only costs a future hit */
+  snprintf(entry, sizeof(entry), "%s/%s.wav", dir, key);
+  if (rename(path, entry) < 0)
+    unlink(path);
+  evict(dir, key, limit);
+  return method;
+}
+
+#else
+
+int cacheFetch(const char *dir, const char *key, uint64_t expected, const char *output)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+FILE *cacheCreate(const char *dir, char path[WAVCACHE_PATH_SIZE])
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+int cacheCommit(const char *dir, const char *key, const char *path, const char *output,
+                uint64_t limit)
+{
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif
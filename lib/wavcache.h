@@ -0,0 +1,87 @@
+#ifndef WAVCACHE_H
+#define WAVCACHE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Cache entry format version; part of every key, so bump it whenever the
+ * encoder output for the same input and parameters changes */
+#define WAVCACHE_VERSION  1
+
+/* Hex key and entry paths */
+#define WAVCACHE_KEY_SIZE   33
+#define WAVCACHE_PATH_SIZE  4096
+
+/* Default size limit (--cache-size) */
+#define WAVCACHE_DEFAULT_LIMIT  (1024ULL << 20)
+
+/* How an entry reached the output file */
+typedef enum {
+  CACHE_REFLINK,    /* Shared extents, copy-on-write (btrfs, XFS...) */
+  CACHE_COPY        /* Plain copy */
+} CacheMethod;
+
+/**
+ * Compute the cache key of an encode: a 128-bit hash, in hex, of the
+ * input bytes, the encoding parameters and WAVCACHE_VERSION.
+ *
+ * @param data   Input file contents
+ * @param size   Input size in bytes
+ * @param params Every parameter that affects the output
+ * @param count  Number of parameters
+ * @param key    Set to the NUL-terminated key
+ */
+void cacheKey(const unsigned char *data, size_t size, const uint32_t *params, int count,
+              char key[WAVCACHE_KEY_SIZE]);
+
+/**
+ * Serve a cached entry as the output file, by reflink or else by copy, so
+ * the output is a file of its own. The output is opened as an uncached
+ * encode opens it: an existing file is overwritten, a symlink written
+ * through. A hit makes the entry the most recently used. Entries whose
+ * size differs from the expected one were damaged and are dropped.
+ *
+ * @param dir      Cache directory
+ * @param key      Entry key (see cacheKey)
+ * @param expected Size the entry must have in bytes
+ * @param output   Output file path
+ * @return CacheMethod used, -1 on a miss or if the output could not be
+ *         written (errno is set)
+ */
+int cacheFetch(const char *dir, const char *key, uint64_t expected, const char *output);
+
+/**
+ * Create a temporary file in the cache directory (created if missing) to
+ * encode a new entry into.
+ *
+ * @param dir  Cache directory
+ * @param path Set to the path of the temporary file
+ * @return Stream open for writing and seeking, NULL on error (errno is set)
+ */
+FILE *cacheCreate(const char *dir, char path[WAVCACHE_PATH_SIZE]);
+
+/**
+ * Serve a finished temporary file (closed) as the output, publish it as
+ * the entry for key and evict least recently used entries until the cache
+ * holds at most limit bytes. The temporary file is removed on error.
+ *
+ * @param dir    Cache directory
+ * @param key    Entry key
+ * @param path   Temporary file from cacheCreate
+ * @param output Output file path
+ * @param limit  Cache size limit in bytes
+ * @return CacheMethod used for the output, -1 on error (errno is set)
+ */
+int cacheCommit(const char *dir, const char *key, const char *path, const char *output,
+                uint64_t limit);
+
+/**
+ * Name of a CacheMethod, for messages.
+ *
+ * @param method CacheMethod value
+ * @return Static string
+ */
+const char *cacheMethodName(int method);
+
+#endif /* WAVCACHE_H */
@@ -0,0 +1,651 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         wavlib.c                                                 */
+/* description:  Library for MSX WAV to CAS conversion                    */
+/*               Signal processing and FSK decoding kernels of wav2cas    */
+/*                                                                        */
+/**************************************************************************/
+
+#include "wavlib.h"
+#include "caslib.h"
+#include "simd.h"
+#include "stats.h"
+#include "trace.h"
+#include "ring.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Sample frames read from the WAV file at a time */
+#define READ_FRAMES  16384
+
+/* PCM chunks in flight between the read and convert stages */
+#define RING_SLOTS   8
+
+/* Set by the kernels when they ran into the end of the samples they were
+ * given: their result may then change once more samples are known */
+static __thread bool reached_end;
+
+/* Read count frames of PCM data; a truncated data chunk reads as silence */
+static void readChunk(FILE *wav_file, const TapeFormat *format, unsigned char *raw,
+                      int32_t count)
+{
+  size_t want = (size_t)count*format->frame_size;
+  size_t got = fread(raw,1,want,wav_file);
+
+  if (got<want)
+    memset(raw+got,format->bits==8 ? 0x80 : 0x00,want-got);
+}
+
+/* Frames in the chunk of the data that starts at frame i */
+static int32_t chunkFrames(const TapeFormat *format, int32_t i)
+{
+  return format->samples-i < READ_FRAMES ? format->samples-i : READ_FRAMES;
+}
+
+/* Read audio samples in chunks and convert to 8-bit signed mono, all on
+ * the calling thread; each chunk is published on converted if given */
+static void readSamples(const Decoder *dec, FILE *wav_file, const TapeFormat *format,
+                        unsigned char *raw, int8_t *buffer, Mark *converted)
+{
+  Stage stage;
+  int32_t i;
+
+  stage=statsEnter(STAGE_READ);
+  for (i=0;i<format->samples;i+=READ_FRAMES) {
+    int32_t count = chunkFrames(format,i);
+
+    readChunk(wav_file,format,raw,count);
+    statsEnter(STAGE_CONVERT);
+    convertSamples(raw,count,format->frame_size,format->bits,dec->phase,buffer+i);
+    if (converted) markPublish(converted,i+count);
+    statsEnter(STAGE_READ);
+  }
+  statsEnter(stage);
+}
+
+int tapeReadHeader(FILE *wav_file, const char *name, TapeFormat *format, FILE *log)
+{
+  /* Note: Using only RIFF header fields, not including data chunk */
+  struct {
+    char     RiffID[4];
+    uint32_t RiffSize;
+    char     WaveID[4];
+    char     FmtID[4];
+    uint32_t FmtSize;
+    uint16_t wFormatTag;
+    uint16_t nChannels;
+    uint32_t nSamplesPerSec;
+    uint32_t nAvgBytesPerSec;
+    uint16_t nBlockAlign;
+    uint16_t wBitsPerSample;
+  } header;
+  WAVE_BLOCK  block;
+  int  adder;
+  int32_t pos;
+  bool found;
+
+  if (fread(&header,sizeof(header),1,wav_file)!=1) return TAPE_ERROR_IO;
+
+  /* Calculate bytes per sample frame (channels × bytes/sample) */
+  adder=header.nChannels*(header.wBitsPerSample/8);
+  if (adder==0) return TAPE_ERROR_FORMAT;
+
+  /* Search for "data" chunk (may not be at fixed position in some WAV files) */
+  found = false;
+  pos = ftell(wav_file);
+  while(fread(&block,sizeof(block),1,wav_file))
+    if (!strncmp(block.DataID,"data",4)) {
+      found = true;
+      break;
+    } else {
+      fseek(wav_file,pos++,SEEK_SET);
+    }
+
+  /* Basic error handling */
+  if (!found) return TAPE_ERROR_FORMAT;
+
+  format->frequency=header.nSamplesPerSec;
+  format->samples=block.nDataBytes/adder;
+  format->frame_size=adder;
+  format->bits=header.wBitsPerSample;
+  format->channels=header.nChannels;
+
+  /* Show wav info */
+  if (log) fprintf(log,"Reading %s (%d Hz, %d-bits, %s)...\n",
+	 name,
+	 (int)header.nSamplesPerSec,
+	 (int)header.wBitsPerSample,
+	 header.nChannels==1 ? "mono" : "stereo" );
+
+  STATS_ADD(COUNT_FILES,1);
+  STATS_ADD(COUNT_SAMPLES,format->samples);
+  STATS_ADD(COUNT_BYTES_READ,(uint64_t)format->samples*adder);
+  return format->frequency;
+}
+
+/* tapeReadStream and tapeReadArena: buffers come from the arena if given */
+static int readTape(const Decoder *dec, FILE *wav_file, const char *name, Arena *arena,
+                    int8_t **buffer, int32_t *size, FILE *log)
+{
+  TapeFormat format;
+  unsigned char *raw;
+  int frequency;
+
+  *buffer = NULL;
+  if ((frequency=tapeReadHeader(wav_file,name,&format,log))<0) return frequency;
+
+  *size=format.samples;
+  *buffer=(int8_t*)(arena ? arenaAlloc(arena,*size) : malloc(*size*sizeof(int8_t)));
+  raw=(unsigned char*)(arena ? arenaAlloc(arena,(size_t)READ_FRAMES*format.frame_size)
+                            : malloc((size_t)READ_FRAMES*format.frame_size));
+  if (*buffer==NULL || raw==NULL) {
+    if (!arena) { free(*buffer); free(raw); }
+    return TAPE_ERROR_MEMORY;
+  }
+
+  readSamples(dec,wav_file,&format,raw,*buffer,NULL);
+
+  if (!arena) free(raw);
+  return frequency;
+}
+
+int tapeReadStream(const Decoder *dec, FILE *wav_file, const char *name, int8_t **buffer,
+                   int32_t *size, FILE *log)
+{
+  return readTape(dec,wav_file,name,NULL,buffer,size,log);
+}
+
+int tapeReadArena(const Decoder *dec, FILE *wav_file, const char *name, Arena *arena,
+                  int8_t **buffer, int32_t *size, FILE *log)
+{
+  return readTape(dec,wav_file,name,arena,buffer,size,log);
+}
+
+int tapeRead(const Decoder *dec, const char *filename, int8_t **buffer, int32_t *size,
+             FILE *log)
+{
+  FILE *wav_file;
+  int frequency;
+
+  if ((wav_file=fopen(filename,"rb"))==NULL) return TAPE_ERROR_IO;
+  frequency=tapeReadStream(dec,wav_file,filename,buffer,size,log);
+  fclose(wav_file);
+  return frequency;
+}
+
+void convertSamples(const unsigned char *raw, int32_t count, int frame_size, int bits,
+                    bool phase, int8_t *out)
+{
+  simdKernels()->convert(raw,count,frame_size,bits,phase,out);
+}
+
+/* Apply envelope correction using weighted moving average to reduce noise */
+void correctEnvelope(int8_t *buffer, int32_t size)
+{
+  simdKernels()->envelope(buffer,size);
+}
+
+/* Normalize amplitude to maximize signal level (scale to ±127) */
+void normalizeAmplitude(int8_t *buffer, int32_t size)
+{
+  const SimdKernels *k = simdKernels();
+  int maximum = k->peak(buffer,size);
+
+  /* All-zero signal: nothing to scale */
+  if (maximum==0) return;
+  k->scale(buffer,size,127/(float)maximum);
+}
+
+/* Check if audio is silent starting at index (below threshold for THRESHOLD_SILENCE samples) */
+bool isSilence(const Decoder *dec, const int8_t *buffer, int32_t index, int32_t size)
+{
+  int32_t end = size-index > THRESHOLD_SILENCE ? index+THRESHOLD_SILENCE : size;
+
+  if (end==size) reached_end=true;
+  STATS_ADD(COUNT_SILENCE,1);
+  return simdKernels()->find(buffer,index,end,1-dec->threshold,dec->threshold-1) >= end;
+}
+
+/* Advance index past silent samples (below threshold) */
+void skipSilence(const Decoder *dec, const int8_t *buffer, int32_t *index, int32_t size)
+{
+  *index = simdKernels()->find(buffer,*index,size,-dec->threshold,dec->threshold);
+  if (*index>=size) reached_end=true;
+}
+
+/* Measure pulse width in samples by detecting zero-crossing */
+int32_t getPulseWidth(const Decoder *dec, const int8_t *buffer, int32_t *index, int32_t size)
+{
+  int min = 1000;   /* Track minimum amplitude */
+  int max =-1000;   /* Track maximum amplitude */
+  int pt  = max;    /* Peak tracking */
+
+  int prev = *index > 0 ? buffer[(*index)-1] : 0;
+
+  int32_t width = 0;
+
+  STATS_ADD(COUNT_PULSES,1);
+  for(;*index<size;width++) {
+
+    /* Signal ascending */
+    if (buffer[*index]>prev) {
+
+      if (prev==min) {
+
+	if (pt-min>=dec->threshold) {
+	  int32_t measured = width;
+
+	  /* Step back to where the signal crossed the mid level */
+	  while(width>1) {
+
+	    if (buffer[*index]>=pt-(pt-min)/2) break;
+	    width--; (*index)--;
+	  }
+
+	  STATS_ADD(COUNT_BACKTRACK,measured-width);
+	  return width;
+	}
+
+	min=1000;
+      }
+
+      if (buffer[*index]>max) max=buffer[*index];
+    }
+
+    /* Signal descending */
+    if (buffer[*index]<prev) {
+
+      if (prev==max) {
+
+	if (max>pt) pt=max;
+	max=-1000;
+      }
+
+      if (buffer[*index]<min) min=buffer[*index];
+    }
+
+    prev=buffer[(*index)++];
+  }
+
+  reached_end=true;
+  return width;
+}
+
+/* Detect sync header by finding THRESHOLD_HEADER pulses of similar width */
+bool isHeader(const Decoder *dec, const int8_t *buffer, int32_t index, int32_t size)
+{
+
+  int32_t width;
+  int32_t pulses  = 0;
+  int32_t biggest = 0;
+
+  /* skip first pulse for phase independance */
+  getPulseWidth(dec,buffer,&index,size);
+
+  while (index<size && pulses<THRESHOLD_HEADER ) {
+
+    width = getPulseWidth(dec,buffer,&index,size);
+    if (!biggest) biggest=width;
+    if (width>(float)biggest*dec->window) return false;
+    if (width>biggest) biggest = width;
+    pulses++;
+  }
+
+  if (pulses>=THRESHOLD_HEADER) return true;
+
+  return false;
+}
+
+/* Skip sync header and return average pulse width (for bit detection) */
+float skipHeader(const Decoder *dec, const int8_t *buffer, int32_t *index, int32_t size)
+{
+
+  int32_t  width;
+  int32_t  count   = 0;
+  float average = 0;
+
+  /* skip first pulse for phase independance */
+  getPulseWidth(dec,buffer,index,size);
+
+  while (*index<size) {
+
+    width=getPulseWidth(dec,buffer,index,size);
+
+    if (average && width>(float)average*dec->window ) {
+
+	*index-=width;
+	return average;
+    }
+
+    /* average=(count*average+width)/++count; */
+    count++; average=((count-1)*average+width)/count;
+  }
+
+  return average;
+}
+
+/* Decode one byte from FSK audio: 1 start + 8 data (LSB first) + 2 stop bits
+ * Returns: byte value (0-255) on success, -1 on error */
+int readByte(const Decoder *dec, const int8_t *buffer, int32_t *index, int32_t size,
+             float average)
+{
+  int  bit;
+  int32_t width;
+  int  value = 0;
+  int  i;
+
+  /* Read start bit (should be long pulse) */
+  width=getPulseWidth(dec,buffer,index,size);
+  if (isSilence(dec,buffer,*index,size) ||
+      width<average*dec->window) return -1;
+
+  /* Read 8 data bits (LSB first): short pulse = 1, long pulse = 0 */
+  for (bit=0;bit<8;bit++) {
+
+    width=getPulseWidth(dec,buffer,index,size);
+    if (isSilence(dec,buffer,*index,size)) return -1;
+
+    /* Short pulse indicates bit = 1 */
+    if (width<average*dec->window) {
+
+      value+=(1<<bit);
+      getPulseWidth(dec,buffer,index,size); /* skip 2nd short pulse */
+      if (isSilence(dec,buffer,*index,size)) return -1;
+    }
+  }
+
+  /* Read two stop bits (four short pulses total) */
+  for (i=0;i<3;i++) {
+
+    getPulseWidth(dec,buffer,index,size);
+    if (isSilence(dec,buffer,*index,size)) return -1;
+  }
+  getPulseWidth(dec,buffer,index,size);
+
+  return value;
+}
+
+/* Wait for more than avail samples: at least as many again as the step
+ * from index has used, so a step over a long stretch of the tape is not
+ * run again for every chunk that arrives */
+static int32_t moreSamples(const Mark *ready, int32_t index, int32_t avail, int32_t size)
+{
+  int32_t want = avail + (avail-index > READ_FRAMES ? avail-index : READ_FRAMES);
+
+  return markWait(ready, want > avail && want < size ? want : size);
+}
+
+/* Run a kernel call on the samples ready so far (avail of them); if it ran
+ * into their end while more are coming, wait for them and run it again
+ * from the same index, counting only the run kept in --stats. With every
+ * sample ready it is just the call. */
+#define FEED(call)                                                  \
+  do {                                                              \
+    int32_t from_ = index;                                          \
+    uint64_t held_[COUNTER_COUNT];                                  \
+    for (;;) {                                                      \
+      if (avail == size) { call; break; }                           \
+      reached_end = false;                                          \
+      if (stats_enabled) statsHold(held_);                          \
+      call;                                                         \
+      if (stats_enabled) statsRelease(!reached_end);                \
+      if (!reached_end) break;                                      \
+      index = from_;                                                \
+      avail = moreSamples(ready, from_, avail, size);               \
+    }                                                               \
+  } while (0)
+
+/* Extract every data block that follows a sync header from filtered
+ * samples; ready, if given, counts the samples filtered so far. Inlined
+ * so the calls without it lose the FEED checks. */
+__attribute__((always_inline))
+static inline int32_t decodeSamples(const Decoder *dec, const int8_t *buffer, int32_t size,
+                             int32_t frequency, FILE *output, FILE *log, const Mark *ready)
+{
+  int32_t index,written,block,avail;
+  uint64_t start;
+  float average;       /* Average pulse width */
+  int   data;
+  bool  header;        /* Track if CAS header has been written */
+  bool  silent,found;
+  Stage stage;
+
+  stage=statsEnter(STAGE_HEADER);
+  avail = ready ? markWait(ready,0) : size;
+
+  if (log) fprintf(log,"Decoding audio data...\n");
+
+  /* Skip initial silence */
+  written=index=0;
+  FEED(skipSilence(dec,buffer,&index,avail));
+
+  header=false;
+  /* Loop through audio data and extract contents */
+  for (;index<size;index++) {
+
+    /* Detect and skip silent parts */
+    FEED(silent=isSilence(dec,buffer,index,avail));
+    if (silent) {
+
+      if (log) fprintf(log,"[%.1f] skipping silence\n",(double)index/frequency);
+      FEED(skipSilence(dec,buffer,&index,avail));
+    }
+
+    /* Detect header and process the data block that follows */
+    FEED(found=isHeader(dec,buffer,index,avail));
+    if (found) {
+
+      if (log) fprintf(log,"[%.1f] header detected\n",(double)index/frequency);
+      start=traceStart();
+      FEED(average=skipHeader(dec,buffer,&index,avail));
+      STATS_ADD(COUNT_HEADERS,1);
+
+      /* Write CAS header if not already written */
+      if (!header) {
+
+	/* CAS headers must be 8-byte aligned */
+	for (;written&7;written++) putc(0x00,output);
+
+	/* write a .cas header */
+	fwrite(HEADER,1,sizeof(HEADER),output);
+	written+=8;
+	header=true;
+      }
+
+      if (log) fprintf(log,"[%.1f] data block\n",(double)index/frequency);
+
+      statsEnter(STAGE_DECODE);
+      block=written;
+      for (;;) {
+	FEED(silent=isSilence(dec,buffer,index,avail));
+	if (silent || index>=size) break;
+	FEED(data=readByte(dec,buffer,&index,avail,average));
+	if (data<0) break;
+	putc(data,output); written++; header=false;
+      }
+      STATS_ADD(COUNT_BYTES_DECODED,written-block);
+      traceSpan("block","decode",NULL,start);
+      statsEnter(STAGE_HEADER);
+
+    } else {
+
+      /* Data found without header - skip it */
+      if (log) fprintf(log,"[%.1f] skipping headerless data\n",(double)index/frequency);
+      for (;;) {
+	FEED(silent=isSilence(dec,buffer,index,avail));
+	if (silent || index>=size) break;
+	index++;
+      }
+    }
+
+  }
+
+  statsEnter(stage);
+  return written;
+}
+
+/* Decode a whole recording: apply the signal corrections, then extract
+ * every data block that follows a sync header */
+int32_t decodeTape(const Decoder *dec, int8_t *buffer, int32_t size, int32_t frequency,
+                   FILE *output, FILE *log)
+{
+  int32_t written;
+  int   i;
+  Stage stage;
+
+  /* Apply signal processing */
+  stage=statsEnter(STAGE_FILTER);
+  if (dec->normalize) normalizeAmplitude(buffer,size);
+  for(i=0;i<dec->envelope;i++) correctEnvelope(buffer,size);
+
+  written=decodeSamples(dec,buffer,size,frequency,output,log,NULL);
+  statsEnter(stage);
+  return written;
+}
+
+/* decodeTapeStream: read -> ring of PCM chunks -> convert -> converted
+ * mark -> filter -> filtered mark -> decode. The samples stay in one
+ * buffer; the marks tell the next stage how much of it it may use. */
+typedef struct {
+  const Decoder *dec;
+  FILE *wav_file;
+  const TapeFormat *format;
+  int8_t *buffer;
+  Ring raw;
+  Mark converted;
+  Mark filtered;
+} Pipeline;
+
+static void readStage(Pipeline *p)
+{
+  Stage stage;
+  int32_t i;
+
+  stage=statsEnter(STAGE_READ);
+  for (i=0;i<p->format->samples;i+=READ_FRAMES) {
+    readChunk(p->wav_file,p->format,ringProduce(&p->raw),chunkFrames(p->format,i));
+    ringPublish(&p->raw);
+  }
+  statsEnter(stage);
+}
+
+static void convertStage(Pipeline *p)
+{
+  const TapeFormat *format = p->format;
+  Stage stage;
+  int32_t i;
+
+  stage=statsEnter(STAGE_CONVERT);
+  for (i=0;i<format->samples;i+=READ_FRAMES) {
+    int32_t count = chunkFrames(format,i);
+
+    convertSamples(ringConsume(&p->raw),count,format->frame_size,format->bits,
+                   p->dec->phase,p->buffer+i);
+    ringRelease(&p->raw);
+    markPublish(&p->converted,i+count);
+  }
+  statsEnter(stage);
+}
+
+/* Normalizing needs the peak of the whole tape, so it waits for every
+ * sample. The envelope filter follows the converter: each output needs
+ * the next input, and the last sample is left as it is. */
+static void filterStage(Pipeline *p)
+{
+  int32_t size = p->format->samples;
+  int32_t ready = 0, done = 1, end;
+  Stage stage;
+
+  stage=statsEnter(STAGE_FILTER);
+  if (p->dec->normalize) {
+    ready=markWait(&p->converted,size);
+    normalizeAmplitude(p->buffer,size);
+  }
+
+  for (;;) {
+    ready=markWait(&p->converted,ready<size ? ready+1 : size);
+    if (p->dec->envelope) {
+      end = ready<size ? ready-1 : size-1;
+      if (end>done) {
+	correctEnvelope(p->buffer+done-1,end-done+2);
+	done=end;
+      }
+      markPublish(&p->filtered,ready<size ? done : size);
+    } else {
+      markPublish(&p->filtered,ready);
+    }
+    if (ready>=size) break;
+  }
+  statsEnter(stage);
+}
+
+static void *readThread(void *arg)
+{
+  traceThread("read");
+  readStage((Pipeline*)arg);
+  return NULL;
+}
+
+static void *convertThread(void *arg)
+{
+  traceThread("convert");
+  convertStage((Pipeline*)arg);
+  return NULL;
+}
+
+static void *filterThread(void *arg)
+{
+  traceThread("filter");
+  filterStage((Pipeline*)arg);
+  return NULL;
+}
+
+int32_t decodeTapeStream(const Decoder *dec, FILE *wav_file, const TapeFormat *format,
+                         FILE *output, FILE *log)
+{
+  Pipeline p;
+  pthread_t read_tid, convert_tid, filter_tid;
+  bool filter = dec->normalize || dec->envelope;
+  bool read_thread, convert_thread, filter_thread;
+  int32_t written;
+
+  p.dec=dec;
+  p.wav_file=wav_file;
+  p.format=format;
+  p.converted.value=0;
+  p.filtered.value=0;
+  if ((p.buffer=(int8_t*)malloc(format->samples*sizeof(int8_t)))==NULL)
+    return TAPE_ERROR_MEMORY;
+  if (ringInit(&p.raw,RING_SLOTS,(size_t)READ_FRAMES*format->frame_size)<0) {
+    free(p.buffer);
+    return TAPE_ERROR_MEMORY;
+  }
+
+  /* Start the stages from the last one back, each only if every stage
+   * after it has a thread: a stage left to this thread then never waits
+   * for one that is not running */
+  filter_thread = filter && pthread_create(&filter_tid,NULL,filterThread,&p)==0;
+  convert_thread = (filter_thread || !filter) &&
+                   pthread_create(&convert_tid,NULL,convertThread,&p)==0;
+  read_thread = convert_thread && pthread_create(&read_tid,NULL,readThread,&p)==0;
+
+  if (!convert_thread)
+    readSamples(dec,wav_file,format,p.raw.slots,p.buffer,&p.converted);
+  else if (!read_thread)
+    readStage(&p);
+  if (filter && !filter_thread)
+    filterStage(&p);
+
+  written=decodeSamples(dec,p.buffer,format->samples,format->frequency,output,log,
+                        filter ? &p.filtered : &p.converted);
+
+  if (read_thread) pthread_join(read_tid,NULL);
+  if (convert_thread) pthread_join(convert_tid,NULL);
+  if (filter_thread) pthread_join(filter_tid,NULL);
+  ringFree(&p.raw);
+  free(p.buffer);
+  return written;
+}
@@ -0,0 +1,207 @@
+#ifndef WAVLIB_H
+#define WAVLIB_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct Arena;
+
+/* Detection thresholds for signal processing */
+#define THRESHOLD_SILENCE   100  /* Min consecutive samples to detect silence */
+#define THRESHOLD_HEADER    25   /* Min pulses to detect sync header */
+
+/* Decoder settings (wav2cas command-line options) */
+typedef struct {
+  int   threshold;   /* Amplitude threshold */
+  bool  envelope;    /* Envelope correction */
+  bool  normalize;   /* Amplitude normalize */
+  bool  phase;       /* Phase shift */
+  float window;      /* Window factor: pulses wider than average*window are long */
+} Decoder;
+
+/* tapeRead errors */
+#define TAPE_ERROR_IO       -1   /* File missing, unreadable or too short */
+#define TAPE_ERROR_FORMAT   -2   /* Not a PCM WAV file */
+#define TAPE_ERROR_MEMORY   -3   /* Sample buffer allocation failed */
+
+/* wav2cas defaults */
+#define DECODER_DEFAULTS  { 5, true, false, true, 1.5 }
+
+/* Format of a WAV file (tapeReadHeader) */
+typedef struct {
+  int32_t frequency;   /* Sample rate in Hz */
+  int32_t samples;     /* Sample frames in the data chunk */
+  int     frame_size;  /* Bytes per frame */
+  int     bits;        /* Bits per sample */
+  int     channels;
+} TapeFormat;
+
+/**
+ * Read the header of a WAV file up to its sample data.
+ *
+ * @param wav_file Stream positioned at the RIFF header; left at the samples
+ * @param name     Name shown in the log
+ * @param format   Set to the format of the file
+ * @param log      Stream for the format of the file, or NULL
+ * @return Sample rate in Hz, or a negative TAPE_ERROR_* code
+ */
+int tapeReadHeader(FILE *wav_file, const char *name, TapeFormat *format, FILE *log);
+
+/**
+ * Read a WAV file into an 8-bit signed mono sample buffer.
+ *
+ * @param dec      Decoder settings (phase)
+ * @param filename WAV file to read
+ * @param buffer   Set to a malloc'ed buffer of samples
+ * @param size     Set to the number of samples
+ * @param log      Stream for the format of the file, or NULL
+ * @return Sample rate in Hz, or a negative TAPE_ERROR_* code
+ */
+int tapeRead(const Decoder *dec, const char *filename, int8_t **buffer, int32_t *size,
+             FILE *log);
+
+/**
+ * Read a WAV file from an open stream, as tapeRead. The stream is left
+ * open; fmemopen gives a stream on a WAV file already in memory.
+ *
+ * @param dec      Decoder settings (phase)
+ * @param wav_file Stream positioned at the RIFF header
+ * @param name     Name shown in the log
+ * @param buffer   Set to a malloc'ed buffer of samples
+ * @param size     Set to the number of samples
+ * @param log      Stream for the format of the file, or NULL
+ * @return Sample rate in Hz, or a negative TAPE_ERROR_* code
+ */
+int tapeReadStream(const Decoder *dec, FILE *wav_file, const char *name, int8_t **buffer,
+                   int32_t *size, FILE *log);
+
+/**
+ * Read a WAV file from an open stream, as tapeReadStream, with the sample
+ * and conversion buffers taken from an arena: nothing to free, and no new
+ * pages to fault in when the arena is reset and reused for the next file.
+ * For the tools (arena.h): libcastools.so does not export it.
+ *
+ * @param dec      Decoder settings (phase)
+ * @param wav_file Stream positioned at the RIFF header
+ * @param name     Name shown in the log
+ * @param arena    Arena for the buffers
+ * @param buffer   Set to the samples, valid until the arena is reset
+ * @param size     Set to the number of samples
+ * @param log      Stream for the format of the file, or NULL
+ * @return Sample rate in Hz, or a negative TAPE_ERROR_* code
+ */
+int tapeReadArena(const Decoder *dec, FILE *wav_file, const char *name, struct Arena *arena,
+                  int8_t **buffer, int32_t *size, FILE *log);
+
+/**
+ * Convert PCM sample frames to 8-bit signed mono: the most significant
+ * byte of the last channel of every frame, sign-adjusted for 8-bit
+ * (unsigned) data and negated when phase is set.
+ *
+ * @param raw    PCM data, count frames of frame_size bytes
+ * @param count  Number of frames
+ * @param frame_size Bytes per frame (channels * bytes per sample)
+ * @param bits   Bits per sample (8 or 16)
+ * @param phase  Negate the samples
+ * @param out    count samples
+ */
+void convertSamples(const unsigned char *raw, int32_t count, int frame_size, int bits,
+                    bool phase, int8_t *out);
+
+/**
+ * Smooth the signal with a weighted moving average (0.5, 1.0, 2.0), in place.
+ *
+ * @param buffer Samples
+ * @param size   Number of samples
+ */
+void correctEnvelope(int8_t *buffer, int32_t size);
+
+/**
+ * Scale the signal so its peak reaches +-127, in place.
+ *
+ * @param buffer Samples
+ * @param size   Number of samples
+ */
+void normalizeAmplitude(int8_t *buffer, int32_t size);
+
+/**
+ * Check for THRESHOLD_SILENCE samples below the threshold from index.
+ *
+ * @return true if the signal is silent at index
+ */
+bool isSilence(const Decoder *dec, const int8_t *buffer, int32_t index, int32_t size);
+
+/**
+ * Advance index past samples below the threshold.
+ */
+void skipSilence(const Decoder *dec, const int8_t *buffer, int32_t *index, int32_t size);
+
+/**
+ * Measure the width of the pulse at index, from minimum to minimum.
+ *
+ * @param index Advanced to the start of the next pulse
+ * @return Pulse width in samples
+ */
+int32_t getPulseWidth(const Decoder *dec, const int8_t *buffer, int32_t *index, int32_t size);
+
+/**
+ * Check for a sync header: THRESHOLD_HEADER pulses of similar width.
+ *
+ * @return true if a sync header starts at index
+ */
+bool isHeader(const Decoder *dec, const int8_t *buffer, int32_t index, int32_t size);
+
+/**
+ * Skip a sync header.
+ *
+ * @param index Advanced to the first pulse after the header
+ * @return Average pulse width of the header (a 1-bit pulse)
+ */
+float skipHeader(const Decoder *dec, const int8_t *buffer, int32_t *index, int32_t size);
+
+/**
+ * Decode one byte: start bit, 8 data bits LSB first, two stop bits.
+ *
+ * @param index   Advanced past the byte
+ * @param average Pulse width of a 1-bit (see skipHeader)
+ * @return Byte value, or -1 on silence or a missing start bit
+ */
+int readByte(const Decoder *dec, const int8_t *buffer, int32_t *index, int32_t size,
+             float average);
+
+/**
+ * Decode a recording into CAS data, as wav2cas does: normalize and envelope
+ * correction as set in dec (both in place), then every data block that
+ * follows a sync header, with a HEADER written at the next 8-byte aligned
+ * offset before each block.
+ *
+ * @param dec       Decoder settings
+ * @param buffer    Samples (see tapeRead and convertSamples), modified
+ * @param size      Number of samples
+ * @param frequency Sample rate in Hz, for the log timestamps
+ * @param output    Stream for the CAS data
+ * @param log       Stream for progress messages, or NULL
+ * @return Number of bytes written to output
+ */
+int32_t decodeTape(const Decoder *dec, int8_t *buffer, int32_t size, int32_t frequency,
+                   FILE *output, FILE *log);
+
+/**
+ * Read and decode the samples of a WAV file, as tapeReadStream and
+ * decodeTape, with the stages overlapped: reading, conversion, filtering
+ * and decoding each run on their own thread and hand samples on as soon
+ * as they are ready, so a long recording takes about as long as its
+ * slowest stage. The output is the same as decodeTape gives.
+ *
+ * @param dec      Decoder settings
+ * @param wav_file Stream positioned at the samples (see tapeReadHeader)
+ * @param format   Format of the file
+ * @param output   Stream for the CAS data
+ * @param log      Stream for progress messages, or NULL
+ * @return Number of bytes written to output, or TAPE_ERROR_MEMORY
+ */
+int32_t decodeTapeStream(const Decoder *dec, FILE *wav_file, const TapeFormat *format,
+                         FILE *output, FILE *log);
+
+#endif /* WAVLIB_H */
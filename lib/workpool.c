@@ -0,0 +1,156 @@
+/**************************************************************************/
+/*                                                                        */
+/* file:         workpool.c                                               */
+/* description:  Worker pool delivering results in submission order      */
+/*                                                                        */
+/**************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "workpool.h"
+#include "trace.h"
+
+/* Items a worker may run ahead of the in-order consumer */
+#define ITEMS_PER_THREAD  4
+
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t  ready_cond;   /* Signalled when an item completes */
+  pthread_cond_t  space_cond;   /* Signalled when the consumer frees a slot */
+  size_t count;                 /* Total items */
+  size_t next;                  /* Next item to hand out */
+  size_t consumed;              /* Items passed to done so far */
+  size_t window;                /* Result slots */
+  size_t result_size;
+  unsigned char *results;       /* window * result_size bytes */
+  unsigned char *ready;         /* Per slot completion flags */
+  WorkFunc work;
+  void *ctx;
+} Pool;
+
+/* Number of online CPUs */
+int defaultWorkerCount(void)
+{
+#ifndef _WIN32
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+  /* MinGW has no sysconf */
+  SYSTEM_INFO info;
+  long cpus;
+
+  GetSystemInfo(&info);
+  cpus = info.dwNumberOfProcessors;
+#endif
+  return cpus > 0 ? (int)cpus : 1;
+}
+
+/* Worker thread: take the next item while there is room in the window */
+static void *worker(void *arg)
+{
+  Pool *pool = (Pool*)arg;
+
+  traceThread("worker");
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    /* Blocked on the consumer: show it in traces */
+    if (pool->next < pool->count && pool->next - pool->consumed >= pool->window) {
+      uint64_t start = traceStart();
+      while (pool->next < pool->count && pool->next - pool->consumed >= pool->window)
+        pthread_cond_wait(&pool->space_cond, &pool->lock);
+      traceSpan("wait", "window full", NULL, start);
+    }
+    if (pool->next >= pool->count)
+      break;
+
+    size_t item = pool->next++;
+    void *result = pool->results + (item % pool->window) * pool->result_size;
+    pthread_mutex_unlock(&pool->lock);
+
+    memset(result, 0, pool->result_size);
+    pool->work(pool->ctx, item, result);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->ready[item % pool->window] = 1;
+    pthread_cond_signal(&pool->ready_cond);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+/* Run items on worker threads, consuming results in order */
+int runOrdered(size_t count, int threads, size_t result_size,
+               WorkFunc work, DoneFunc done, void *ctx)
+{
+  Pool pool;
+  pthread_t *tids;
+  int started = 0;
+
+  if (threads < 1)
+    threads = defaultWorkerCount();
+  if ((size_t)threads > count)
+    threads = count ? (int)count : 1;
+
+  memset(&pool, 0, sizeof(pool));
+  pool.count = count;
+  pool.window = threads * ITEMS_PER_THREAD;
+  pool.result_size = result_size ? result_size : 1;
+  pool.work = work;
+  pool.ctx = ctx;
+  pool.results = (unsigned char*)malloc(pool.window * pool.result_size);
+  pool.ready = (unsigned char*)calloc(pool.window, 1);
+  tids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+  if (pool.results == NULL || pool.ready == NULL || tids == NULL) {
+    free(pool.results);
+    free(pool.ready);
+    free(tids);
+    return -1;
+  }
+
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.ready_cond, NULL);
+  pthread_cond_init(&pool.space_cond, NULL);
+
+  for (int i = 0; i < threads; i++)
+    if (pthread_create(&tids[i], NULL, worker, &pool) == 0)
+      started++;
+
+  /* Stream results back in item order */
+  for (size_t item = 0; started && item < count; item++) {
+    size_t slot = item % pool.window;
+
+    pthread_mutex_lock(&pool.lock);
+    if (!pool.ready[slot]) {
+      uint64_t start = traceStart();
+      while (!pool.ready[slot])
+        pthread_cond_wait(&pool.ready_cond, &pool.lock);
+      traceSpan("wait", "next result", NULL, start);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    done(ctx, item, pool.results + slot * pool.result_size);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.ready[slot] = 0;
+    pool.consumed++;
+    pthread_cond_broadcast(&pool.space_cond);
+    pthread_mutex_unlock(&pool.lock);
+  }
+
+  for (int i = 0; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  pthread_cond_destroy(&pool.space_cond);
+  pthread_cond_destroy(&pool.ready_cond);
+  pthread_mutex_destroy(&pool.lock);
+  free(pool.results);
+  free(pool.ready);
+  free(tids);
+
+  return started ? 0 : -1;
+}
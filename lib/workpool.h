@@ -0,0 +1,37 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <stddef.h>
+
+/* Process one item; result points to result_size zeroed bytes for it */
+typedef void (*WorkFunc)(void *ctx, size_t item, void *result);
+
+/* Consume the result of one item; called in item order */
+typedef void (*DoneFunc)(void *ctx, size_t item, void *result);
+
+/**
+ * Return the number of online CPUs (at least 1).
+ *
+ * @return Default worker count
+ */
+int defaultWorkerCount(void);
+
+/**
+ * Run count items on a pool of worker threads and hand the results back
+ * in item order.
+ * Workers pick items in increasing order and may run at most a few items
+ * per thread ahead of the consumer, so memory stays bounded however many
+ * items there are. The done callback runs on the calling thread.
+ *
+ * @param count       Number of items
+ * @param threads     Worker threads (values < 1 use defaultWorkerCount)
+ * @param result_size Size of the per-item result passed to work and done
+ * @param work        Called on a worker thread for every item
+ * @param done        Called on the calling thread, in item order
+ * @param ctx         Opaque pointer passed to both callbacks
+ * @return 0 on success, -1 if threads or memory could not be allocated
+ */
+int runOrdered(size_t count, int threads, size_t result_size,
+               WorkFunc work, DoneFunc done, void *ctx);
+
+#endif /* WORKPOOL_H */
@@ -23,332 +23,74 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <errno.h>
 #include <string.h>
 #include <memory.h>
 #include "lib/caslib.h"
-
-/* Detection thresholds for signal processing */
-#define THRESHOLD_SILENCE   100  /* Min consecutive samples to detect silence */
-#define THRESHOLD_HEADER    25   /* Min pulses to detect sync header */
+#include "lib/wavlib.h"
+#include "lib/stats.h"
+#include "lib/trace.h"
 
 /* Command-line configurable parameters */
-/* default arguments */
-int   threshold = 5;     /* amplitude threshold  */
-bool  envelope  = 2;     /* envelope correction  */
-bool  normalize = false; /* amplitude normalize  */
-bool  phase     = true;  /* phase shift */
-float window    = 1.5;   /* window factor */
-
-/* Read WAV file and convert to 8-bit mono signed PCM buffer
- * Returns: sample rate (Hz) on success, -1 on error */
-int tapeRead(char* szFileName, int8_t** pBuffer, int32_t *size)
-{
-  FILE* wav_file;
-  /* Note: Using only RIFF header fields, not including data chunk */
-  struct {
-    char     RiffID[4];
-    uint32_t RiffSize;
-    char     WaveID[4];
-    char     FmtID[4];
-    uint32_t FmtSize;
-    uint16_t wFormatTag;
-    uint16_t nChannels;
-    uint32_t nSamplesPerSec;
-    uint32_t nAvgBytesPerSec;
-    uint16_t nBlockAlign;
-    uint16_t wBitsPerSample;
-  } header;
-  WAVE_BLOCK  block;
-
-  int  adder;
-  int32_t i,j,pos;
-  int8_t data;
-  bool found;
-
-  if ((wav_file=fopen(szFileName,"rb"))==NULL) return -1;
-
-  fread(&header,sizeof(header),1,wav_file);
-
-  /* Calculate bytes per sample frame (channels × bytes/sample) */
-  adder=header.nChannels*(header.wBitsPerSample/8);
-
-  /* Search for "data" chunk (may not be at fixed position in some WAV files) */
-  found = false;
-  pos = ftell(wav_file);
-  while(fread(&block,sizeof(block),1,wav_file))
-    if (!strncmp(block.DataID,"data",4)) {
-      *size=block.nDataBytes/adder ;
-      *pBuffer=(int8_t*)malloc(*size*sizeof(int8_t));
-      found = true;
-      break;
-    } else {
-      fseek(wav_file,pos++,SEEK_SET);
-    }
-
-  /* Basic error handling */
-  if (!found) {
-    fprintf(stderr,"Incorrect wav header!\n");
-    return -1;
-  }
-
-  if (*pBuffer==NULL) {
-    fprintf(stderr,"Not enough memory!\n");
-    return -1;
-  }
-
-  /* Show wav info */
-  printf("Reading %s (%d Hz, %d-bits, %s)...\n",
-	 szFileName,
-	 (int)header.nSamplesPerSec,
-	 (int)header.wBitsPerSample,
-	 header.nChannels==1 ? "mono" : "stereo" );
-
-  /* Read audio samples and convert to 8-bit signed mono */
-  for (i=0;i<(*size);i++) {
-
-    for (j=1; j<adder; j++) fread(&data,sizeof(int8_t),1,wav_file);  /* Skip extra channels/bytes */
-    fread(&data,sizeof(int8_t),1,wav_file);  /* Read one sample */
-    if (header.wBitsPerSample==8) data^=128;  /* Convert unsigned to signed */
-    if (phase) data=-data;  /* Apply phase shift if enabled */
-    (*pBuffer)[i]=data;
-  }
-
-  fclose(wav_file);
-  return header.nSamplesPerSec;
-}
-
-/* Apply envelope correction using weighted moving average to reduce noise */
-void correctEnvelope(int8_t **buffer,int32_t size)
-{
-  int32_t i;
-  for (i=1;i<size-1;i++)
-
-    (*buffer)[i] = ( 0.5*(*buffer)[i-1] +
-		     1.0*(*buffer)[i]   +
-		     2.0*(*buffer)[i+1]   ) / 3.5;
-}
-
-/* Normalize amplitude to maximize signal level (scale to ±127) */
-void normalizeAmplitude(int8_t **buffer,int32_t size)
-{
-  int32_t i;
-  int  maximum=0;
-  /* Find peak amplitude */
-  for (i=0;i<size;i++)
-    if (abs((*buffer)[i])>maximum) maximum=abs((*buffer)[i]);
-  /* Scale all samples to use full dynamic range */
-  for (i=0;i<size;i++) (*buffer)[i]*=127/(float)maximum;
-}
-
-/* Check if audio is silent starting at index (below threshold for THRESHOLD_SILENCE samples) */
-bool isSilence(int8_t *buffer,int32_t index,int32_t size)
-{
-  int32_t silent=0;
-
-  while (index<size && silent<THRESHOLD_SILENCE) {
-
-    if ((buffer[index] >= threshold ||
-	 buffer[index] <= -threshold )) return false;
-
-    silent++; index++;
-  }
-
-  return true;
-}
-
-/* Advance index past silent samples (below threshold) */
-void skipSilence(int8_t *buffer, int32_t *index, int32_t size)
-{
-  while(*index<size &&
-	(buffer[*index] <= threshold &&
-	 buffer[*index] >= -threshold )) (*index)++;
-}
-
-/* Measure pulse width in samples by detecting zero-crossing */
-int32_t getPulseWidth(int8_t *buffer, int32_t *index, int32_t size)
-{
-  int min = 1000;   /* Track minimum amplitude */
-  int max =-1000;   /* Track maximum amplitude */
-  int pt  = max;    /* Peak tracking */
-
-  int prev = *index > 0 ? buffer[(*index)-1] : 0;
-
-  int32_t width = 0;
-  for(;*index<size;width++) {
-
-    /* Signal ascending */
-    if (buffer[*index]>prev) {
-
-      if (prev==min) {
-
-	if (pt-min>=threshold) {
-
-	  while(width>1) {
-
-	    if (buffer[*index]>=pt-(pt-min)/2) break;
-	    width--; (*index)--;
-	  }
-
-	  return width;
-	}
-
-	min=1000;
-      }
-
-      if (buffer[*index]>max) max=buffer[*index];
-    }
-
-    /* Signal descending */
-    if (buffer[*index]<prev) {
-
-      if (prev==max) {
-
-	if (max>pt) pt=max;
-	max=-1000;
-      }
-
-      if (buffer[*index]<min) min=buffer[*index];
-    }
-
-    prev=buffer[(*index)++];
-  }
-
-  return width;
-}
-
-/* Detect sync header by finding THRESHOLD_HEADER pulses of similar width */
-bool isHeader(int8_t *buffer, int32_t index, int32_t size)
-{
-
-  int32_t width;
-  int32_t pulses  = 0;
-  int32_t biggest = 0;
-
-  /* skip first pulse for phase independance */
-  getPulseWidth(buffer,&index,size);
-
-  while (index<size && pulses<THRESHOLD_HEADER ) {
-
-    width = getPulseWidth(buffer,&index,size);
-    if (!biggest) biggest=width;
-    if (width>(float)biggest*window) return false;
-    if (width>biggest) biggest = width;
-    pulses++;
-  }
-
-  if (pulses>=THRESHOLD_HEADER) return true;
-
-  return false;
-}
-
-/* Skip sync header and return average pulse width (for bit detection) */
-float skipHeader(int8_t *buffer, int32_t *index, int32_t size)
-{
-
-  int32_t  width;
-  int32_t  count   = 0;
-  float average = 0;
-
-  /* skip first pulse for phase independance */
-  getPulseWidth(buffer,index,size);
-
-  while (*index<size) {
-
-    width=getPulseWidth(buffer,index,size);
-
-    if (average && width>(float)average*window ) {
-
-	*index-=width;
-	return average;
-    }
-
-    /* average=(count*average+width)/++count; */
-    count++; average=((count-1)*average+width)/count;
-  }
-
-  return average;
-}
-
-/* Decode one byte from FSK audio: 1 start + 8 data (LSB first) + 2 stop bits
- * Returns: byte value (0-255) on success, -1 on error */
-int readByte(int8_t *buffer, int32_t *index, int32_t size, float average)
-{
-  int  bit;
-  int32_t width;
-  int  value = 0;
-  int  i;
-
-  /* Read start bit (should be long pulse) */
-  width=getPulseWidth(buffer,index,size);
-  if (isSilence(buffer,*index,size) ||
-      width<average*window) return -1;
-
-  /* Read 8 data bits (LSB first): short pulse = 1, long pulse = 0 */
-  for (bit=0;bit<8;bit++) {
-
-    width=getPulseWidth(buffer,index,size);
-    if (isSilence(buffer,*index,size)) return -1;
-
-    /* Short pulse indicates bit = 1 */
-    if (width<average*window) {
-
-      value+=(1<<bit);
-      getPulseWidth(buffer,index,size); /* skip 2nd short pulse */
-      if (isSilence(buffer,*index,size)) return -1;
-    }
-  }
-
-  /* Read two stop bits (four short pulses total) */
-  for (i=0;i<3;i++) {
-
-    getPulseWidth(buffer,index,size);
-    if (isSilence(buffer,*index,size)) return -1;
-  }
-  getPulseWidth(buffer,index,size);
-
-  return value;
-}
+static Decoder dec = DECODER_DEFAULTS;
 
 /* Display usage information and command-line options */
 void showUsage(char *progname)
 {
-  printf("usage: %s [-np] [-t threshold] [-w window] [-e envelope] <ifile> <ofile>\n"
+  printf("usage: %s [-np] [-t threshold] [-w window] [-e envelope] [--stats[=json]]\n"
+	 "       [--perf-counters] [--trace file] [--serial] <ifile> <ofile>\n"
 	 " -n   normalize amplitude level\n"
 	 " -p   phase shift signal\n"
 	 " -w   window factor (default:%.1f)\n"
 	 " -e   level of envelope correction (default:%d)\n"
 	 " -t   threshold factor (default:%d)\n"
-	 ,progname,window,envelope,threshold);
+	 " --stats  print time per stage and counters to stderr (text or json)\n"
+	 " --perf-counters  add cycles, instructions, cache and branch misses\n"
+	 "          per stage to the --stats report (Linux perf_event_open)\n"
+	 " --trace  write a Chrome trace-event file of the conversion\n"
+	 " --serial read, filter and decode one after the other on one thread\n"
+	 "          (default: a thread per stage, overlapped)\n"
+	 ,progname,dec.window,dec.envelope,dec.threshold);
 }
 
 
 
 int main(int argc, char* argv[])
 {
+  FILE *input = NULL;
   FILE *output;
   int8_t *buffer;      /* Audio sample buffer */
-  int32_t frequency,size,index,written;
-  float average;       /* Average pulse width */
-  int   data,i,j;
-  bool  header;        /* Track if CAS header has been written */
+  int32_t frequency,size;
+  TapeFormat format;
+  int   i,j;
 
   char  *ifile = NULL;  /* Input WAV filename */
   char  *ofile = NULL;  /* Output CAS filename */
+  StatsFormat stats = STATS_OFF;
+  bool  perf = false;   /* Hardware events per stage */
+  char  *tfile = NULL;  /* Trace filename */
+  bool  serial = false; /* One stage after the other */
+  uint64_t start;
 
   /* Parse command line options */
   for (i=1; i<argc; i++) {
 
+    if (statsFormat(argv[i])!=STATS_OFF) { stats=statsFormat(argv[i]); continue; }
+    if (!strcmp(argv[i],"--perf-counters")) { perf=true; continue; }
+    if (!strcmp(argv[i],"--trace") && i+1<argc) { tfile=argv[++i]; continue; }
+    if (!strcmp(argv[i],"--serial")) { serial=true; continue; }
+
     if (argv[i][0]=='-') {
 
       for(j=1;j && argv[i][j]!='\0';j++)
 
 	switch(argv[i][j]) {
 
-	case 'n': normalize=true; break;
-	case 'p': phase=false; break;
-	case 'w': window=atof(argv[++i]);    j=-1; break;
-	case 't': threshold=atoi(argv[++i]); j=-1; break;
-	case 'e': envelope=atoi(argv[++i]);  j=-1; break;
+	case 'n': dec.normalize=true; break;
+	case 'p': dec.phase=false; break;
+	case 'w': dec.window=atof(argv[++i]);    j=-1; break;
+	case 't': dec.threshold=atoi(argv[++i]); j=-1; break;
+	case 'e': dec.envelope=atoi(argv[++i]);  j=-1; break;
 
 	default:
 	  fprintf(stderr,"%s: invalid option\n",argv[0]);
@@ -367,10 +109,29 @@ int main(int argc, char* argv[])
 
   if (ifile==NULL || ofile==NULL) { showUsage(argv[0]); exit(1); }
 
-  /* read the sample data and store it in buffer */
-  frequency=tapeRead(ifile,&buffer,&size);
+  if (perf && stats==STATS_OFF) stats=STATS_TEXT;
+  if (stats!=STATS_OFF) statsStart();
+  if (perf && statsPerfCounters()==0)
+    fprintf(stderr,"%s: hardware counters unavailable (%s)\n",argv[0],strerror(errno));
+  if (tfile!=NULL && traceOpen(tfile)<0) {
+
+    fprintf(stderr,"%s: failed writing %s\n",argv[0],tfile);
+    exit(1);
+  }
+  start=traceStart();
+
+  /* read the sample data and store it in buffer, or only the header when
+   * the samples are read as they are decoded */
+  if (serial)
+    frequency=tapeRead(&dec,ifile,&buffer,&size,stdout);
+  else if ((input=fopen(ifile,"rb"))==NULL)
+    frequency=TAPE_ERROR_IO;
+  else
+    frequency=tapeReadHeader(input,ifile,&format,stdout);
   if (frequency<0) {
 
+    if (frequency==TAPE_ERROR_FORMAT) fprintf(stderr,"Incorrect wav header!\n");
+    if (frequency==TAPE_ERROR_MEMORY) fprintf(stderr,"Not enough memory!\n");
     fprintf(stderr,"%s: failed reading %s\n",argv[0],ifile);
     exit(1);
   }
@@ -382,68 +143,33 @@ int main(int argc, char* argv[])
     exit(1);
   }
 
-  /* Apply signal processing */
-  if (normalize) normalizeAmplitude(&buffer,size);
-  for(i=0;i<envelope;i++) correctEnvelope(&buffer,size);
-
-  printf("Decoding audio data...\n");
-
-  /* Skip initial silence */
-  written=index=0;
-  skipSilence(buffer,&index,size);
+  /* Extract the data blocks */
+  if (serial) {
 
-  header=false;
-  /* Loop through audio data and extract contents */
-  for (;index<size;index++) {
+    decodeTape(&dec,buffer,size,frequency,output,stdout);
+    free(buffer);
+  } else {
 
-    /* Detect and skip silent parts */
-    if (isSilence(buffer,index,size)) {
+    if (decodeTapeStream(&dec,input,&format,output,stdout)<0) {
 
-      printf("[%.1f] skipping silence\n",(double)index/frequency);
-      skipSilence(buffer,&index,size);
+      fprintf(stderr,"Not enough memory!\n");
+      fprintf(stderr,"%s: failed reading %s\n",argv[0],ifile);
+      exit(1);
     }
-
-    /* Detect header and process the data block that follows */
-    if (isHeader(buffer,index,size)) {
-
-      printf("[%.1f] header detected\n",(double)index/frequency);
-      average=skipHeader(buffer,&index,size);
-
-      /* Write CAS header if not already written */
-      if (!header) {
-
-	/* CAS headers must be 8-byte aligned */
-	for (;written&7;written++) putc(0x00,output);
-
-	/* write a .cas header */
-	putc(0x1f,output); putc(0xa6,output);
-	putc(0xde,output); putc(0xba,output);
-	putc(0xcc,output); putc(0x13,output);
-	putc(0x7d,output); putc(0x74,output);
-	written+=8;
-	header=true;
-      }
-
-      printf("[%.1f] data block\n",(double)index/frequency);
-
-      while (!isSilence(buffer,index,size) && index<size) {
-	data=readByte(buffer,&index,size,average);
-	if (data>=0) { putc(data,output); written++; header=false; }
-	else break;
-      }
-
-    } else {
-
-      /* Data found without header - skip it */
-      printf("[%.1f] skipping headerless data\n",(double)index/frequency);
-      while(!isSilence(buffer,index,size) && index<size ) index++;
-    }
-
+    fclose(input);
   }
 
+  statsEnter(STAGE_WRITE);
   fclose(output);
-  free(buffer);
+  statsEnter(STAGE_NONE);
+  traceSpan("file","wav2cas",ifile,start);
 
   printf("All done...\n");
+  if (stats!=STATS_OFF) statsReport(stderr,stats,"wav2cas");
+  if (traceClose()<0) {
+
+    fprintf(stderr,"%s: failed writing %s\n",argv[0],tfile);
+    exit(1);
+  }
   return 0;
 }